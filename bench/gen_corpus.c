@@ -0,0 +1,224 @@
+/*
+Synthetic PNG corpus generator for the pngq benchmarks
+
+The generator writes a deterministic corpus (the same bytes on every run and machine) in four directories,
+one for each kind of workload measured by "pngq_bench":
+    - tiny : many small files with a single IDAT chunk (per-file overhead: open, read, print)
+    - huge : a few large files with a single huge IDAT chunk (CRC throughput)
+    - idat : files with thousands of small IDAT chunks (chunk parsing and per-chunk overhead)
+    - text : files heavy with tEXt chunks (kformat printing)
+The images are valid PNG files: the IDAT chunks hold a zlib stream of stored (uncompressed) deflate blocks with
+the correct Adler-32, and every scanline starts with a filter type byte.
+
+Usage: gen_corpus DIR [--scale=S]
+    DIR is created if it doesn't exist, S (default 1) multiplies the number of tiny files and the size of the huge files.
+
+Notes about the imported libraries:
+    - sys/stat.h : for creating the corpus directories (mkdir)
+    - stdint.h : for the fixed width integer types
+    - ../crc32_tables.h : CRC32 lookup table of pngq, used to write the chunk CRC fields
+
+Compile with: gcc -O2 bench/gen_corpus.c -o gen_corpus
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "../crc32_tables.h"
+
+
+//Deterministic pseudo-random generator (xorshift64*), the corpus doesn't depend on the C library
+static uint64_t rng_state = 0x9E3779B97F4A7C15u;
+
+static uint32_t rng_next(void){
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t)((rng_state * 0x2545F4914F6CDD1Du) >> 32);
+}
+
+//Fill buf[0..len-1] with pseudo-random bytes
+static void rng_fill(unsigned char* buf, size_t len){
+    size_t i = 0;
+    for(; i + 4 <= len; i += 4){
+        uint32_t r = rng_next();
+        memcpy(buf + i, &r, 4);
+    }
+    for(; i < len; i++)
+        buf[i] = (unsigned char)rng_next();
+}
+
+//Update a running CRC with the bytes buf[0..len-1]
+static uint32_t crc_update(uint32_t crc, const unsigned char* buf, size_t len){
+    for(size_t i = 0; i < len; i++)
+        crc = crc_tables[0][(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+//Write a big endian 32 bit value
+static void put_be32(unsigned char* p, uint32_t v){
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+//Write a chunk with its CRC field, return 0 on success
+static int write_chunk(FILE* f, const char* type, const unsigned char* data, uint32_t length){
+    unsigned char header[8], crc_field[4];
+    put_be32(header, length);
+    memcpy(header + 4, type, 4);
+    uint32_t crc = crc_update(0xffffffffu, header + 4, 4);
+    crc = crc_update(crc, data, length) ^ 0xffffffffu;
+    put_be32(crc_field, crc);
+    if(fwrite(header, 8, 1, f) != 1 || (length > 0 && fwrite(data, length, 1, f) != 1) || fwrite(crc_field, 4, 1, f) != 1)
+        return -1;
+    return 0;
+}
+
+//Build the zlib stream of the raw image data raw[0..raw_len-1] with stored deflate blocks, return its length
+//"out" must hold at least raw_len + 6 + 5 bytes per 65535 bytes block
+static size_t zlib_stored(unsigned char* out, const unsigned char* raw, size_t raw_len){
+    size_t pos = 0;
+    out[pos++] = 0x78; // deflate, 32K window
+    out[pos++] = 0x01; // no preset dictionary, check bits
+    size_t done = 0;
+    do{
+        size_t block = raw_len - done > 65535 ? 65535 : raw_len - done;
+        out[pos++] = done + block == raw_len ? 1 : 0; // BFINAL, BTYPE=00 (stored)
+        out[pos++] = (unsigned char)block;
+        out[pos++] = (unsigned char)(block >> 8);
+        out[pos++] = (unsigned char)~block;
+        out[pos++] = (unsigned char)(~block >> 8);
+        memcpy(out + pos, raw + done, block);
+        pos += block;
+        done += block;
+    }while(done < raw_len);
+
+    //Adler-32 of the raw data
+    uint32_t a = 1, b = 0;
+    for(size_t i = 0; i < raw_len; i++){
+        a = (a + raw[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    put_be32(out + pos, b << 16 | a);
+    return pos + 4;
+}
+
+//Write a truecolour 8 bit PNG file of width x height pixels, with the image data split in IDAT chunks of at most
+//"idat_size" bytes and "texts" tEXt chunks before them, return 0 on success
+static int write_png(const char* path, uint32_t width, uint32_t height, size_t idat_size, unsigned int texts){
+    static const unsigned char signature[8] = {0x89,0x50,0x4E,0x47,0x0D,0x0A,0x1A,0x0A};
+    size_t row = 1 + (size_t)width * 3;
+    size_t raw_len = row * height;
+    unsigned char* raw = malloc(raw_len);
+    unsigned char* z = malloc(raw_len + 6 + 5 * (raw_len / 65535 + 1));
+    FILE* f = fopen(path, "wb");
+    int result = -1;
+    if(raw == NULL || z == NULL || f == NULL)
+        goto done;
+
+    //Scanlines of random pixels, each one with a filter type byte (0 to 4)
+    rng_fill(raw, raw_len);
+    for(uint32_t y = 0; y < height; y++)
+        raw[y * row] = (unsigned char)(rng_next() % 5);
+    size_t z_len = zlib_stored(z, raw, raw_len);
+
+    unsigned char ihdr[13];
+    put_be32(ihdr, width);
+    put_be32(ihdr + 4, height);
+    ihdr[8] = 8;    // bit depth
+    ihdr[9] = 2;    // truecolour
+    ihdr[10] = 0;   // compression method
+    ihdr[11] = 0;   // filter method
+    ihdr[12] = 0;   // no interlace
+    if(fwrite(signature, 8, 1, f) != 1 || write_chunk(f, "IHDR", ihdr, 13) != 0)
+        goto done;
+
+    //tEXt chunks: a keyword, a null separator and a text string of random printable characters
+    for(unsigned int t = 0; t < texts; t++){
+        unsigned char text[512];
+        int k = snprintf((char*)text, 80, "Comment%u", t);
+        size_t length = (size_t)k + 1 + 16 + rng_next() % 400;
+        text[k] = '\0';
+        for(size_t i = (size_t)k + 1; i < length; i++)
+            text[i] = (unsigned char)(' ' + rng_next() % 95);
+        if(write_chunk(f, "tEXt", text, (uint32_t)length) != 0)
+            goto done;
+    }
+
+    for(size_t pos = 0; pos < z_len; pos += idat_size){
+        size_t length = z_len - pos > idat_size ? idat_size : z_len - pos;
+        if(write_chunk(f, "IDAT", z + pos, (uint32_t)length) != 0)
+            goto done;
+    }
+    if(write_chunk(f, "IEND", NULL, 0) != 0)
+        goto done;
+    result = 0;
+
+done:
+    if(f != NULL && fclose(f) != 0)
+        result = -1;
+    free(raw);
+    free(z);
+    return result;
+}
+
+//Create the directory "path" if it doesn't exist, return 0 on success
+static int make_dir(const char* path){
+    if(mkdir(path, 0755) != 0 && errno != EEXIST){
+        printf("Error, can't create the directory %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+//Write "count" files named DIR/KIND/NNNNNN.png, return 0 on success
+static int write_kind(const char* dir, const char* kind, unsigned int count, uint32_t width, uint32_t height, size_t idat_size, unsigned int texts){
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, kind);
+    if(make_dir(path) != 0)
+        return -1;
+    for(unsigned int i = 0; i < count; i++){
+        snprintf(path, sizeof(path), "%s/%s/%06u.png", dir, kind, i);
+        if(write_png(path, width, height, idat_size, texts) != 0){
+            printf("Error, can't write the PNG file %s\n", path);
+            return -1;
+        }
+    }
+    printf("%s/%s: %u files\n", dir, kind, count);
+    return 0;
+}
+
+int main(int argc, char* argv[]){
+    if(argc < 2){
+        printf("Error, a directory name is required.Try to use: %s DIR [--scale=S]\n", argv[0]);
+        return 1;
+    }
+    unsigned int scale = 1;
+    for(int i = 2; i < argc; i++){
+        if(strncmp(argv[i], "--scale=", 8) == 0 && atoi(argv[i] + 8) > 0){
+            scale = (unsigned int)atoi(argv[i] + 8);
+            continue;
+        }
+        printf("Error, unknown option %s\n", argv[i]);
+        return 1;
+    }
+
+    if(make_dir(argv[1]) != 0)
+        return 1;
+    //tiny: 2000 files of 8 x 8 pixels
+    //huge: 2 files of about 32 MiB in a single IDAT chunk
+    //idat: 8 files of 512 x 512 pixels in IDAT chunks of 200 bytes (about 3900 chunks)
+    //text: 50 files with 1000 tEXt chunks each
+    if(write_kind(argv[1], "tiny", 2000 * scale, 8, 8, 8192, 0) != 0 ||
+       write_kind(argv[1], "huge", 2, 4096, 2730 * scale, (size_t)1 << 31, 0) != 0 ||
+       write_kind(argv[1], "idat", 8, 512, 512, 200, 0) != 0 ||
+       write_kind(argv[1], "text", 50, 16, 16, 8192, 1000) != 0)
+        return 1;
+    return 0;
+}
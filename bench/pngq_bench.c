@@ -0,0 +1,433 @@
+/*
+Benchmarks of pngq
+
+The benchmarks measure the stages of pngq on a corpus written by "gen_corpus", each kind of file (tiny, huge, idat,
+text) being measured separately:
+    - crc/ENGINE : CRC of the chunks (type and data fields) with every CRC engine supported by the CPU
+    - parse, parse-fread : readPNGfile on each file, in the default mode (mapped, or read whole when small) and with fread
+    - format/FORMATS : print_info on each file already read, with the default formats, formats printing every field
+      and formats dumping the chunk data (_D)
+    - end-to-end : process_png_file on each file, the output is written to /dev/null
+    - end-to-end-jN : the parallel driver with N worker threads (one per CPU)
+Each benchmark is repeated and the best time is kept. The results are printed as a table or, with "--json", as one JSON
+object per line, which can be saved and given to "--compare" on another commit to print the speedup of each benchmark.
+
+Usage: pngq_bench CORPUS_DIR [--repeat=N] [--json] [--compare=RESULTS]
+
+The benchmarks include the pngq library (libpngq.c) and pngq.c with its main function renamed, so they measure the same code
+as the program.
+
+Notes about the imported libraries:
+    - time.h : for the monotonic clock (clock_gettime)
+    - dirent.h : for listing the corpus files (opendir, readdir)
+
+Compile with: gcc -O2 -pthread bench/pngq_bench.c -o pngq_bench
+*/
+
+#include "../libpngq.c"
+
+#define main pngq_main
+#include "../pngq.c"
+#undef main
+
+#include <time.h>
+#include <dirent.h>
+
+
+//Kinds of files of the corpus
+static const char* corpus_kinds[] = {"tiny", "huge", "idat", "text"};
+#define CORPUS_KINDS_NUM (sizeof(corpus_kinds)/sizeof(corpus_kinds[0]))
+
+//Define the struct for the files of a kind of the corpus
+struct corpus{
+    const char* kind;           // kind of files
+    char** names;               // file names, sorted
+    size_t count;               // number of files
+    size_t bytes;               // total size of the files
+};
+
+//Define the struct for the result of a benchmark
+struct bench_result{
+    char name[64];              // benchmark name
+    const char* kind;           // kind of files of the corpus
+    size_t files;               // number of files processed by a run
+    size_t bytes;               // number of bytes processed by a run
+    double seconds;             // best time of a run
+};
+
+//Formats used by the format benchmarks: name, pformat, cformat, kformat
+static const char* bench_formats[][4] = {
+    {"default", "_f: _w x _h, _c, _d bits per sample, _N chunks\n_C", "\t_n: _t (_l)\n", "\t_k: _t\n"},
+    {"fields", "_f: _w x _h, _c, _d bits, _N chunks\n_C_K", "\t_n: _t (_l) crc=_c\n", "\tkeyword=_k text=_t\n"},
+    {"dump", "_f _N chunks\n_C", "_n _t _l\n_D\n", "\t_k: _t\n"},
+};
+#define BENCH_FORMATS_NUM (sizeof(bench_formats)/sizeof(bench_formats[0]))
+
+static unsigned int repeat = 3; // number of runs of each benchmark (option "--repeat")
+
+//Current time in seconds
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare_names(const void* a, const void* b){
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+//List the PNG files of DIR/KIND, return 0 on success
+static int corpus_load(struct corpus* c, const char* dir, const char* kind){
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, kind);
+    memset(c, 0, sizeof(*c));
+    c->kind = kind;
+    DIR* d = opendir(path);
+    if(d == NULL)
+        return -1;
+    size_t capacity = 0;
+    struct dirent* e;
+    while((e = readdir(d)) != NULL){
+        size_t len = strlen(e->d_name);
+        if(len < 5 || strcmp(e->d_name + len - 4, ".png") != 0)
+            continue;
+        if(c->count == capacity){
+            capacity = capacity ? 2 * capacity : 256;
+            char** names = realloc(c->names, capacity * sizeof(char*));
+            if(names == NULL)
+                break;
+            c->names = names;
+        }
+        char* name = malloc(strlen(path) + len + 2);
+        struct stat st;
+        if(name == NULL)
+            break;
+        sprintf(name, "%s/%s", path, e->d_name);
+        if(stat(name, &st) == 0)
+            c->bytes += (size_t)st.st_size;
+        c->names[c->count++] = name;
+    }
+    closedir(d);
+    qsort(c->names, c->count, sizeof(char*), compare_names);
+    return c->count > 0 ? 0 : -1;
+}
+
+//Read the whole file "name" in memory, return NULL on error
+static unsigned char* read_whole(const char* name, size_t* size){
+    FILE* f = fopen(name, "rb");
+    if(f == NULL)
+        return NULL;
+    struct stat st;
+    unsigned char* buf = NULL;
+    if(fstat(fileno(f), &st) == 0 && (buf = malloc((size_t)st.st_size + 1)) != NULL){
+        *size = fread(buf, 1, (size_t)st.st_size, f);
+    }
+    fclose(f);
+    return buf;
+}
+
+//Print the result of a benchmark, as a table row or as a JSON object
+static void report(const struct bench_result* r, int json){
+    double mb_s = r->bytes / r->seconds / 1e6;
+    double files_s = r->files / r->seconds;
+    if(json)
+        printf("{\"bench\":\"%s\",\"corpus\":\"%s\",\"files\":%zu,\"bytes\":%zu,\"seconds\":%.6f,\"mb_s\":%.2f,\"files_s\":%.1f}\n",
+               r->name, r->kind, r->files, r->bytes, r->seconds, mb_s, files_s);
+    else
+        printf("%-24s %-6s %8zu %12zu %10.4f %10.1f %12.1f\n", r->name, r->kind, r->files, r->bytes, r->seconds, mb_s, files_s);
+    fflush(stdout);
+}
+
+//CRC of the chunks of every file with the CRC engine "engine", the files are read in memory first
+static double bench_crc(const struct corpus* c, const struct crc_engine* engine, size_t* bytes){
+    unsigned char** data = calloc(c->count, sizeof(unsigned char*));
+    size_t* sizes = calloc(c->count, sizeof(size_t));
+    double best = -1;
+    *bytes = 0;
+    if(data == NULL || sizes == NULL)
+        goto done;
+    for(size_t f = 0; f < c->count; f++){
+        data[f] = read_whole(c->names[f], &sizes[f]);
+        if(data[f] == NULL)
+            goto done;
+    }
+
+    volatile uint32_t sink = 0;
+    for(unsigned int r = 0; r < repeat; r++){
+        size_t total = 0;
+        double start = now();
+        for(size_t f = 0; f < c->count; f++){
+            size_t pos = 8;
+            while(pos + 12 <= sizes[f]){
+                size_t length = read_be32(data[f] + pos);
+                if(length > sizes[f] - pos - 12)
+                    break;
+                sink ^= engine->update(0xffffffffu, data[f] + pos + 4, length + 4);
+                total += length + 4;
+                pos += length + 12;
+            }
+        }
+        double t = now() - start;
+        if(best < 0 || t < best)
+            best = t;
+        *bytes = total;
+    }
+
+done:
+    if(data != NULL)
+        for(size_t f = 0; f < c->count; f++)
+            free(data[f]);
+    free(data);
+    free(sizes);
+    return best;
+}
+
+//Read every file with readPNGfile, in memory-mapped mode or with fread
+static double bench_parse(const struct corpus* c, int use_mmap){
+    struct png_context ctx;
+    struct out_sink out;
+    memset(&ctx, 0, sizeof(ctx));
+    if(sink_init(&out, -1) != 0)
+        return -1;
+    ctx.out = &out;
+    ctx.use_mmap = use_mmap;
+    ctx.crc_threads = 1;
+
+    double best = -1;
+    for(unsigned int r = 0; r < repeat; r++){
+        double start = now();
+        for(size_t f = 0; f < c->count; f++){
+            FILE* png_file = fopen(c->names[f], "rb");
+            if(png_file == NULL)
+                continue;
+            out.used = 0;
+            if(readPNGfile(&ctx, png_file) == 0)
+                dealloc_mem(&ctx, png_file);
+            memset(&ctx.pformat_output, 0, sizeof(ctx.pformat_output));
+        }
+        double t = now() - start;
+        if(best < 0 || t < best)
+            best = t;
+    }
+    free(out.buf);
+    free_context(&ctx);
+    return best;
+}
+
+//Print every file already read with print_info in the formats "formats", only the printing is timed
+static double bench_format(const struct corpus* c, const char* const* formats, size_t* bytes){
+    struct format_program* pformat = compile_format(formats[1], PFORMAT);
+    struct format_program* cformat = compile_format(formats[2], CFORMAT);
+    struct format_program* kformat = compile_format(formats[3], KFORMAT);
+    struct png_context ctx;
+    struct out_sink out;
+    memset(&ctx, 0, sizeof(ctx));
+    double best = -1;
+    *bytes = 0;
+    if(pformat == NULL || cformat == NULL || kformat == NULL || sink_init(&out, -1) != 0)
+        goto done;
+    ctx.out = &out;
+    ctx.use_mmap = 1;
+    ctx.crc_threads = 1;
+
+    double total_time[64] = {0};
+    unsigned int runs = repeat < 64 ? repeat : 64;
+    for(size_t f = 0; f < c->count; f++){
+        FILE* png_file = fopen(c->names[f], "rb");
+        if(png_file == NULL)
+            continue;
+        out.used = 0;
+        if(readPNGfile(&ctx, png_file) != 0)
+            continue;
+        ctx.pformat_output._f = c->names[f];
+        struct pf_output saved = ctx.pformat_output;
+        for(unsigned int r = 0; r < runs; r++){
+            ctx.pformat_output = saved;
+            out.used = 0;
+            double start = now();
+            print_info(&ctx, pformat, cformat, kformat);
+            total_time[r] += now() - start;
+        }
+        *bytes += out.used;
+        dealloc_mem(&ctx, png_file);
+        memset(&ctx.pformat_output, 0, sizeof(ctx.pformat_output));
+    }
+    for(unsigned int r = 0; r < runs; r++){
+        if(best < 0 || total_time[r] < best)
+            best = total_time[r];
+    }
+    free(out.buf);
+
+done:
+    free_context(&ctx);
+    free(pformat);
+    free(cformat);
+    free(kformat);
+    return best;
+}
+
+//Process every file like the program does with the default formats, serially or with "threads" worker threads
+//The output is written to /dev/null
+static double bench_end_to_end(const struct corpus* c, unsigned int threads){
+    struct read_settings settings;
+    memset(&settings, 0, sizeof(settings));
+    settings.pformat = compile_format(default_pformat, PFORMAT);
+    settings.cformat = compile_format(default_cformat, CFORMAT);
+    settings.kformat = compile_format(default_kformat, KFORMAT);
+    settings.use_mmap = 1;
+    settings.crc_threads = 1;
+    struct cmd_entry* entries = calloc(c->count, sizeof(struct cmd_entry));
+    double best = -1;
+    int null_fd = open("/dev/null", O_WRONLY);
+    int saved_stdout = dup(STDOUT_FILENO);
+    if(settings.pformat == NULL || settings.cformat == NULL || settings.kformat == NULL || entries == NULL || null_fd < 0 || saved_stdout < 0)
+        goto done;
+    for(size_t f = 0; f < c->count; f++){
+        entries[f].kind = JOB_FILE;
+        entries[f].name = c->names[f];
+        entries[f].settings = settings;
+    }
+
+    for(unsigned int r = 0; r < repeat; r++){
+        struct job_source source;
+        memset(&source, 0, sizeof(source));
+        source.entries = entries;
+        source.count = c->count;
+        fflush(stdout);
+        dup2(null_fd, STDOUT_FILENO);
+        double start = now();
+        if(threads > 1)
+            process_parallel(&source, threads);
+        else
+            process_serial(&source);
+        double t = now() - start;
+        dup2(saved_stdout, STDOUT_FILENO);
+        free_job_source(&source);
+        if(best < 0 || t < best)
+            best = t;
+    }
+
+done:
+    if(null_fd >= 0)
+        close(null_fd);
+    if(saved_stdout >= 0)
+        close(saved_stdout);
+    free(entries);
+    free((void*)settings.pformat);
+    free((void*)settings.cformat);
+    free((void*)settings.kformat);
+    return best;
+}
+
+//Print the speedup of each benchmark of "results" over the same benchmark saved in the JSON results file "path"
+static void compare(const struct bench_result* results, size_t count, const char* path){
+    FILE* f = fopen(path, "r");
+    if(f == NULL){
+        printf("Error, can't open the results file %s\n", path);
+        return;
+    }
+    printf("\n%-24s %-6s %12s %12s %8s\n", "benchmark", "corpus", "old s", "new s", "speedup");
+    char line[512];
+    while(fgets(line, sizeof(line), f) != NULL){
+        char name[64], kind[16];
+        double seconds;
+        const char* s = strstr(line, "\"seconds\":");
+        if(sscanf(line, "{\"bench\":\"%63[^\"]\",\"corpus\":\"%15[^\"]\"", name, kind) != 2 || s == NULL || sscanf(s + 10, "%lf", &seconds) != 1)
+            continue;
+        for(size_t i = 0; i < count; i++){
+            if(strcmp(results[i].name, name) == 0 && strcmp(results[i].kind, kind) == 0)
+                printf("%-24s %-6s %12.4f %12.4f %7.2fx\n", name, kind, seconds, results[i].seconds, seconds / results[i].seconds);
+        }
+    }
+    fclose(f);
+}
+
+int main(int argc, char* argv[]){
+    if(argc < 2){
+        printf("Error, a corpus directory is required.Try to use: %s CORPUS_DIR [--repeat=N] [--json] [--compare=RESULTS]\n", argv[0]);
+        return 1;
+    }
+    int json = 0;
+    const char* compare_path = NULL;
+    for(int i = 2; i < argc; i++){
+        if(strncmp(argv[i], "--repeat=", 9) == 0 && atoi(argv[i] + 9) > 0)
+            repeat = (unsigned int)atoi(argv[i] + 9);
+        else if(strcmp(argv[i], "--json") == 0)
+            json = 1;
+        else if(strncmp(argv[i], "--compare=", 10) == 0)
+            compare_path = argv[i] + 10;
+        else{
+            printf("Error, unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    crc_engine_init();
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int threads = cpus > 1 ? (unsigned int)cpus : 2;
+
+    struct bench_result results[256];
+    size_t count = 0;
+    if(!json)
+        printf("%-24s %-6s %8s %12s %10s %10s %12s\n", "benchmark", "corpus", "files", "bytes", "seconds", "MB/s", "files/s");
+
+    for(size_t k = 0; k < CORPUS_KINDS_NUM; k++){
+        struct corpus c;
+        if(corpus_load(&c, argv[1], corpus_kinds[k]) != 0){
+            printf("Error, can't read the corpus directory %s/%s, write it with gen_corpus\n", argv[1], corpus_kinds[k]);
+            return 1;
+        }
+
+        for(size_t e = 0; e < CRC_ENGINES_NUM; e++){
+            if(!crc_engines[e].available())
+                continue;
+            struct bench_result* r = &results[count++];
+            snprintf(r->name, sizeof(r->name), "crc/%s", crc_engines[e].name);
+            r->kind = c.kind;
+            r->files = c.count;
+            r->seconds = bench_crc(&c, &crc_engines[e], &r->bytes);
+            report(r, json);
+        }
+
+        for(int use_mmap = 1; use_mmap >= 0; use_mmap--){
+            struct bench_result* r = &results[count++];
+            snprintf(r->name, sizeof(r->name), use_mmap ? "parse" : "parse-fread");
+            r->kind = c.kind;
+            r->files = c.count;
+            r->bytes = c.bytes;
+            r->seconds = bench_parse(&c, use_mmap);
+            report(r, json);
+        }
+
+        //Formats: the throughput is the one of the output
+        for(size_t fmt = 0; fmt < BENCH_FORMATS_NUM; fmt++){
+            struct bench_result* r = &results[count++];
+            snprintf(r->name, sizeof(r->name), "format/%s", bench_formats[fmt][0]);
+            r->kind = c.kind;
+            r->files = c.count;
+            r->seconds = bench_format(&c, bench_formats[fmt], &r->bytes);
+            report(r, json);
+        }
+
+        for(int parallel = 0; parallel <= 1; parallel++){
+            struct bench_result* r = &results[count++];
+            if(parallel)
+                snprintf(r->name, sizeof(r->name), "end-to-end-j%u", threads);
+            else
+                snprintf(r->name, sizeof(r->name), "end-to-end");
+            r->kind = c.kind;
+            r->files = c.count;
+            r->bytes = c.bytes;
+            r->seconds = bench_end_to_end(&c, parallel ? threads : 1);
+            report(r, json);
+        }
+
+        for(size_t f = 0; f < c.count; f++)
+            free(c.names[f]);
+        free(c.names);
+    }
+
+    if(compare_path != NULL)
+        compare(results, count, compare_path);
+    return 0;
+}
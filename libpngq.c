@@ -0,0 +1,1358 @@
+/*
+pngq library : reading and validating Portable Network Graphics files
+
+Implementation of the API declared in "pngq.h": the readers of PNG files, the CRC-32 and Adler-32 engines, the streaming
+inflater and the checks of the IHDR chunk and of the image data. The pngq program is a thin wrapper around it which adds
+the formats, the output modes, the worker threads and the validation cache.
+
+The library has no global state that changes while files are read: the checksum engines and the fixed Huffman tables are
+selected and built once by pngq_init (through pthread_once), then every reader and every inflater is an independent handle.
+
+Notes about the imported libraries:
+    - string.h : for the memory comparison and copy functions
+    - stdlib.h : for the memory allocation functions (malloc, realloc, free)
+    - stdint.h : for the fixed width integer types used by the checksum engines
+    - pthread.h : for the one-time initialization of the library (pthread_once)
+    - sys/mman.h, sys/stat.h : for mapping the PNG files in memory (mmap, madvise, munmap) and getting their size (fstat)
+    - unistd.h, fcntl.h, errno.h : for opening and reading the PNG files that can't be mapped (open, read, close)
+    - immintrin.h, arm_acle.h, sys/auxv.h, asm/hwcap.h : for the CRC and Adler-32 engines using the instructions of the CPU
+    - crc32_tables.h : CRC32 lookup tables computed at compile time (reference and slicing-by-8 tables)
+    - pngq.h : the declarations of the library API
+
+Compile with the program using it: gcc -O2 -pthread pngq.c libpngq.c -o pngq
+*/
+
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "crc32_tables.h"
+#include "pngq.h"
+
+
+/*
+    CRC32 algorithm
+    The reference CRC algorithm is the available implementation on the PNG format specifications website: https://www.w3.org/TR/2023/CR-png-3-20230921/#samplecrc
+    On top of it there are faster engines computing exactly the same CRC, the one used is chosen once by crc_engine_init():
+        - slicing-by-8 : portable, 8 bytes per iteration using the tables of "crc32_tables.h"
+        - pclmul       : x86-64 carry-less multiplication folding (Intel, "Fast CRC Computation Using PCLMULQDQ")
+        - armv8-crc    : AArch64 CRC32 instructions
+*/
+
+/* Table of CRCs of all 8-bit messages (crc_tables[0]), built at compile time. */
+#define crc_table crc_tables[0]
+
+//Signature of a CRC engine: update the running CRC "crc" with the bytes buf[0..len-1]
+typedef uint32_t (*crc_update_fn)(uint32_t crc, const unsigned char* buf, size_t len);
+
+/* Update a running CRC with the bytes buf[0..len-1]--the CRC
+   should be initialized to all 1's, and the transmitted value
+   is the 1's complement of the final running CRC.
+   This is the byte-at-a-time reference version, every other engine is checked against it. */
+static uint32_t update_crc_reference(uint32_t crc, const unsigned char *buf, size_t len){
+  uint32_t c = crc;
+  size_t n;
+
+  for (n = 0; n < len; n++) {
+    c = crc_table[(c ^ buf[n]) & 0xff] ^ (c >> 8);
+  }
+  return c;
+}
+
+//Slicing-by-8 version: fold 8 bytes per iteration with 8 table lookups
+static uint32_t update_crc_slice8(uint32_t crc, const unsigned char *buf, size_t len){
+    uint32_t c = crc;
+
+    while(len >= 8){
+        uint32_t one = c ^ ((uint32_t)buf[0] | (uint32_t)buf[1] << 8 | (uint32_t)buf[2] << 16 | (uint32_t)buf[3] << 24);
+        uint32_t two = (uint32_t)buf[4] | (uint32_t)buf[5] << 8 | (uint32_t)buf[6] << 16 | (uint32_t)buf[7] << 24;
+
+        c = crc_tables[7][one & 0xff] ^ crc_tables[6][(one >> 8) & 0xff] ^ crc_tables[5][(one >> 16) & 0xff] ^ crc_tables[4][one >> 24]
+          ^ crc_tables[3][two & 0xff] ^ crc_tables[2][(two >> 8) & 0xff] ^ crc_tables[1][(two >> 16) & 0xff] ^ crc_tables[0][two >> 24];
+        buf += 8;
+        len -= 8;
+    }
+
+    return update_crc_reference(c, buf, len); // remaining bytes
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+//Fold the CRC of buffers of at least 64 bytes with the PCLMULQDQ instruction, the bytes left (len % 16) are processed by slicing-by-8
+//The constants are the bit-reflected x^n mod P(x) values of the Intel paper for the PNG/zlib polynomial
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t update_crc_pclmul(uint32_t crc, const unsigned char *buf, size_t len){
+    if(len < 64)
+        return update_crc_slice8(crc, buf, len);
+
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    //Load the first block of 64 bytes and inject the running CRC
+    x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(buf + 0x00)), _mm_cvtsi32_si128((int)crc));
+    x2 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+    buf += 64;
+    len -= 64;
+
+    //Fold 4 x 128 bits in parallel
+    while(len >= 64){
+        x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(buf + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(buf + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(buf + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(buf + 0x30)));
+        buf += 64;
+        len -= 64;
+    }
+
+    //Fold the 4 registers into a single one
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    //Fold the remaining blocks of 16 bytes
+    while(len >= 16){
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i*)buf)), x5);
+        buf += 16;
+        len -= 16;
+    }
+
+    //Reduce 128 bits to 64 bits
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k5k0, 0x00), x2);
+
+    //Barrett reduction to 32 bits
+    x0 = _mm_and_si128(x1, mask32);
+    x0 = _mm_clmulepi64_si128(x0, poly, 0x10);
+    x0 = _mm_and_si128(x0, mask32);
+    x0 = _mm_clmulepi64_si128(x0, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x0);
+
+    return update_crc_slice8((uint32_t)_mm_extract_epi32(x1, 1), buf, len);
+}
+
+static int crc_pclmul_available(void){
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+}
+#endif
+
+#if defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+
+//AArch64 version: the CRC32X/CRC32B instructions implement the same reflected polynomial as PNG
+__attribute__((target("+crc")))
+static uint32_t update_crc_armv8(uint32_t crc, const unsigned char *buf, size_t len){
+    uint32_t c = crc;
+    uint64_t word;
+
+    while(len >= 8){
+        memcpy(&word, buf, 8);
+        c = __crc32d(c, word);
+        buf += 8;
+        len -= 8;
+    }
+    while(len--)
+        c = __crc32b(c, *buf++);
+    return c;
+}
+
+static int crc_armv8_available(void){
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+#endif
+
+static int crc_always_available(void){
+    return 1;
+}
+
+//List of the CRC engines, from the most preferred to the least preferred one
+struct crc_engine{
+    const char* name;           // engine name
+    crc_update_fn update;       // function updating the running CRC
+    int (*available)(void);     // check if the CPU supports the engine
+};
+
+static const struct crc_engine crc_engines[] = {
+#if defined(__x86_64__) || defined(__i386__)
+    {"pclmul", update_crc_pclmul, crc_pclmul_available},
+#endif
+#if defined(__aarch64__)
+    {"armv8-crc", update_crc_armv8, crc_armv8_available},
+#endif
+    {"slicing-by-8", update_crc_slice8, crc_always_available},
+    {"reference", update_crc_reference, crc_always_available},
+};
+#define CRC_ENGINES_NUM (sizeof(crc_engines)/sizeof(crc_engines[0]))
+
+//CRC engine currently in use, slicing-by-8 until crc_engine_init() picks the best one for the CPU (it's never changed afterwards)
+static const struct crc_engine* crc_engine = &crc_engines[CRC_ENGINES_NUM-2];
+
+//Compare an engine against the reference version on buffers of every length up to 300 bytes, some larger ones and every alignment
+//Return 0 if the engine always produces the same CRC as the reference version
+static int crc_engine_check(const struct crc_engine* engine){
+    static const size_t big_lengths[] = {511, 512, 1000, 4096, 65536+13, 1<<20};
+    size_t max_len = 1<<20;
+    unsigned char* buf = malloc(max_len+16);
+    if(buf == NULL)
+        return -1;
+
+    //Pseudo-random but deterministic buffer content
+    uint32_t seed = 0x12345678;
+    for(size_t i = 0; i < max_len+16; i++){
+        seed = seed*1103515245 + 12345;
+        buf[i] = (unsigned char)(seed >> 16);
+    }
+
+    int errors = 0;
+    for(size_t offset = 0; offset < 16; offset++){
+        for(size_t len = 0; len <= 300; len++){
+            uint32_t init = len & 1 ? 0xffffffffU : (uint32_t)len*0x9e3779b9U;
+            if(engine->update(init, buf+offset, len) != update_crc_reference(init, buf+offset, len))
+                errors++;
+        }
+        for(size_t j = 0; j < sizeof(big_lengths)/sizeof(big_lengths[0]); j++){
+            if(engine->update(0xffffffffU, buf+offset, big_lengths[j]) != update_crc_reference(0xffffffffU, buf+offset, big_lengths[j]))
+                errors++;
+        }
+    }
+
+    free(buf);
+    return errors;
+}
+
+//Select the fastest CRC engine supported by the CPU, an engine is used only if it agrees with the reference version on a known input
+static void crc_engine_init(void){
+    static const unsigned char check_input[] = "123456789 PNG CRC engine check, long enough to exercise the folding loops of every engine.";
+    uint32_t expected = update_crc_reference(0xffffffffU, check_input, sizeof(check_input)-1);
+
+    for(size_t i = 0; i < CRC_ENGINES_NUM; i++){
+        if(crc_engines[i].available() && crc_engines[i].update(0xffffffffU, check_input, sizeof(check_input)-1) == expected){
+            crc_engine = &crc_engines[i];
+            return;
+        }
+    }
+}
+
+/*
+    Adler-32 algorithm
+    Checksum of the zlib streams (RFC 1950), checked by the deep validation of the image data. Like the CRC, the engine used is
+    chosen once by adler_engine_init():
+        - ssse3  : x86-64 SSSE3 kernel summing 32 bytes per iteration (PSADBW for the byte sums, PMADDUBSW for the weighted sums)
+        - scalar : portable, 8 bytes per iteration
+    Both engines reduce the sums modulo 65521 only every ADLER_NMAX bytes, the largest run that can't overflow 32 bits.
+*/
+
+#define ADLER_BASE 65521
+#define ADLER_NMAX 5552
+
+//Signature of an Adler-32 engine: update the running checksum "adler" with the bytes buf[0..len-1]
+typedef uint32_t (*adler_update_fn)(uint32_t adler, const unsigned char* buf, size_t len);
+
+//Portable version
+static uint32_t update_adler_scalar(uint32_t adler, const unsigned char* buf, size_t len){
+    uint32_t a = adler & 0xffff, b = adler >> 16;
+
+    while(len > 0){
+        size_t n = len < ADLER_NMAX ? len : ADLER_NMAX;
+        len -= n;
+        while(n >= 8){
+            a += buf[0]; b += a;
+            a += buf[1]; b += a;
+            a += buf[2]; b += a;
+            a += buf[3]; b += a;
+            a += buf[4]; b += a;
+            a += buf[5]; b += a;
+            a += buf[6]; b += a;
+            a += buf[7]; b += a;
+            buf += 8;
+            n -= 8;
+        }
+        while(n--){
+            a += *buf++;
+            b += a;
+        }
+        a %= ADLER_BASE;
+        b %= ADLER_BASE;
+    }
+    return b << 16 | a;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+//SSSE3 version: for a block of 32 bytes, "a" grows by the sum of the bytes and "b" by 32 times the previous "a" plus the bytes
+//weighted 32..1; the previous values of "a" are accumulated in "prev" and multiplied by 32 once per run of ADLER_NMAX bytes
+__attribute__((target("ssse3")))
+static uint32_t update_adler_ssse3(uint32_t adler, const unsigned char* buf, size_t len){
+    uint32_t a = adler & 0xffff, b = adler >> 16;
+    const __m128i weights_high = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+    const __m128i weights_low = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+
+    size_t blocks = len / 32;
+    len -= blocks * 32;
+    while(blocks > 0){
+        size_t n = blocks < ADLER_NMAX / 32 ? blocks : ADLER_NMAX / 32;
+        blocks -= n;
+
+        __m128i prev = _mm_setr_epi32((int)(a * (uint32_t)n), 0, 0, 0);
+        __m128i sum_a = zero;
+        __m128i sum_b = _mm_setr_epi32((int)b, 0, 0, 0);
+        do{
+            const __m128i bytes_high = _mm_loadu_si128((const __m128i*)buf);
+            const __m128i bytes_low = _mm_loadu_si128((const __m128i*)(buf + 16));
+            prev = _mm_add_epi32(prev, sum_a);
+            sum_a = _mm_add_epi32(sum_a, _mm_sad_epu8(bytes_high, zero));
+            sum_b = _mm_add_epi32(sum_b, _mm_madd_epi16(_mm_maddubs_epi16(bytes_high, weights_high), ones));
+            sum_a = _mm_add_epi32(sum_a, _mm_sad_epu8(bytes_low, zero));
+            sum_b = _mm_add_epi32(sum_b, _mm_madd_epi16(_mm_maddubs_epi16(bytes_low, weights_low), ones));
+            buf += 32;
+        }while(--n);
+        sum_b = _mm_add_epi32(sum_b, _mm_slli_epi32(prev, 5));
+
+        //Horizontal sums of the 4 lanes
+        sum_a = _mm_add_epi32(sum_a, _mm_shuffle_epi32(sum_a, _MM_SHUFFLE(2, 3, 0, 1)));
+        sum_a = _mm_add_epi32(sum_a, _mm_shuffle_epi32(sum_a, _MM_SHUFFLE(1, 0, 3, 2)));
+        sum_b = _mm_add_epi32(sum_b, _mm_shuffle_epi32(sum_b, _MM_SHUFFLE(2, 3, 0, 1)));
+        sum_b = _mm_add_epi32(sum_b, _mm_shuffle_epi32(sum_b, _MM_SHUFFLE(1, 0, 3, 2)));
+        a = (a + (uint32_t)_mm_cvtsi128_si32(sum_a)) % ADLER_BASE;
+        b = (uint32_t)_mm_cvtsi128_si32(sum_b) % ADLER_BASE;
+    }
+
+    return update_adler_scalar(b << 16 | a, buf, len); // remaining bytes
+}
+
+static int adler_ssse3_available(void){
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3");
+}
+#endif
+
+//Adler-32 engine currently in use, the scalar one until adler_engine_init() picks the best one for the CPU
+static adler_update_fn adler_engine = update_adler_scalar;
+
+//Select the fastest Adler-32 engine supported by the CPU, an engine is used only if it agrees with the scalar version on a known input
+static void adler_engine_init(void){
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned char check_input[1000];
+    for(size_t i = 0; i < sizeof(check_input); i++)
+        check_input[i] = (unsigned char)(i * 7 + (i >> 3));
+    if(adler_ssse3_available() && update_adler_ssse3(1, check_input, sizeof(check_input)) == update_adler_scalar(1, check_input, sizeof(check_input)))
+        adler_engine = update_adler_ssse3;
+#endif
+}
+
+
+/*
+    Inflate (RFC 1951), used for the image data (IDAT chunks) and the compressed text of the zTXt and iTXt chunks
+    The deflate stream is decoded through a fixed 32 KiB window used as a ring: the input is pulled from a list of segments
+    (the data fields of the IDAT chunks, or the compressed text) and the output is handed to a callback every time the window
+    is full, so neither the compressed nor the decompressed data is ever copied in a single buffer.
+    The Huffman codes are decoded with a lookup table of the first HUFFMAN_FAST_BITS bits, the longer codes bit by bit.
+*/
+
+#define INFLATE_WINDOW 32768
+#define HUFFMAN_FAST_BITS 10
+
+//Define the results of the decoding
+enum inflate_result {INFLATE_OK=0, INFLATE_TRUNCATED=-1, INFLATE_BAD_DATA=-2, INFLATE_BAD_HEADER=-3, INFLATE_STOPPED=-4};
+
+//Define the struct for a canonical Huffman code
+struct huffman{
+    uint16_t fast[1<<HUFFMAN_FAST_BITS];    // symbol << 4 | code length for the codes of at most HUFFMAN_FAST_BITS bits, 0 otherwise
+    uint16_t count[16];                     // number of codes of each length
+    uint16_t symbol[288];                   // symbols ordered by code
+};
+
+//Define the struct for the state of the decoder
+struct pngq_inflater{
+    //Input: the current segment and the callback returning the next one (0 when there are no more segments)
+    const unsigned char* in;
+    size_t in_left;
+    pngq_input_fn input;
+    void* input_arg;
+    uint64_t bits;                          // bits read from the input and not used yet, the first one is the lowest
+    unsigned int nbits;                     // number of bits in "bits"
+
+    //Output: the callback receives each run of decoded bytes, a non-zero result stops the decoding
+    pngq_output_fn output;
+    void* output_arg;
+    uint64_t total;                         // number of bytes decoded
+    size_t wpos;                            // position of the next decoded byte in the window
+    size_t flushed;                         // position of the first byte of the window not given to "output" yet
+
+    struct huffman lencode;                 // literal/length code of the current block
+    struct huffman distcode;                // distance code of the current block
+    unsigned char window[INFLATE_WINDOW];   // last 32 KiB decoded
+};
+
+//Base values and extra bits of the length symbols (257..285) and of the distance symbols (0..29)
+static const uint16_t inflate_length_base[29] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+static const uint8_t inflate_length_extra[29] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+static const uint16_t inflate_dist_base[30] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+static const uint8_t inflate_dist_extra[30] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+
+//Build the canonical Huffman code of the symbols 0..n-1 with the code lengths lengths[0..n-1]
+//Return -1 if the code is over-subscribed, the number of unused codes of length 15 otherwise (0 for a complete code)
+static int huffman_build(struct huffman* h, const unsigned char* lengths, int n){
+    uint16_t offsets[16];
+    uint16_t next_code[16];
+
+    memset(h->count, 0, sizeof(h->count));
+    for(int s = 0; s < n; s++)
+        h->count[lengths[s]]++;
+    h->count[0] = 0;
+
+    int left = 1;
+    for(int len = 1; len < 16; len++){
+        left <<= 1;
+        left -= h->count[len];
+        if(left < 0)
+            return -1;
+    }
+
+    offsets[1] = 0;
+    next_code[1] = 0;
+    for(int len = 1; len < 15; len++){
+        offsets[len+1] = offsets[len] + h->count[len];
+        next_code[len+1] = (uint16_t)((next_code[len] + h->count[len]) << 1);
+    }
+
+    memset(h->fast, 0, sizeof(h->fast));
+    for(int s = 0; s < n; s++){
+        unsigned int len = lengths[s];
+        if(len == 0)
+            continue;
+        h->symbol[offsets[len]++] = (uint16_t)s;
+        unsigned int code = next_code[len]++;
+        if(len > HUFFMAN_FAST_BITS)
+            continue;
+        //The codes are stored from their first bit, which is the lowest bit of the input
+        unsigned int reversed = 0;
+        for(unsigned int b = 0; b < len; b++)
+            reversed |= ((code >> b) & 1) << (len - 1 - b);
+        for(unsigned int k = reversed; k < (1u << HUFFMAN_FAST_BITS); k += 1u << len)
+            h->fast[k] = (uint16_t)(s << 4 | len);
+    }
+    return left;
+}
+
+//Number of codes of a Huffman code
+static int huffman_codes(const struct huffman* h){
+    int codes = 0;
+    for(int len = 1; len < 16; len++)
+        codes += h->count[len];
+    return codes;
+}
+
+//Fixed Huffman codes of the blocks of type 1, built once by pngq_init
+static struct huffman inflate_fixed_lencode, inflate_fixed_distcode;
+
+static void inflate_build_fixed(void){
+    unsigned char lengths[288];
+    memset(lengths, 8, 144);
+    memset(lengths+144, 9, 112);
+    memset(lengths+256, 7, 24);
+    memset(lengths+280, 8, 8);
+    huffman_build(&inflate_fixed_lencode, lengths, 288);
+    memset(lengths, 5, 30);
+    huffman_build(&inflate_fixed_distcode, lengths, 30);
+}
+
+//Move to the next non-empty input segment, return 0 if there are no more segments
+static int inflate_next_input(struct pngq_inflater* z){
+    while(z->in_left == 0){
+        if(z->input == NULL || !z->input(z->input_arg, &z->in, &z->in_left)){
+            z->input = NULL;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+//Fill the bit buffer with at least 57 bits, unless the input ends
+static void inflate_refill(struct pngq_inflater* z){
+    //Fast path: 8 bytes loaded at once
+    if(z->in_left >= 8 && z->nbits <= 56){
+        uint64_t word;
+        memcpy(&word, z->in, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        z->bits |= word << z->nbits;
+        size_t bytes = (63 - z->nbits) >> 3;
+        z->in += bytes;
+        z->in_left -= bytes;
+        z->nbits |= 56;
+        z->bits &= (1ull << z->nbits) - 1; // the bits of the byte loaded in part are loaded again with it
+        return;
+    }
+    while(z->nbits <= 56 && (z->in_left > 0 || inflate_next_input(z))){
+        z->bits |= (uint64_t)*z->in++ << z->nbits;
+        z->in_left--;
+        z->nbits += 8;
+    }
+}
+
+//Read "n" bits (at most 32), return -1 if the input ends
+static inline int64_t inflate_bits(struct pngq_inflater* z, unsigned int n){
+    if(z->nbits < n){
+        inflate_refill(z);
+        if(z->nbits < n)
+            return -1;
+    }
+    int64_t value = (int64_t)(z->bits & ((1ull << n) - 1));
+    z->bits >>= n;
+    z->nbits -= n;
+    return value;
+}
+
+//Decode a symbol with the Huffman code "h", return INFLATE_TRUNCATED or INFLATE_BAD_DATA on error
+static inline int inflate_symbol(struct pngq_inflater* z, const struct huffman* h){
+    if(z->nbits < HUFFMAN_FAST_BITS)
+        inflate_refill(z);
+    unsigned int entry = h->fast[z->bits & ((1u << HUFFMAN_FAST_BITS) - 1)];
+    if(entry != 0 && (entry & 15) <= z->nbits){
+        z->bits >>= entry & 15;
+        z->nbits -= entry & 15;
+        return (int)(entry >> 4);
+    }
+
+    //Long codes and the end of the input: decode bit by bit
+    int code = 0, first = 0, index = 0;
+    for(int len = 1; len < 16; len++){
+        int64_t bit = inflate_bits(z, 1);
+        if(bit < 0)
+            return INFLATE_TRUNCATED;
+        code |= (int)bit;
+        int count = h->count[len];
+        if(code - count < first)
+            return h->symbol[index + (code - first)];
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    return INFLATE_BAD_DATA;
+}
+
+//Give the bytes of the window not handed yet to the output callback, the window restarts when it's full
+static int inflate_flush(struct pngq_inflater* z){
+    if(z->wpos > z->flushed && z->output(z->output_arg, z->window + z->flushed, z->wpos - z->flushed) != 0)
+        return INFLATE_STOPPED;
+    z->flushed = z->wpos;
+    if(z->wpos == INFLATE_WINDOW)
+        z->wpos = z->flushed = 0;
+    return INFLATE_OK;
+}
+
+//Decode a stored block (type 0): the bytes are copied from the input
+static int inflate_stored(struct pngq_inflater* z){
+    //The block starts on a byte boundary
+    z->bits >>= z->nbits & 7;
+    z->nbits -= z->nbits & 7;
+    int64_t length = inflate_bits(z, 16);
+    int64_t nlength = inflate_bits(z, 16);
+    if(length < 0 || nlength < 0)
+        return INFLATE_TRUNCATED;
+    if(length != (~nlength & 0xffff))
+        return INFLATE_BAD_DATA;
+
+    //Bytes already in the bit buffer, then bytes copied from the input segments
+    while(length > 0 && z->nbits >= 8){
+        z->window[z->wpos++] = (unsigned char)z->bits;
+        z->bits >>= 8;
+        z->nbits -= 8;
+        z->total++;
+        length--;
+        if(z->wpos == INFLATE_WINDOW && inflate_flush(z) != INFLATE_OK)
+            return INFLATE_STOPPED;
+    }
+    while(length > 0){
+        if(z->in_left == 0 && !inflate_next_input(z))
+            return INFLATE_TRUNCATED;
+        size_t n = (size_t)length;
+        if(n > z->in_left)
+            n = z->in_left;
+        if(n > INFLATE_WINDOW - z->wpos)
+            n = INFLATE_WINDOW - z->wpos;
+        memcpy(z->window + z->wpos, z->in, n);
+        z->in += n;
+        z->in_left -= n;
+        z->wpos += n;
+        z->total += n;
+        length -= (int64_t)n;
+        if(z->wpos == INFLATE_WINDOW && inflate_flush(z) != INFLATE_OK)
+            return INFLATE_STOPPED;
+    }
+    return INFLATE_OK;
+}
+
+//Decode the symbols of a compressed block with the codes "lencode" and "distcode" up to the end of block symbol
+static int inflate_codes(struct pngq_inflater* z, const struct huffman* lencode, const struct huffman* distcode){
+    for(;;){
+        int symbol = inflate_symbol(z, lencode);
+        if(symbol < 0)
+            return symbol;
+
+        if(symbol < 256){
+            //Literal byte
+            z->window[z->wpos++] = (unsigned char)symbol;
+            z->total++;
+            if(z->wpos == INFLATE_WINDOW && inflate_flush(z) != INFLATE_OK)
+                return INFLATE_STOPPED;
+            continue;
+        }
+        if(symbol == 256) // end of block
+            return INFLATE_OK;
+
+        //Length and distance of a copy of previous bytes
+        symbol -= 257;
+        if(symbol >= 29)
+            return INFLATE_BAD_DATA;
+        int64_t extra = inflate_bits(z, inflate_length_extra[symbol]);
+        if(extra < 0)
+            return INFLATE_TRUNCATED;
+        size_t length = inflate_length_base[symbol] + (size_t)extra;
+
+        symbol = inflate_symbol(z, distcode);
+        if(symbol < 0)
+            return symbol;
+        if(symbol >= 30)
+            return INFLATE_BAD_DATA;
+        extra = inflate_bits(z, inflate_dist_extra[symbol]);
+        if(extra < 0)
+            return INFLATE_TRUNCATED;
+        size_t dist = inflate_dist_base[symbol] + (size_t)extra;
+        if(dist > z->total)
+            return INFLATE_BAD_DATA; // distance too far back
+
+        size_t from = (z->wpos - dist) & (INFLATE_WINDOW - 1);
+        while(length > 0){
+            size_t n = length;
+            if(n > INFLATE_WINDOW - z->wpos)
+                n = INFLATE_WINDOW - z->wpos;
+            if(n > INFLATE_WINDOW - from)
+                n = INFLATE_WINDOW - from;
+            if(from < z->wpos && z->wpos - from < n){
+                //Overlapping copy, the bytes written are read again
+                for(size_t i = 0; i < n; i++)
+                    z->window[z->wpos + i] = z->window[from + i];
+            }else{
+                memmove(z->window + z->wpos, z->window + from, n);
+            }
+            z->wpos += n;
+            z->total += n;
+            length -= n;
+            from = (from + n) & (INFLATE_WINDOW - 1);
+            if(z->wpos == INFLATE_WINDOW && inflate_flush(z) != INFLATE_OK)
+                return INFLATE_STOPPED;
+        }
+    }
+}
+
+//Read the code lengths of a block with dynamic Huffman codes (type 2) and build its codes
+static int inflate_dynamic_codes(struct pngq_inflater* z){
+    static const unsigned char order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    unsigned char lengths[286+30];
+    struct huffman lencode_code;
+
+    int64_t nlen = inflate_bits(z, 5);
+    int64_t ndist = inflate_bits(z, 5);
+    int64_t ncode = inflate_bits(z, 4);
+    if(nlen < 0 || ndist < 0 || ncode < 0)
+        return INFLATE_TRUNCATED;
+    nlen += 257;
+    ndist += 1;
+    ncode += 4;
+    if(nlen > 286 || ndist > 30)
+        return INFLATE_BAD_DATA;
+
+    //Code of the code lengths, it must be complete
+    memset(lengths, 0, 19);
+    for(int i = 0; i < ncode; i++){
+        int64_t len = inflate_bits(z, 3);
+        if(len < 0)
+            return INFLATE_TRUNCATED;
+        lengths[order[i]] = (unsigned char)len;
+    }
+    if(huffman_build(&lencode_code, lengths, 19) != 0)
+        return INFLATE_BAD_DATA;
+
+    //Code lengths of the literal/length and distance codes, with the runs of repeated lengths and zeros
+    int index = 0;
+    while(index < nlen + ndist){
+        int symbol = inflate_symbol(z, &lencode_code);
+        if(symbol < 0)
+            return symbol;
+        if(symbol < 16){
+            lengths[index++] = (unsigned char)symbol;
+            continue;
+        }
+        unsigned char len = 0;
+        int64_t repeat;
+        if(symbol == 16){
+            if(index == 0)
+                return INFLATE_BAD_DATA; // no length to repeat
+            len = lengths[index - 1];
+            repeat = inflate_bits(z, 2);
+            repeat = repeat < 0 ? -1 : 3 + repeat;
+        }else if(symbol == 17){
+            repeat = inflate_bits(z, 3);
+            repeat = repeat < 0 ? -1 : 3 + repeat;
+        }else{
+            repeat = inflate_bits(z, 7);
+            repeat = repeat < 0 ? -1 : 11 + repeat;
+        }
+        if(repeat < 0)
+            return INFLATE_TRUNCATED;
+        if(index + repeat > nlen + ndist)
+            return INFLATE_BAD_DATA;
+        while(repeat--)
+            lengths[index++] = len;
+    }
+
+    //The end of block symbol must have a code, incomplete codes are accepted only when they have a single symbol
+    if(lengths[256] == 0)
+        return INFLATE_BAD_DATA;
+    int left = huffman_build(&z->lencode, lengths, (int)nlen);
+    if(left < 0 || (left > 0 && huffman_codes(&z->lencode) > 1))
+        return INFLATE_BAD_DATA;
+    left = huffman_build(&z->distcode, lengths + nlen, (int)ndist);
+    if(left < 0 || (left > 0 && huffman_codes(&z->distcode) > 1))
+        return INFLATE_BAD_DATA;
+    return INFLATE_OK;
+}
+
+//Decode a raw deflate stream up to the end of its last block, the decoded bytes are all handed to the output callback
+static int inflate_raw(struct pngq_inflater* z){
+    int last;
+    do{
+        int64_t header = inflate_bits(z, 3);
+        if(header < 0)
+            return INFLATE_TRUNCATED;
+        last = (int)(header & 1);
+
+        int result;
+        switch(header >> 1){
+        case 0:
+            result = inflate_stored(z);
+            break;
+        case 1:
+            result = inflate_codes(z, &inflate_fixed_lencode, &inflate_fixed_distcode);
+            break;
+        case 2:
+            result = inflate_dynamic_codes(z);
+            if(result == INFLATE_OK)
+                result = inflate_codes(z, &z->lencode, &z->distcode);
+            break;
+        default:
+            result = INFLATE_BAD_DATA; // reserved block type
+            break;
+        }
+        if(result != INFLATE_OK)
+            return result;
+    }while(!last);
+
+    return inflate_flush(z);
+}
+
+//Decode a zlib stream (RFC 1950): header, raw deflate stream and Adler-32 field, which is saved in "adler" for the caller
+static int inflate_zlib(struct pngq_inflater* z, uint32_t* adler){
+    int64_t cmf = inflate_bits(z, 8);
+    int64_t flg = inflate_bits(z, 8);
+    if(cmf < 0 || flg < 0)
+        return INFLATE_TRUNCATED;
+    //Deflate compression method, window of at most 32 KiB, header check bits and no preset dictionary
+    if((cmf & 15) != 8 || (cmf >> 4) > 7 || (cmf << 8 | flg) % 31 != 0 || (flg & 0x20) != 0)
+        return INFLATE_BAD_HEADER;
+
+    int result = inflate_raw(z);
+    if(result != INFLATE_OK)
+        return result;
+
+    //The Adler-32 field starts on a byte boundary, it's big endian
+    z->bits >>= z->nbits & 7;
+    z->nbits -= z->nbits & 7;
+    *adler = 0;
+    for(int i = 0; i < 4; i++){
+        int64_t byte = inflate_bits(z, 8);
+        if(byte < 0)
+            return INFLATE_TRUNCATED;
+        *adler = *adler << 8 | (uint32_t)byte;
+    }
+    return INFLATE_OK;
+}
+
+//Start decoding the input segments returned by "input" with the output callback "output"
+static void inflate_start(struct pngq_inflater* z, pngq_input_fn input, void* input_arg, pngq_output_fn output, void* output_arg){
+    z->in = NULL;
+    z->in_left = 0;
+    z->input = input;
+    z->input_arg = input_arg;
+    z->bits = 0;
+    z->nbits = 0;
+    z->output = output;
+    z->output_arg = output_arg;
+    z->total = 0;
+    z->wpos = 0;
+    z->flushed = 0;
+}
+
+//Check if the input has bytes left after the decoded stream
+static int inflate_input_left(struct pngq_inflater* z){
+    return z->nbits >= 8 || z->in_left > 0 || inflate_next_input(z);
+}
+
+/*
+    Library API (see "pngq.h")
+    The readers parse the PNG file in memory: a buffer of the caller, a regular file mapped by the reader or the content of
+    a pipe read by the reader. The chunks are returned in place, only the reader state is allocated.
+*/
+
+static pthread_once_t pngq_once = PTHREAD_ONCE_INIT;
+
+static void pngq_init_once(void){
+    crc_engine_init();
+    adler_engine_init();
+    inflate_build_fixed();
+}
+
+//Select the checksum engines and build the fixed Huffman codes, only the first call does it
+void pngq_init(void){
+    pthread_once(&pngq_once, pngq_init_once);
+}
+
+//Update a running CRC with the bytes buf[0..len-1] using the selected CRC engine
+uint32_t pngq_crc32_update(uint32_t crc, const unsigned char* buf, size_t len){
+    return crc_engine->update(crc, buf, len);
+}
+
+//Update a running Adler-32 checksum (initialized to 1) with the bytes buf[0..len-1] using the selected engine
+uint32_t pngq_adler32_update(uint32_t adler, const unsigned char* buf, size_t len){
+    return adler_engine(adler, buf, len);
+}
+
+size_t pngq_crc_engine_count(void){
+    return CRC_ENGINES_NUM;
+}
+
+const char* pngq_crc_engine_name(size_t engine){
+    return engine < CRC_ENGINES_NUM ? crc_engines[engine].name : NULL;
+}
+
+int pngq_crc_engine_available(size_t engine){
+    return engine < CRC_ENGINES_NUM && crc_engines[engine].available();
+}
+
+const char* pngq_crc_engine_in_use(void){
+    pngq_init();
+    return crc_engine->name;
+}
+
+int pngq_crc_engine_check(size_t engine){
+    if(!pngq_crc_engine_available(engine))
+        return -1;
+    return crc_engine_check(&crc_engines[engine]);
+}
+
+struct pngq_inflater* pngq_inflater_new(void){
+    pngq_init();
+    return malloc(sizeof(struct pngq_inflater));
+}
+
+void pngq_inflater_free(struct pngq_inflater* inflater){
+    free(inflater);
+}
+
+//Status of a result of the decoder
+static int inflate_status(int result){
+    switch(result){
+    case INFLATE_OK:
+        return PNGQ_OK;
+    case INFLATE_TRUNCATED:
+        return PNGQ_ERR_ZLIB_TRUNCATED;
+    case INFLATE_BAD_DATA:
+        return PNGQ_ERR_ZLIB_DATA;
+    case INFLATE_BAD_HEADER:
+        return PNGQ_ERR_ZLIB_HEADER;
+    default:
+        return PNGQ_ERR_STOPPED;
+    }
+}
+
+int pngq_inflate_zlib(struct pngq_inflater* inflater, pngq_input_fn input, void* input_arg, pngq_output_fn output, void* output_arg, uint32_t* adler){
+    inflate_start(inflater, input, input_arg, output, output_arg);
+    int result = inflate_zlib(inflater, adler);
+    //The bytes decoded before an error in the stream are still in the window
+    if(result != INFLATE_OK && result != INFLATE_STOPPED)
+        inflate_flush(inflater);
+    return inflate_status(result);
+}
+
+int pngq_inflate_input_left(struct pngq_inflater* inflater){
+    return inflate_input_left(inflater);
+}
+
+//Read a big endian 32 bit value
+static uint32_t be32(const unsigned char* p){
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+int pngq_parse_ihdr(const unsigned char* data, size_t length, struct pngq_ihdr* ihdr){
+    if(length < 13)
+        return PNGQ_ERR_NO_IHDR;
+    ihdr->width = be32(data);
+    ihdr->height = be32(data + 4);
+    ihdr->bit_depth = data[8];
+    ihdr->color_type = data[9];
+    ihdr->compression = data[10];
+    ihdr->filter = data[11];
+    ihdr->interlace = data[12];
+    return PNGQ_OK;
+}
+
+//Number of channels of each color type, 0 for the undefined ones
+static const uint8_t color_channels[7] = {1, 0, 3, 1, 2, 0, 4};
+
+//Analyze if the bit depth field value assumes a valid number for the PNG image color type, then check the color type and methods
+//For more information about this checking are available on the PNG format specifications website: https://www.w3.org/TR/2023/CR-png-3-20230921/#table111
+int pngq_check_ihdr(const struct pngq_ihdr* ihdr){
+    unsigned int d = ihdr->bit_depth;
+    switch(ihdr->color_type){
+    case 0: //Greyscale
+        if(!(d == 1 || d == 2 || d == 4 || d == 8 || d == 16))
+            return PNGQ_ERR_IHDR;
+        break;
+    case 3: //Indexed
+        if(!(d == 1 || d == 2 || d == 4 || d == 8))
+            return PNGQ_ERR_IHDR;
+        break;
+    case 2: //Truecolour
+    case 4: //GreyscaleAlpha
+    case 6: //TruecolourAlpha
+        if(!(d == 8 || d == 16))
+            return PNGQ_ERR_IHDR;
+        break;
+    default:
+        break;
+    }
+    if(ihdr->color_type > 6 || color_channels[ihdr->color_type] == 0)
+        return PNGQ_ERR_COLOR_TYPE;
+    if(ihdr->compression != 0 || ihdr->filter != 0 || ihdr->interlace > 1)
+        return PNGQ_ERR_IHDR_METHOD;
+    return PNGQ_OK;
+}
+
+//Define the struct for the check of the decoded image data: the scanlines of each pass and the Adler-32
+struct image_check{
+    uint32_t width, height;             // image size
+    unsigned int pixel_bits;            // bits per pixel
+    int interlaced;                     // Adam7 interlace method
+    int pass;                           // current pass (0..6 when interlaced, 0 otherwise), 7 once all the scanlines are read
+    uint64_t row_bytes;                 // bytes of a scanline of the current pass, filter type byte included
+    uint64_t rows;                      // scanlines left in the current pass
+    uint64_t pos;                       // position in the current scanline
+    uint32_t adler;                     // Adler-32 of the decoded data
+    int error;                          // error found in the decoded data
+};
+
+//Move to the next pass with at least one pixel, or past the last one
+static void image_next_pass(struct image_check* d){
+    //Adam7 passes: first column and row, column and row steps
+    static const uint8_t x0[7] = {0, 4, 0, 2, 0, 1, 0}, y0[7] = {0, 0, 4, 0, 2, 0, 1};
+    static const uint8_t dx[7] = {8, 8, 4, 4, 2, 2, 1}, dy[7] = {8, 8, 8, 4, 4, 2, 2};
+
+    for(d->pass++; d->pass < 7; d->pass++){
+        uint64_t columns, rows;
+        if(!d->interlaced){
+            if(d->pass > 0)
+                break;
+            columns = d->width;
+            rows = d->height;
+        }else{
+            columns = d->width > x0[d->pass] ? (d->width - x0[d->pass] + dx[d->pass] - 1) / dx[d->pass] : 0;
+            rows = d->height > y0[d->pass] ? (d->height - y0[d->pass] + dy[d->pass] - 1) / dy[d->pass] : 0;
+        }
+        if(columns > 0 && rows > 0){
+            d->row_bytes = 1 + (columns * d->pixel_bits + 7) / 8;
+            d->rows = rows;
+            d->pos = 0;
+            return;
+        }
+    }
+    d->pass = 7;
+}
+
+//Output callback: update the Adler-32 and check the filter type byte at the start of each scanline
+static int image_output(void* arg, const unsigned char* data, size_t length){
+    struct image_check* d = arg;
+    d->adler = adler_engine(d->adler, data, length);
+
+    while(length > 0){
+        if(d->pass == 7){
+            d->error = PNGQ_ERR_IMAGE_LARGE;
+            return -1;
+        }
+        if(d->pos == 0 && *data > 4){
+            d->error = PNGQ_ERR_FILTER;
+            return -1;
+        }
+        uint64_t n = d->row_bytes - d->pos;
+        if(n > length)
+            n = length;
+        d->pos += n;
+        data += n;
+        length -= n;
+        if(d->pos == d->row_bytes){
+            d->pos = 0;
+            if(--d->rows == 0)
+                image_next_pass(d);
+        }
+    }
+    return 0;
+}
+
+int pngq_check_image_data(struct pngq_inflater* inflater, const struct pngq_ihdr* ihdr, pngq_input_fn input, void* input_arg){
+    int status = pngq_check_ihdr(ihdr);
+    if(status != PNGQ_OK)
+        return status;
+
+    struct image_check d = {0};
+    d.width = ihdr->width;
+    d.height = ihdr->height;
+    d.pixel_bits = color_channels[ihdr->color_type] * ihdr->bit_depth;
+    d.interlaced = ihdr->interlace;
+    d.pass = -1;
+    d.adler = 1;
+    image_next_pass(&d);
+
+    uint32_t adler;
+    status = pngq_inflate_zlib(inflater, input, input_arg, image_output, &d, &adler);
+    if(status == PNGQ_ERR_STOPPED)
+        return d.error;
+    if(status != PNGQ_OK)
+        return status;
+    if(adler != d.adler)
+        return PNGQ_ERR_ADLER;
+    if(d.pass != 7)
+        return PNGQ_ERR_IMAGE_SMALL;
+    if(inflate_input_left(inflater))
+        return PNGQ_ERR_IMAGE_EXTRA;
+    return PNGQ_OK;
+}
+
+//Check if the chunk type field is valid, each byte must be a letter ('A'-'Z','a'-'z') or a digit
+int pngq_valid_chunk_type(const unsigned char* type){
+    for(unsigned int i = 0; i < 4; i++){
+        if(!((type[i] >= 'A' && type[i] <= 'Z') || (type[i] >= 'a' && type[i] <= 'z') || (type[i] >= '0' && type[i] <= '9')))
+            return 0;
+    }
+    return 1;
+}
+
+//Define the struct for a reader of a PNG file
+struct pngq_reader{
+    const unsigned char* data;      // PNG file
+    size_t size;                    // length of the PNG file
+    size_t pos;                     // offset of the next chunk
+    uint32_t num;                   // number of chunks read
+    unsigned int flags;             // PNGQ_NO_CRC
+    int status;                     // 1 while there are chunks to read, then PNGQ_OK or the error found
+    void* owned;                    // PNG file mapped or read by the reader, released by pngq_close
+    int mapped;                     // "owned" is a mapping of "size" bytes, a buffer allocated by the reader otherwise
+};
+
+//Create a reader of data[0..size-1] and check the PNG signature, "owned" is released with the reader
+static int reader_open(struct pngq_reader** reader, const unsigned char* data, size_t size, unsigned int flags, void* owned, int mapped){
+    static const unsigned char png_signature[8] = {0x89,0x50,0x4E,0x47,0x0D,0x0A,0x1A,0x0A};
+    pngq_init();
+    *reader = NULL;
+
+    struct pngq_reader* r = calloc(1, sizeof(struct pngq_reader));
+    if(r == NULL){
+        if(mapped)
+            munmap(owned, size);
+        else
+            free(owned);
+        return PNGQ_ERR_MEMORY;
+    }
+    r->data = data;
+    r->size = size;
+    r->flags = flags;
+    r->owned = owned;
+    r->mapped = mapped;
+
+    if(size < 8){
+        pngq_close(r);
+        return PNGQ_ERR_SIGNATURE_SHORT;
+    }
+    if(memcmp(png_signature, data, 8) != 0){
+        pngq_close(r);
+        return PNGQ_ERR_SIGNATURE;
+    }
+    pngq_rewind(r);
+    *reader = r;
+    return PNGQ_OK;
+}
+
+int pngq_open_memory(struct pngq_reader** reader, const void* data, size_t size, unsigned int flags){
+    return reader_open(reader, data, size, flags, NULL, 0);
+}
+
+int pngq_open_fd(struct pngq_reader** reader, int fd, unsigned int flags){
+    struct stat st;
+    *reader = NULL;
+    if(fstat(fd, &st) != 0)
+        return PNGQ_ERR_READ;
+
+    //Regular files are mapped, the file is read only once from the start to the end
+    if(S_ISREG(st.st_mode) && st.st_size > 0){
+        void* addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(addr != MAP_FAILED){
+            madvise(addr, (size_t)st.st_size, MADV_SEQUENTIAL);
+            return reader_open(reader, addr, (size_t)st.st_size, flags, addr, 1);
+        }
+    }
+
+    //Pipes, special files and the files that can't be mapped are read in a buffer growing as needed
+    size_t capacity = 65536, size = 0;
+    unsigned char* buf = malloc(capacity);
+    if(buf == NULL)
+        return PNGQ_ERR_MEMORY;
+    for(;;){
+        if(size == capacity){
+            unsigned char* bigger = realloc(buf, capacity * 2);
+            if(bigger == NULL){
+                free(buf);
+                return PNGQ_ERR_MEMORY;
+            }
+            buf = bigger;
+            capacity *= 2;
+        }
+        ssize_t n = read(fd, buf + size, capacity - size);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0){
+            free(buf);
+            return PNGQ_ERR_READ;
+        }
+        if(n == 0)
+            break;
+        size += (size_t)n;
+    }
+    return reader_open(reader, buf, size, flags, buf, 0);
+}
+
+int pngq_open_path(struct pngq_reader** reader, const char* path, unsigned int flags){
+    *reader = NULL;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return PNGQ_ERR_OPEN;
+    int status = pngq_open_fd(reader, fd, flags);
+    close(fd); // the mapping stays valid
+    return status;
+}
+
+void pngq_close(struct pngq_reader* reader){
+    if(reader == NULL)
+        return;
+    if(reader->mapped)
+        munmap(reader->owned, reader->size);
+    else
+        free(reader->owned);
+    free(reader);
+}
+
+void pngq_rewind(struct pngq_reader* reader){
+    reader->pos = 8;
+    reader->num = 0;
+    reader->status = 1;
+}
+
+//Stop the iteration of the reader with the error "status"
+static int reader_fail(struct pngq_reader* reader, int status){
+    reader->status = status;
+    return status;
+}
+
+int pngq_next_chunk(struct pngq_reader* reader, struct pngq_chunk* chunk){
+    if(reader->status != 1)
+        return reader->status;
+    const unsigned char* pos = reader->data + reader->pos;
+    const unsigned char* end = reader->data + reader->size;
+
+    //The fields are checked in the order they are read, so the error is the one of the first field missing or not valid
+    if(end - pos < 4)
+        return reader_fail(reader, PNGQ_ERR_LENGTH_FIELD);
+    chunk->offset = reader->pos;
+    chunk->length = be32(pos);
+    pos += 4;
+    if(end - pos < 4)
+        return reader_fail(reader, PNGQ_ERR_TYPE_FIELD);
+    memcpy(chunk->type, pos, 4);
+    pos += 4;
+    if(!pngq_valid_chunk_type(chunk->type))
+        return reader_fail(reader, PNGQ_ERR_CHUNK_TYPE);
+    if((size_t)(end - pos) < chunk->length)
+        return reader_fail(reader, PNGQ_ERR_DATA_FIELD);
+    chunk->data = pos;
+    pos += chunk->length;
+    if(end - pos < 4)
+        return reader_fail(reader, PNGQ_ERR_CRC_FIELD);
+    chunk->crc = be32(pos);
+    pos += 4;
+
+    if(!(reader->flags & PNGQ_NO_CRC)){
+        uint32_t crc = crc_engine->update(0xffffffffU, chunk->type, 4);
+        crc = crc_engine->update(crc, chunk->data, chunk->length) ^ 0xffffffffU;
+        if(crc != chunk->crc)
+            return reader_fail(reader, PNGQ_ERR_CRC);
+    }
+
+    chunk->num = ++reader->num;
+    reader->pos = (size_t)(pos - reader->data);
+    if(memcmp(chunk->type, "IEND", 4) == 0)
+        reader->status = PNGQ_OK;
+    return 1;
+}
+
+int pngq_get_ihdr(struct pngq_reader* reader, struct pngq_ihdr* ihdr){
+    const unsigned char* first = reader->data + 8;
+    if(reader->size < 8 + 8 + 13 || memcmp(first + 4, "IHDR", 4) != 0)
+        return PNGQ_ERR_NO_IHDR;
+    return pngq_parse_ihdr(first + 8, be32(first), ihdr);
+}
+
+//Input callback of the deep validation: the data fields of the consecutive IDAT chunks from the position of the reader
+static int reader_idat_input(void* arg, const unsigned char** data, size_t* length){
+    struct pngq_reader* reader = arg;
+    struct pngq_chunk chunk;
+    if(pngq_next_chunk(reader, &chunk) != 1 || memcmp(chunk.type, "IDAT", 4) != 0)
+        return 0;
+    *data = chunk.data;
+    *length = chunk.length;
+    return 1;
+}
+
+int pngq_validate(struct pngq_reader* reader, unsigned int flags){
+    unsigned int reader_flags = reader->flags;
+    struct pngq_chunk chunk;
+    struct pngq_ihdr ihdr;
+    uint64_t first_idat = 0;
+    int idat_ended = 0;
+    int status;
+
+    //Structure, CRC and IHDR chunk fields
+    reader->flags &= ~PNGQ_NO_CRC;
+    pngq_rewind(reader);
+    while((status = pngq_next_chunk(reader, &chunk)) == 1){
+        if(chunk.num == 1){
+            if(memcmp(chunk.type, "IHDR", 4) != 0 || pngq_parse_ihdr(chunk.data, chunk.length, &ihdr) != PNGQ_OK){
+                status = PNGQ_ERR_NO_IHDR;
+                break;
+            }
+            if((status = pngq_check_ihdr(&ihdr)) != PNGQ_OK)
+                break;
+        }
+        if(memcmp(chunk.type, "IDAT", 4) != 0){
+            idat_ended = first_idat != 0;
+        }else if(first_idat == 0){
+            first_idat = chunk.offset;
+        }else if(idat_ended){
+            status = PNGQ_ERR_IDAT_SPLIT;
+            break;
+        }
+    }
+    if(status == PNGQ_OK && first_idat == 0)
+        status = PNGQ_ERR_NO_IDAT;
+
+    //Image data, the CRC of the IDAT chunks are already checked
+    if(status == PNGQ_OK && (flags & PNGQ_DEEP)){
+        struct pngq_inflater* inflater = pngq_inflater_new();
+        if(inflater == NULL){
+            status = PNGQ_ERR_MEMORY;
+        }else{
+            reader->flags |= PNGQ_NO_CRC;
+            reader->pos = (size_t)first_idat;
+            reader->status = 1;
+            status = pngq_check_image_data(inflater, &ihdr, reader_idat_input, reader);
+            pngq_inflater_free(inflater);
+        }
+    }
+
+    reader->flags = reader_flags;
+    pngq_rewind(reader);
+    return status;
+}
+
+//Messages of the status codes, indexed by -status
+static const char* const status_messages[] = {
+    [PNGQ_OK] = "no error",
+    [-PNGQ_ERR_OPEN] = "can't open the file",
+    [-PNGQ_ERR_READ] = "can't read the file",
+    [-PNGQ_ERR_MEMORY] = "can't allocate memory",
+    [-PNGQ_ERR_SIGNATURE_SHORT] = "can't read the PNG signature",
+    [-PNGQ_ERR_SIGNATURE] = "the file is not a valid PNG file",
+    [-PNGQ_ERR_LENGTH_FIELD] = "can't read the chunk length field",
+    [-PNGQ_ERR_TYPE_FIELD] = "can't read the chunk type field",
+    [-PNGQ_ERR_CHUNK_TYPE] = "the chunk type field is not valid",
+    [-PNGQ_ERR_DATA_FIELD] = "can't read the chunk data field",
+    [-PNGQ_ERR_CRC_FIELD] = "can't read the chunk CRC field",
+    [-PNGQ_ERR_CRC] = "the chunk CRC field is not correct",
+    [-PNGQ_ERR_NO_IHDR] = "the first chunk is not a complete IHDR chunk",
+    [-PNGQ_ERR_IHDR] = "the bit depth field value is not valid for the color type field value",
+    [-PNGQ_ERR_COLOR_TYPE] = "the IHDR color type field is not valid",
+    [-PNGQ_ERR_IHDR_METHOD] = "the IHDR compression, filter or interlace method is not valid",
+    [-PNGQ_ERR_NO_IDAT] = "the image data is missing, there is no IDAT chunk",
+    [-PNGQ_ERR_IDAT_SPLIT] = "the image data is split in IDAT chunks that are not consecutive",
+    [-PNGQ_ERR_ZLIB_HEADER] = "the image data zlib header is not valid",
+    [-PNGQ_ERR_ZLIB_DATA] = "the image data zlib stream is not valid",
+    [-PNGQ_ERR_ZLIB_TRUNCATED] = "the image data zlib stream is truncated",
+    [-PNGQ_ERR_ADLER] = "the image data Adler-32 checksum is not correct",
+    [-PNGQ_ERR_FILTER] = "the image data has a scanline filter type that is not valid",
+    [-PNGQ_ERR_IMAGE_LARGE] = "the image data is larger than the size given by the IHDR chunk fields",
+    [-PNGQ_ERR_IMAGE_SMALL] = "the image data is smaller than the size given by the IHDR chunk fields",
+    [-PNGQ_ERR_IMAGE_EXTRA] = "the image data has bytes after the end of the zlib stream",
+    [-PNGQ_ERR_STOPPED] = "the decoding was stopped by the output callback",
+};
+
+const char* pngq_strerror(int status){
+    if(status > 0 || (size_t)-status >= sizeof(status_messages)/sizeof(status_messages[0]))
+        return "unknown error";
+    return status_messages[-status];
+}
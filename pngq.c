@@ -14,7 +14,24 @@ Notes about the imported libraries:
     - string.h : for the string manipulation functions
     - stdlib.h : for the memory allocation functions (malloc, realloc, free)
     - arpa/inet.h : for the htonl() function (for converting the network byte order to host byte order,which means little endian to big endian translation)
-    - ctype.h : for the isdigit() function call (to check if a character is a digit)
+    - stdint.h : for the fixed width integer types (uint32_t) used by the CRC engines
+    - sys/mman.h, sys/stat.h : for mapping the PNG files in memory (mmap, madvise, munmap) and getting their size (fstat)
+    - pthread.h : for the worker threads processing several PNG files at the same time (option "-j")
+    - sys/uio.h, unistd.h, errno.h, stdarg.h : for the output sink (writev of the output buffer, formatted error messages)
+    - linux/io_uring.h, linux/stat.h, sys/syscall.h, fcntl.h : for the io_uring backend reading many PNG files at the same time (option "--uring")
+    - sys/file.h, sys/sysmacros.h : for the validation cache shared by several runs (flock of the cache updates, device numbers)
+    - time.h : for the monotonic clock timing the phases of the run (option "--stats")
+    - sys/epoll.h, sys/socket.h, sys/un.h, signal.h, sys/signalfd.h : for the server mode answering requests over a Unix domain
+      socket (option "--serve"), its event loops and its shutdown on SIGINT and SIGTERM
+    - emmintrin.h : for the SSE2 search of the chunk type fields by the recovery scanner (option "--recover"), when available
+    - dirent.h, fnmatch.h : for the directory walker (option "-r"), the types of the directory entries and the include and
+      exclude patterns
+    - sys/sendfile.h : for the rewrite mode (option "--rewrite"), which copies the chunks kept from file to file in the kernel
+    - pngq.h : the pngq library (libpngq.c), which reads the PNG files mapped in memory and holds the CRC-32 and Adler-32
+      engines and the inflater; this file is the command line program using it. The library parses the chunks of the
+      files mapped in memory and of the files read by the io_uring backend, the other read paths ("--no-mmap" and the
+      pipes, "--stream", "--trust-crc", "--index", "--recover" and "--rewrite") parse the chunks here, since a library
+      reader needs the whole file in memory
 
 Solution by : Birindelli Leonardo
 */
@@ -24,7 +41,34 @@ Solution by : Birindelli Leonardo
 #include <string.h>
 #include <stdlib.h>
 #include <arpa/inet.h>
-#include <ctype.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#include <sys/file.h>
+#include <sys/sysmacros.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/sendfile.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "pngq.h"
 
 
 /*
@@ -56,544 +100,5738 @@ struct pf_output{
     enum colorType _c; // image color type
     unsigned int _N; //number of chunks of the PNG file
     int _C ; // boolean value, print or not print the chunks information
-    int _K; // boolean value , print or not print the keywords and corrisponding text of the tEXt chunks
+    int _K; // boolean value , print or not print the keywords and corrisponding text of the text chunks (tEXt, zTXt, iTXt)
 
-} pformat_output;
+};
 
 //Default formats declaration and initialization
 const char *default_pformat = "_f: _w x _h, _c, _d bits per sample, _N chunks\n_C";
 const char *default_cformat = "\t_n: _t (_l)\n";
 const char *default_kformat = "\t_k: _t\n";
 
-/*
-    CRC32 algorithm
-    The following CRC algorithm is the available implementation on the PNG format specifications website: https://www.w3.org/TR/2023/CR-png-3-20230921/#samplecrc
-*/
+//Define the operations of a compiled format (see "compile_format")
+enum format_opcode{
+    OP_LITERAL,     // run of literal characters
+    OP_FILE,        // pformat _f : file name
+    OP_WIDTH,       // pformat _w : image width
+    OP_HEIGHT,      // pformat _h : image height
+    OP_DEPTH,       // pformat _d : image bit depth
+    OP_COLOR,       // pformat _c : image color type
+    OP_NCHUNKS,     // pformat _N : number of chunks
+    OP_NUM,         // cformat _n : chunk number
+    OP_TYPE,        // cformat _t : chunk type
+    OP_LENGTH,      // cformat _l : chunk length
+    OP_CRC,         // cformat _c : chunk CRC
+    OP_DATA,        // cformat _D : chunk data
+    OP_KEYWORD,     // kformat _k : keyword
+    OP_TEXT,        // kformat _t : text string, decompressed for zTXt and compressed iTXt chunks
+    OP_LANGUAGE,    // kformat _l : iTXt language tag
+    OP_TRANSLATED   // kformat _x : iTXt translated keyword
+};
 
-/* Table of CRCs of all 8-bit messages. */
-unsigned long crc_table[256];
+//Define the kinds of format, the same field letter has a different meaning in each of them
+enum format_kind {PFORMAT, CFORMAT, KFORMAT};
 
-/* Flag: has the table been computed? Initially false. */
-int crc_table_computed = 0;
+//Define the output modes (option "--output"): the formats, one JSON object per file on each line, binary records
+enum output_mode {OUTPUT_TEXT, OUTPUT_NDJSON, OUTPUT_BINARY};
 
-/* Make the table for a fast CRC. */
-void make_crc_table(void)
-{
-  unsigned long c;
-  int n, k;
+//Define the struct for an operation of a compiled format
+struct format_op{
+    enum format_opcode code;    // operation
+    const char* text;           // OP_LITERAL : first character of the run in the format string
+    size_t length;              // OP_LITERAL : number of characters of the run
+};
 
-  for (n = 0; n < 256; n++) {
-    c = (unsigned long) n;
-    for (k = 0; k < 8; k++) {
-      if (c & 1)
-        c = 0xedb88320L ^ (c >> 1);
-      else
-        c = c >> 1;
-    }
-    crc_table[n] = c;
-  }
-  crc_table_computed = 1;
-}
-/* Update a running CRC with the bytes buf[0..len-1]--the CRC
-   should be initialized to all 1's, and the transmitted value
-   is the 1's complement of the final running CRC (see the
-   crc() routine below). */
+//Define the struct for a compiled format
+struct format_program{
+    struct format_op* ops;      // operations, in the printing order
+    size_t count;               // number of operations
+    int set_C;                  // boolean value, pformat contains _C
+    int set_K;                  // boolean value, pformat contains _K
+    int uses_N;                 // boolean value, pformat prints the number of chunks
+    int uses_D;                 // boolean value, cformat prints the chunk data
+    int uses_text;              // boolean value, kformat prints the keyword, the text string or the iTXt fields
+    int uses_text_string;       // boolean value, kformat prints the text string, the compressed text is decompressed only then
+};
 
-unsigned long update_crc(unsigned long crc, unsigned char *buf,
-                         int len){
-  unsigned long c = crc;
-  int n;
+//Define the struct for the fields of a text chunk (tEXt, zTXt, iTXt) printed with kformat
+struct text_fields{
+    const unsigned char* keyword;   // keyword (not null terminated)
+    size_t keyword_length;          // length of the keyword
+    const unsigned char* text;      // text string (not null terminated)
+    size_t text_length;             // length of the text string
+    const unsigned char* language;  // iTXt language tag (not null terminated)
+    size_t language_length;         // length of the language tag
+    const unsigned char* translated;// iTXt translated keyword (not null terminated)
+    size_t translated_length;       // length of the translated keyword
+};
 
-  if (!crc_table_computed)
-    make_crc_table();
-  for (n = 0; n < len; n++) {
-    c = crc_table[(c ^ buf[n]) & 0xff] ^ (c >> 8);
-  }
-  return c;
-}
+//Define the struct for the buffer of the decompressed text of a zTXt or iTXt chunk, it grows up to TEXT_INFLATE_LIMIT bytes
+struct text_buffer{
+    unsigned char* buf;             // buffer
+    size_t used;                    // bytes of decompressed text
+    size_t capacity;                // size of the buffer
+};
 
-// check if the CRC of a chunk is correct using the chunk type field and the chunk data field 
-unsigned int PNG_crc_check(struct chunk ch, int len){
-    unsigned long crc = 0xffffffffL;
+//Define the struct for the memory mapping of the PNG file currently read, in this mode the chunk data fields point directly into the mapping
+struct mapped_file{
+    unsigned char* addr;    // start address of the mapping, NULL if the file is read with fread
+    size_t size;            // size of the mapping (file size)
+    int loaded;             // 0 if the file is mapped, 1 if it has been read in a heap buffer by the io_uring backend (released
+                            // with free), 2 if it's a small file read in the arena
+};
 
-    //Calculate the CRC of chunk type field
-    crc = update_crc(0xffffffffL,ch.type, 4);
+//Define the struct for the streaming mode (option "--stream"), the PNG file is read through a single buffer of fixed size,
+//each chunk is printed as soon as its CRC is checked and only the metadata of the current chunk is kept
+struct stream_state{
+    unsigned char* buffer;  // read buffer, allocated once and reused for all the files read with the same context
+    size_t limit;           // size of the buffer, which is the memory limit of the mode, 0 if the mode is disabled
+    FILE* file;             // PNG file currently read
+    long data_offset;       // file offset of the data field of the current chunk
+};
 
-    //Calculate the CRC of chunk data field
-    crc = update_crc(crc, ch.data, ch.length);
+//Define the struct for the chunk index of the PNG file currently read, stored as a structure of arrays so that iterating
+//over the chunks only touches the fields that are needed; the chunk data fields are referenced by their offset from "base"
+struct chunk_index{
+    unsigned int count;             // number of chunks
+    unsigned int capacity;          // size of the arrays
+    unsigned char (*types)[4];      // chunk type fields
+    unsigned int* lengths;          // chunk length fields
+    size_t* offsets;                // offsets of the chunk data fields from "base"
+    unsigned int* crcs;             // chunk CRC fields
+    const unsigned char* base;      // base address of the data fields: the mapping of the file or the arena
+};
 
-    /* Finalize and complement the CRC */
-    return crc ^ 0xffffffffL;
-}
+//Define the struct for an item of a chunk selector: a chunk type or a range of chunk numbers
+struct chunk_range{
+    int by_type;                    // boolean value, the item is a chunk type
+    unsigned char type[4];          // chunk type
+    unsigned int first, last;       // first and last chunk numbers of the range
+};
 
-//Print the data chunk on the standard output in at line of at most 16 hexadecimal values (bytes)
-void print_dataChunk(unsigned char* data, unsigned int length){
-    if(length==0)
-        putchar('\n');
+//Define the struct for a chunk selector (option "--chunks"): the chunks printed with cformat and kformat match one of the items
+struct chunk_selector{
+    size_t count;                   // number of items
+    struct chunk_range items[];     // items
+};
 
-    for(int i=0;i<length;i++){
-        // printf("%02x ",data[i]);
-        if(data[i] < 0x10)
-            printf(" %x ",data[i]);
-        else 
-            printf("%x ",data[i]);
-        if((i+1)%16==0 && i+1<length){
-            putchar('\n');
-        }
-    }
-}
+//Define the struct for the arena of a context: the chunk data fields read with fread are stored one after the other
+//in a single buffer, which is reset (not freed) between files and reused for the whole run
+struct arena{
+    unsigned char* buf;             // buffer
+    size_t used;                    // bytes in use
+    size_t capacity;                // size of the buffer
+};
 
-//Read IHDR data, update the value of the struct "pformat_output" for the printing and,finally,
-//print the information contained in that struct to the standard output according to the format defined by "pformat"
+//Minimum size of the arena and maximum size kept from one file to the next one
+#define ARENA_MIN_SIZE (64*1024)
+#define ARENA_KEEP_MAX (64*1024*1024)
+//The regular files smaller than this size are read in the arena with a single read, mapping them costs more than copying them
+#define MMAP_MIN_SIZE (256*1024)
 
-int print_pformat(const struct chunk* IHDR_ch, const char* pformat){
-    //Reading IHDR_ch data
-    unsigned char* data=IHDR_ch->data;
+//Define the struct for an output sink: the information printed is collected in a large user-space buffer, which is either
+//written to a file descriptor with writev when it's full or kept in memory (worker threads, whose output is printed later in order)
+struct out_sink{
+    char* buf;                  // buffer
+    size_t used;                // number of bytes in the buffer
+    size_t capacity;            // size of the buffer
+    int fd;                     // file descriptor where the buffer is flushed, -1 if the whole output is kept in memory
+    size_t flushed;             // number of bytes already written to the file descriptor
+};
 
-    //Save the image width, height, bit depth and color type in the pformat_output struct
+//Size of the buffer of the output sinks writing to a file descriptor and initial size of the in-memory ones
+#define SINK_BUFFER_SIZE (256*1024)
+#define SINK_MEMORY_SIZE 4096
 
-    //Reading the image width 
-    pformat_output._w=(unsigned int)data[0] << 24 | (unsigned int)data[1] << 16 | (unsigned int)data[2] << 8 
-    | (unsigned int)data[3]; // convert the image width from network byte order to host byte order (little endian to big endian)
+//Define the struct for the context of a PNG file read: it holds all the state needed to read and print one file,
+//so that several files can be processed at the same time by different threads
+struct png_context{
+    struct pf_output pformat_output;    // information about the PNG file printed with pformat
+    struct mapped_file mapping;         // memory mapping of the PNG file (zero-copy mode)
+    struct stream_state stream;         // state of the streaming mode
+    struct chunk_index index;           // chunk index of the PNG file
+    struct arena arena;                 // arena of the chunk data fields read with fread
+    int use_mmap;                       // map the regular PNG files in memory instead of copying each chunk with fread
+    unsigned int crc_threads;           // number of threads checking the CRC of the chunks of a large mapped file
+    const struct chunk_selector* select;    // chunks printed with cformat and kformat, NULL for all of them
+    struct out_sink* out;               // output sink where the information about the PNG file is printed
+    struct out_sink messages;           // error messages printed while the file is read, kept for the machine output modes
+    int error_kind;                     // kind of the last error reported (enum stats_error), saved in the validation cache
+    struct out_sink record_text;        // text section of the binary record being printed
+    struct pngq_inflater* inflate;      // decoder of the image data and of the compressed text, allocated when it's first used
+    struct text_buffer inflated;        // decompressed text of the zTXt or iTXt chunk printed
+};
 
-    //Reading the image height
-     pformat_output._h=(unsigned int)data[4] << 24 | (unsigned int)data[5] << 16 | (unsigned int)data[6] << 8 
-    | (unsigned int)data[7]; // convert the image width from network byte order to host byte order (little endian to big endian)
+//Default memory limit of the streaming mode and minimum accepted one
+#define STREAM_DEFAULT_LIMIT (1024*1024)
+#define STREAM_MIN_LIMIT 1024
 
-    //Reading the image bit depth
-    pformat_output._d=data[8];
+void stream_print_dataChunk(struct png_context* ctx, const struct chunk* ch);
+void inflate_text(struct png_context* ctx, const unsigned char* data, size_t length);
 
-    //Reading the image color type
-    pformat_output._c=data[9];
-    
-    //Mapping the color type value to its corresponding string
-    const char* color_type_str=colorTypeStrings[pformat_output._c];
-
-    //Check if the color type is valid 
-    //Analyze if the bit depth field value assumes a valid number for the PNG image color type
-    //For more information about this checking are available on the PNG format specifications website: https://www.w3.org/TR/2023/CR-png-3-20230921/#table111
-    switch (pformat_output._c){
-    case 0: //Greyscale
-        if(!(pformat_output._d==1 || pformat_output._d==2 || pformat_output._d==4 || pformat_output._d==8|| pformat_output._d==16))
-            return -1;
-        break;
-    case 2: //Truecolour
-        if(!(pformat_output._d==8|| pformat_output._d==16))
-            return -1;
-        break;
-    case 3: //Indexed
-        if(!(pformat_output._d==1 || pformat_output._d==2 || pformat_output._d==4 || pformat_output._d==8))
-            return -1;
-        break;
-    case 4: //GreyscaleAlpha
-        if(!(pformat_output._d==8|| pformat_output._d==16))
-            return -1;
-        break;
-    case 6: //TruecolourAlpha
-        if(!(pformat_output._d==8|| pformat_output._d==16))
-            return -1;
-        break;
-    default:
-        break;
-    }
+/*
+    Statistics (option "--stats")
+    Each thread processing PNG files counts the time spent in each phase and the files, chunks, bytes and errors in its own
+    struct, reached through a thread-local pointer, so that the hot paths never take a lock. The structs of all the threads
+    are summed in the report printed at exit. Without "--stats" the pointer is NULL and each measure costs a single branch;
+    compiling with -DPNGQ_NO_STATS removes the instrumentation completely.
+*/
 
-    //Print the information about the PNG file in the specified format
-    for(const char* p=pformat;*p!='\0';p++){
-        switch(*p){
-            case '\n':
-                if(strcmp(p+1,"_K")!=0)
-                    printf("\n"); //print the new line character
-                break;
-            case '_':
-                p++;
-                switch(*p){
-                    case 'f':
-                        printf("%s",pformat_output._f); //print the file name
-                        break;
-                    case 'w':
-                        printf("%u",pformat_output._w); //print the image width
-                        break;
-                    case 'h':
-                        printf("%u",pformat_output._h); //print the image height
-                        break;
-                    case 'd':
-                        printf("%u",pformat_output._d); //print the image bit depth
-                        break;
-                    case 'c':
-                        printf("%s",colorTypeStrings[pformat_output._c]); //print the image color type string
-                        break;
-                    case 'N':
-                        printf("%u",pformat_output._N); //print the number of chunks of the PNG file
-                        break;
-                    case 'C':
-                        pformat_output._C=1; //set the flag to 1 to indicate that the chunks information must be printed
-                        break;
-                    case 'K':
-                        pformat_output._K=1; //set the flag to 1 to indicate that the keywords and corrisponding text of the tEXt chunks must be printed
-                        break;
-
-                    default: //ignore the keyword that are not defined in the pformat specification
-                        break;
-                }
-                break;
-            default:
-                printf("%c",*p); //print the character
-                break;
-        }
-    }
+//Define the phases timed, "read" includes "signature", "crc" and "alloc" (the report shows the time left for the chunks)
+enum stats_phase {STATS_OPEN, STATS_SIGNATURE, STATS_READ, STATS_CRC, STATS_ALLOC, STATS_INFLATE, STATS_FORMAT, STATS_OUTPUT, STATS_PHASES};
 
-    return 0;
-}
+//Define the kinds of errors counted
+enum stats_error {STATS_ERR_OPEN, STATS_ERR_SIGNATURE, STATS_ERR_TRUNCATED, STATS_ERR_CHUNK_TYPE, STATS_ERR_CRC, STATS_ERR_IHDR, STATS_ERR_IMAGE, STATS_ERR_MEMORY, STATS_ERR_STREAM, STATS_ERR_OTHER, STATS_ERRORS};
 
-//Print the information about the chunk in the specified format specified by "cformat"
-void print_cformat(const struct chunk* ch, const char* cformat){
+//Define the struct for the statistics of a thread
+struct png_stats{
+    char name[32];                      // name of the thread
+    uint64_t phase_ns[STATS_PHASES];    // time spent in each phase, in nanoseconds
+    uint64_t phase_count[STATS_PHASES]; // number of times each phase is timed
+    uint64_t files;                     // number of PNG files processed (opened or found in the validation cache)
+    uint64_t valid;                     // number of PNG files read without errors
+    uint64_t cache_hits;                // number of PNG files printed from the validation cache
+    uint64_t chunks;                    // number of chunks read
+    uint64_t bytes;                     // number of bytes of the PNG files read (signature and chunks)
+    uint64_t errors[STATS_ERRORS];      // number of errors of each kind
+    struct png_stats* next;             // statistics of the next thread
+};
 
-    //Print the information about the chunk in the specified format
-    for(const char* p=cformat;*p!='\0';p++){
-        switch(*p){
-            case '_':
-                p++;
-                switch(*p){
-                    case 'n':
-                        printf("%u",ch->num); // print the chunk number
-                        break;
-                    case 't':
-                        printf("%.4s",ch->type); // print the chunk type string
-                        break;
-                    case 'l':
-                        printf("%u",ch->length); // print the chunk length
-                        break;
-                    case 'c':
-                        printf("%u",ch->crc); // print the chunk CRC
-                        break;
-                    case 'D':
-                        print_dataChunk(ch->data,ch->length); // print the data chunk
-                        break;
-                    default: //ignore the keyword that are not defined in the pformat specification
-                        break;
-                }
-                break;
-            default:
-                printf("%c",*p); //print the character
-                break;
-        }
-    }
-}
+#ifndef PNGQ_NO_STATS
 
-//Print the keyword and the text string of the tEXt chunk in the specified format specified by "kformat"
-void print_kformat(const struct chunk* ch, const char* cformat){
+static const char* stats_phase_names[] = {"open", "signature", "read", "crc", "alloc", "inflate", "format", "output"};
+static const char* stats_error_names[] = {"open", "signature", "truncated", "chunk_type", "crc", "ihdr", "image", "memory", "stream", "other"};
 
-    //Declare the Keyword characters array in which is also included the Null separator byte space for the null terminator
-    unsigned char keyword[79+1]; 
+static int stats_enabled = 0;                               // set by the option "--stats"
+static __thread struct png_stats* stats_current = NULL;     // statistics of the calling thread, NULL if not collected
+static struct png_stats* stats_threads = NULL;              // statistics of all the threads
+static unsigned int stats_workers = 0;                      // number of worker threads registered
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
 
-    //Copy the keyword from the chunk data field to the keyword array
-    unsigned i =0;
-    for(;i<79 && ch->data[i]!='\0';i++){
-        keyword[i]=ch->data[i];
-    }
-    keyword[i]='\0'; // add the null terminator to the keyword
+//Current time of the monotonic clock in nanoseconds
+static inline uint64_t stats_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
 
-    int keyword_length=i; // length of the keyword
+//Start a timer "t", stop it adding the time to the phase "phase" and add "n" to the counter "field" of the calling thread
+#define STATS_TIMER(t) uint64_t t = stats_current != NULL ? stats_now() : 0
+#define STATS_PHASE(t, phase) do{ if(stats_current != NULL){ stats_current->phase_ns[phase] += stats_now() - (t); stats_current->phase_count[phase]++; } }while(0)
+#define STATS_ADD(field, n) do{ if(stats_current != NULL) stats_current->field += (n); }while(0)
+#define STATS_ERROR(kind) do{ if(stats_current != NULL) stats_current->errors[kind]++; }while(0)
 
-    //Declare the Text string characters array and its length
-    const unsigned char* text_string=ch->data+keyword_length+1;
-    int text_string_length=ch->length-keyword_length-1;
+//Start collecting the statistics of the calling thread, "name" is "main" or "worker" (numbered)
+void stats_thread_begin(const char* name){
+    if(!stats_enabled)
+        return;
+    struct png_stats* stats = calloc(1, sizeof(struct png_stats));
+    if(stats == NULL)
+        return;
+    pthread_mutex_lock(&stats_lock);
+    if(strcmp(name, "worker") == 0)
+        snprintf(stats->name, sizeof(stats->name), "worker %u", ++stats_workers);
+    else
+        snprintf(stats->name, sizeof(stats->name), "%s", name);
+    //The threads are reported in the order they started
+    struct png_stats** last = &stats_threads;
+    while(*last != NULL)
+        last = &(*last)->next;
+    *last = stats;
+    pthread_mutex_unlock(&stats_lock);
+    stats_current = stats;
+}
 
-    //Print the information about the tEXt chunk in the specified format
-    for(const char* p=cformat;*p!='\0';p++){
-        switch(*p){
-            case '_':
-                p++;
-                switch(*p){
-                    case 'k': 
-                        printf("%.*s",keyword_length,keyword); // print the keyword
-                        break;
-                    case 't': 
-                        printf("%.*s",text_string_length,text_string); // print the text string
-                        break;
-
-                    default: //ignore the keyword that are not defined in the pformat specification
-                        break;
-                }
-                break;
-            default:
-                printf("%c",*p); //print the character
-                break;
-        }
+//Add the statistics "b" to "a"
+static void stats_sum(struct png_stats* a, const struct png_stats* b){
+    for(int p = 0; p < STATS_PHASES; p++){
+        a->phase_ns[p] += b->phase_ns[p];
+        a->phase_count[p] += b->phase_count[p];
     }
+    a->files += b->files;
+    a->valid += b->valid;
+    a->cache_hits += b->cache_hits;
+    a->chunks += b->chunks;
+    a->bytes += b->bytes;
+    for(int e = 0; e < STATS_ERRORS; e++)
+        a->errors[e] += b->errors[e];
 }
-//Print the information about the PNG file in the specified formats (pformat,cformat,kformat)
-int print_info(struct chunk* chunks,const char * pformat,const char * cformat,const char * kformat){
 
-    const struct chunk* p = chunks;
-    int flag=0; // flag to check if the IHDR chunk fields are valid
+//Print the statistics "s" as a JSON object
+static void stats_print_json(FILE* f, const struct png_stats* s){
+    fprintf(f, "{\"name\":\"%s\",\"files\":%llu,\"valid\":%llu,\"cache_hits\":%llu,\"chunks\":%llu,\"bytes\":%llu,\"phases\":{",
+            s->name, (unsigned long long)s->files, (unsigned long long)s->valid, (unsigned long long)s->cache_hits,
+            (unsigned long long)s->chunks, (unsigned long long)s->bytes);
+    for(int p = 0; p < STATS_PHASES; p++)
+        fprintf(f, "%s\"%s\":{\"count\":%llu,\"ns\":%llu}", p ? "," : "", stats_phase_names[p],
+                (unsigned long long)s->phase_count[p], (unsigned long long)s->phase_ns[p]);
+    fprintf(f, "},\"errors\":{");
+    for(int e = 0; e < STATS_ERRORS; e++)
+        fprintf(f, "%s\"%s\":%llu", e ? "," : "", stats_error_names[e], (unsigned long long)s->errors[e]);
+    fprintf(f, "}}");
+}
 
-    //Print the chunk information 
-    for(int i =0; i < pformat_output._N; i++,p++){
-        
-        if(memcmp(p->type,"IHDR",4)==0){
-            flag=print_pformat(p,pformat); //print the IHDR chunk information following the format "pformat"
+//Print the statistics "s" as a table
+static void stats_print_text(FILE* f, const struct png_stats* s){
+    fprintf(f, "%s: %llu files (%llu valid, %llu from the cache), %llu chunks, %llu bytes\n", s->name,
+            (unsigned long long)s->files, (unsigned long long)s->valid, (unsigned long long)s->cache_hits,
+            (unsigned long long)s->chunks, (unsigned long long)s->bytes);
+    for(int p = 0; p < STATS_PHASES; p++){
+        if(s->phase_count[p] == 0)
+            continue;
+        uint64_t ns = s->phase_ns[p];
+        //Time of the chunks: the read phase without the nested phases
+        if(p == STATS_READ){
+            uint64_t nested = s->phase_ns[STATS_SIGNATURE] + s->phase_ns[STATS_CRC] + s->phase_ns[STATS_ALLOC];
+            ns = ns > nested ? ns - nested : 0;
         }
+        fprintf(f, "    %-10s %12llu %12.6f s\n", p == STATS_READ ? "chunks" : stats_phase_names[p],
+                (unsigned long long)s->phase_count[p], ns * 1e-9);
+    }
+    int errors = 0;
+    for(int e = 0; e < STATS_ERRORS; e++){
+        if(s->errors[e] == 0)
+            continue;
+        fprintf(f, "%s %s=%llu", errors++ ? "," : "    errors:", stats_error_names[e], (unsigned long long)s->errors[e]);
+    }
+    if(errors)
+        fprintf(f, "\n");
+}
+
+//Print the statistics of the run to the standard error, as a summary or as JSON, "wall_ns" is the duration of the run
+//The per-thread statistics are printed when there are several threads
+void stats_report(int json, uint64_t wall_ns){
+    struct png_stats total;
+    memset(&total, 0, sizeof(total));
+    snprintf(total.name, sizeof(total.name), "total");
+    unsigned int threads = 0;
+    for(struct png_stats* s = stats_threads; s != NULL; s = s->next, threads++)
+        stats_sum(&total, s);
 
-        if(pformat_output._C){
-            print_cformat(p,cformat); //print the chunk information following the format "cformat"
+    if(json){
+        fprintf(stderr, "{\"wall_ns\":%llu,\"total\":", (unsigned long long)wall_ns);
+        stats_print_json(stderr, &total);
+        fprintf(stderr, ",\"threads\":[");
+        for(struct png_stats* s = stats_threads; s != NULL; s = s->next){
+            stats_print_json(stderr, s);
+            if(s->next != NULL)
+                fprintf(stderr, ",");
         }
-        if(pformat_output._K && memcmp(p->type,"tEXt",4)==0){
-            print_kformat(p,kformat); //print the keyword and the text string of the tEXt chunk following the format "kformat"
+        fprintf(stderr, "]}\n");
+    }else{
+        fprintf(stderr, "pngq statistics: %.6f s, %u threads (phase, count, time)\n", wall_ns * 1e-9, threads);
+        stats_print_text(stderr, &total);
+        if(threads > 1){
+            for(struct png_stats* s = stats_threads; s != NULL; s = s->next)
+                stats_print_text(stderr, s);
         }
     }
+}
 
-    return flag;
+//Release the statistics of the threads
+void stats_free(void){
+    while(stats_threads != NULL){
+        struct png_stats* next = stats_threads->next;
+        free(stats_threads);
+        stats_threads = next;
+    }
+    stats_current = NULL;
+}
 
+#else
 
+#define STATS_TIMER(t)
+#define STATS_PHASE(t, phase) ((void)0)
+#define STATS_ADD(field, n) ((void)0)
+#define STATS_ERROR(kind) ((void)0)
+#define stats_thread_begin(name) ((void)0)
 
-}
+#endif
+
+/*
+    CRC check
+    The CRC-32 engines are in the pngq library (libpngq.c), the fastest one supported by the CPU is selected by pngq_init()
+*/
 
-//Close the PNG file and deallocate memory for the array of chunks
-struct chunk* dealloc_mem(FILE* png_file,struct chunk* chunks_array){
-    //Close the PNG file
-    fclose(png_file);
-    //Deallocate memory allocated before with the "malloc" and "realloc" functions
-    for (int i = 0; i < pformat_output._N; i++) {
-        free(chunks_array[i].data);
+//Run the CRC self-test: compare every engine supported by the CPU against the reference version and print the result
+//Return 0 if all the engines are correct, 1 otherwise
+int crc_self_test(void){
+    int failed = 0;
+
+    for(size_t i = 0; i < pngq_crc_engine_count(); i++){
+        if(!pngq_crc_engine_available(i)){
+            printf("crc %s: not supported by this CPU\n", pngq_crc_engine_name(i));
+            continue;
+        }
+        int errors = pngq_crc_engine_check(i);
+        printf("crc %s: %s\n", pngq_crc_engine_name(i), errors == 0 ? "ok" : "FAILED");
+        if(errors != 0)
+            failed = 1;
     }
-    free(chunks_array);
-    
-    return NULL;
+    printf("crc engine in use: %s\n", pngq_crc_engine_in_use());
 
+    return failed;
 }
 
+// check if the CRC of a chunk is correct using the chunk type field and the chunk data field 
+unsigned int PNG_crc_check(struct chunk ch, int len){
+    STATS_TIMER(timer);
+    uint32_t crc = 0xffffffffU;
 
-//Read the PNG file and return an array of chunks if the PNG file is valid, otherwise return NULL
-struct chunk* readPNGfile(FILE* png_file){
+    //Calculate the CRC of chunk type field
+    crc = pngq_crc32_update(crc, ch.type, 4);
 
-    //Check if the PNG file is valid
+    //Calculate the CRC of chunk data field
+    crc = pngq_crc32_update(crc, ch.data, ch.length);
+    STATS_PHASE(timer, STATS_CRC);
 
-    //PNG signature check
-    const unsigned char png_signature[8] = {0x89,0x50,0x4E,0x47,0x0D,0x0A,0x1A,0x0A}; // PNG signature
-    unsigned char png_signature_read[8]; // PNG signature read from the PNG file
-    
-    //Read the PNG signature from the PNG file
-    if(fread(png_signature_read,8,1,png_file)!=1){
-        printf("Error, can't read the PNG signature\n");
-        fclose(png_file);
-        return NULL;
-    }
+    /* Finalize and complement the CRC */
+    return crc ^ 0xffffffffU;
+}
 
-    //Check if the PNG signature is correct
-    if(memcmp(png_signature,png_signature_read,8)!=0){
-        printf("Error, the file is not a valid PNG file\n");
-        fclose(png_file);
-        return NULL;
-    }
+/*
+    Parallel CRC check
+    The data of large chunks is split into segments whose CRC is computed by different threads, the CRC of a chunk is then obtained
+    combining the CRC of its segments with crc32_combine (the same math of zlib: appending len2 zero bytes to a message multiplies
+    its CRC by x^(8*len2) mod P(x), which is a linear operator on GF(2) computed by repeated squaring of a 32x32 bit matrix).
+    Segments of different chunks are independent, so the chunks of a file are checked concurrently too.
+*/
 
+//Size of the segments of chunk data checked by a single thread, and minimum amount of data for which the parallel check is used
+#define CRC_SEGMENT_SIZE (1024*1024)
+#define CRC_PARALLEL_MIN (2*CRC_SEGMENT_SIZE)
 
-    //Allocate memory for the array of chunks
-    unsigned int size=5; // initial size of the array of chunks
-    struct chunk* chunk_array=malloc(sizeof(struct chunk)*size); // allocate memory for the array of chunks
+//Multiply the 32x32 GF(2) matrix "mat" by the vector "vec"
+static uint32_t gf2_matrix_times(const uint32_t* mat, uint32_t vec){
+    uint32_t sum = 0;
+
+    while(vec){
+        if(vec & 1)
+            sum ^= *mat;
+        vec >>= 1;
+        mat++;
+    }
+    return sum;
+}
 
-    if(chunk_array!=NULL){
+//Compute square = mat * mat
+static void gf2_matrix_square(uint32_t* square, const uint32_t* mat){
+    for(int n = 0; n < 32; n++)
+        square[n] = gf2_matrix_times(mat, mat[n]);
+}
 
-    //Reading the PNG file chunks
+//Return the CRC of the concatenation of two messages A and B given crc1 = CRC(A), crc2 = CRC(B) and the length of B
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2){
+    uint32_t even[32]; // even-power-of-two zeros operator
+    uint32_t odd[32];  // odd-power-of-two zeros operator
 
-    unsigned char check_chunk_type[4]="IHDR"; //used to flag the type of the current chunk and check if it is the IEND chunk
-    unsigned i =0;
+    if(len2 == 0)
+        return crc1;
 
-    /* Read and save chunk information till the end of file */
-    while(memcmp(check_chunk_type,"IEND",4)!=0 && !feof(png_file)){
+    //Operator for one zero bit
+    odd[0] = 0xedb88320U;
+    uint32_t row = 1;
+    for(int n = 1; n < 32; n++){
+        odd[n] = row;
+        row <<= 1;
+    }
+    gf2_matrix_square(even, odd); // operator for two zero bits
+    gf2_matrix_square(odd, even); // operator for four zero bits
 
-        struct chunk new_chunk;
+    //Apply len2 zero bytes to crc1, the first square puts the operator for one zero byte (eight zero bits) in "even"
+    do{
+        gf2_matrix_square(even, odd);
+        if(len2 & 1)
+            crc1 = gf2_matrix_times(even, crc1);
+        len2 >>= 1;
+        if(len2 == 0)
+            break;
 
-        //Assign the chunk number to the new chunk
-        new_chunk.num=i+1;
-        
-        // Read the chunk length field
-        if(fread(&new_chunk.length,4,1,png_file)!=1){
-            printf("Error, can't read the chunk length field\n");
-            return dealloc_mem(png_file,chunk_array);
-        }
+        gf2_matrix_square(odd, even);
+        if(len2 & 1)
+            crc1 = gf2_matrix_times(odd, crc1);
+        len2 >>= 1;
+    }while(len2 != 0);
 
-        new_chunk.length=htonl(new_chunk.length); // convert the chunk length field from network byte order to host byte order
-        
-        //Read the chunk type field
-        if(fread(new_chunk.type,4,1,png_file)!=1){ 
-            printf("Error, can't read the chunk type field\n");
-            return dealloc_mem(png_file,chunk_array);
-        } 
+    return crc1 ^ crc2;
+}
 
-        //Check if the chunk type field is valid
-        for(unsigned i =0;i<4;i++){
-            if(!((new_chunk.type[i]>='A' && new_chunk.type[i]<= 'Z') || (new_chunk.type[i]>= 'a' && new_chunk.type[i]<= 'z') || isdigit(new_chunk.data[i]))){
-                printf("Error, the chunk type field is not valid\n");
-                return dealloc_mem(png_file,chunk_array);
-            }
-        }
-        
-        //Reading the chunk data
-        new_chunk.data = malloc(sizeof(unsigned char)*new_chunk.length); // allocate memory for the chunk data field
+//Define the struct for a segment of chunk data whose CRC is computed by one thread
+struct crc_segment{
+    const unsigned char* data;  // first byte of the segment
+    size_t length;              // length of the segment
+    uint32_t crc;               // CRC of the segment
+};
 
-        //Check if the memory allocation was successful
-        if(new_chunk.data==NULL){
-            printf("Error, can't allocate memory for the chunk data field\n");
-            return dealloc_mem(png_file,chunk_array);
-        }
+//Define the struct for the segments shared by the threads of the parallel CRC check
+struct crc_task{
+    struct crc_segment* segments;   // segments of all the chunks, in the file order
+    size_t count;                   // number of segments
+    size_t next;                    // next segment to compute, taken atomically by the threads
+};
 
+//Thread of the parallel CRC check: compute the CRC of the segments until there are none left
+static void* crc_worker(void* arg){
+    struct crc_task* task = arg;
 
-        
-        //Read the chunk data field
-        if(fread(new_chunk.data,sizeof(unsigned char),new_chunk.length,png_file)!=new_chunk.length){ // read the IHDR chunk data)
-            printf("Error, can't read the chunk data field\n");
-            return dealloc_mem(png_file,chunk_array);
-        } 
+    for(size_t s = __atomic_fetch_add(&task->next, 1, __ATOMIC_RELAXED); s < task->count; s = __atomic_fetch_add(&task->next, 1, __ATOMIC_RELAXED)){
+        struct crc_segment* seg = &task->segments[s];
+        seg->crc = pngq_crc32_update(0xffffffffU, seg->data, seg->length) ^ 0xffffffffU;
+    }
+    return NULL;
+}
 
-        //Reading the chunk CRC field
-        if(fread(&new_chunk.crc,4,1,png_file)!=1){
-            printf("Error, can't read the chunk CRC field\n");
-            fclose(png_file);
-            free(new_chunk.data); //deallocate memory for the chunk data field
-            free(chunk_array); //deallocate memory for the array of chunks
-            return NULL;
-        }
-        new_chunk.crc=htonl(new_chunk.crc); // convert the chunk CRC field from network byte order to host byte order
+struct chunk index_chunk(const struct chunk_index* index, unsigned int i);
 
+//Check the CRC of the first "count" chunks of the chunk index with "threads" threads
+//Return the index of the first chunk whose CRC is not correct, -1 if all the CRC are correct
+long parallel_crc_check(const struct chunk_index* index, unsigned int count, unsigned int threads){
+    //Count the segments of the chunks
+    size_t nsegments = 0;
+    for(unsigned int i = 0; i < count; i++)
+        nsegments += index->lengths[i] == 0 ? 1 : (index->lengths[i] + CRC_SEGMENT_SIZE - 1) / CRC_SEGMENT_SIZE;
 
-        //Check if the CRC is correct
-        if(PNG_crc_check(new_chunk,4)!=new_chunk.crc){
-            printf("Error, the chunk CRC field is not correct\n");
-            return dealloc_mem(png_file,chunk_array);
+    struct crc_task task = {malloc(sizeof(struct crc_segment) * nsegments), nsegments, 0};
+    if(task.segments == NULL){
+        //Not enough memory for the segments, check the chunks sequentially
+        for(unsigned int i = 0; i < count; i++){
+            if(PNG_crc_check(index_chunk(index, i), 4) != index->crcs[i])
+                return i;
         }
+        return -1;
+    }
+    STATS_TIMER(timer);
 
-        chunk_array[i]=new_chunk;
+    //Split the chunks data fields into segments
+    size_t s = 0;
+    for(unsigned int i = 0; i < count; i++){
+        size_t done = 0;
+        do{
+            size_t length = index->lengths[i] - done < CRC_SEGMENT_SIZE ? index->lengths[i] - done : CRC_SEGMENT_SIZE;
+            task.segments[s].data = index->base + index->offsets[i] + done;
+            task.segments[s].length = length;
+            s++;
+            done += length;
+        }while(done < index->lengths[i]);
+    }
 
-        //Update the check_chunk_type value
-        memcpy(check_chunk_type,new_chunk.type,4);
+    //The calling thread computes segments too
+    if(threads > nsegments)
+        threads = (unsigned int)nsegments;
+    pthread_t workers[threads > 1 ? threads - 1 : 1];
+    unsigned int started = 0;
+    for(; started + 1 < threads; started++){
+        if(pthread_create(&workers[started], NULL, crc_worker, &task) != 0)
+            break;
+    }
+    crc_worker(&task);
+    for(unsigned int t = 0; t < started; t++)
+        pthread_join(workers[t], NULL);
 
-        i++;
+    //Combine the CRC of the chunk type field with the CRC of the segments of its data field
+    long bad = -1;
+    s = 0;
+    for(unsigned int i = 0; i < count; i++){
+        uint32_t crc = pngq_crc32_update(0xffffffffU, index->types[i], 4) ^ 0xffffffffU;
+        size_t done = 0;
+        do{
+            crc = crc32_combine(crc, task.segments[s].crc, task.segments[s].length);
+            done += task.segments[s].length;
+            s++;
+        }while(done < index->lengths[i]);
 
-        //Reallocate memory for the array of chunks if needed
-        if(i>=size){
-            size*=2;
-            chunk_array=realloc(chunk_array,sizeof(struct chunk)*size);
+        if(crc != index->crcs[i]){
+            bad = i;
+            break;
         }
-        //Increment the number of chunks of the PNG file
-        pformat_output._N+=1;
     }
 
+    free(task.segments);
+    STATS_PHASE(timer, STATS_CRC);
+    return bad;
+}
+
+/*
+    Output sink
+    All the information about the PNG files is printed through an output sink instead of stdio: the bytes are appended to a
+    large buffer, which is written with a single writev together with the large blocks that don't fit in it (so they are never copied).
+*/
+
+//Write all the buffers of "iov" to the file descriptor "fd", retrying after partial writes and interruptions
+static int write_all(int fd, struct iovec* iov, int count){
+    STATS_TIMER(timer);
+    while(count>0){
+        ssize_t written=writev(fd,iov,count);
+        if(written<0){
+            if(errno==EINTR)
+                continue;
+            STATS_PHASE(timer, STATS_OUTPUT);
+            return -1;
+        }
+        //Skip the buffers completely written and advance in the partially written one
+        while(count>0 && (size_t)written>=iov->iov_len){
+            written-=iov->iov_len;
+            iov++;
+            count--;
+        }
+        if(count>0){
+            iov->iov_base=(char*)iov->iov_base+written;
+            iov->iov_len-=written;
+        }
     }
+    STATS_PHASE(timer, STATS_OUTPUT);
+    return 0;
+}
 
-    return chunk_array;
+//Initialize the output sink "s", writing to the file descriptor "fd" or keeping the output in memory if "fd" is -1
+int sink_init(struct out_sink* s, int fd){
+    s->capacity=fd>=0 ? SINK_BUFFER_SIZE : SINK_MEMORY_SIZE;
+    s->buf=malloc(s->capacity);
+    s->used=0;
+    s->fd=fd;
+    s->flushed=0;
+    return s->buf==NULL ? -1 : 0;
 }
 
+//Write the content of the buffer to the file descriptor of the sink
+void sink_flush(struct out_sink* s){
+    if(s->fd>=0 && s->used>0){
+        struct iovec iov={s->buf,s->used};
+        write_all(s->fd,&iov,1);
+        s->flushed+=s->used;
+        s->used=0;
+    }
+}
 
-int main(int argc, char* argv[]){
-    if(argc < 2){
-        printf("Error, a PNG file name is required for %s \n.Try to use: %s [options] [--] file1 [[options] file2 . . . ]\n", argv[0],argv[0]);
-        return 1;
+//Make room for at least "length" more bytes in the buffer, return 0 on success
+static int sink_room(struct out_sink* s, size_t length){
+    if(s->capacity-s->used>=length)
+        return 0;
+    if(s->fd>=0){
+        sink_flush(s);
+        if(s->capacity>=length)
+            return 0;
     }
+    //Grow the buffer (in-memory sinks, or a single write larger than the buffer)
+    size_t capacity=s->capacity;
+    while(capacity-s->used<length)
+        capacity*=2;
+    char* buf=realloc(s->buf,capacity);
+    if(buf==NULL)
+        return -1;
+    s->buf=buf;
+    s->capacity=capacity;
+    return 0;
+}
 
-    //Set to default values struct to store the information about the PNG file in the specified format
-    memset(&pformat_output, 0, sizeof(pformat_output)); 
-    
-    //Definition of the initial format values
-    const char *pformat = default_pformat;
-    const char *cformat = default_cformat;
-    const char *kformat = default_kformat;
+//Reserve "length" bytes at the end of the buffer, the caller writes them and then calls sink_commit
+char* sink_reserve(struct out_sink* s, size_t length){
+    if(sink_room(s,length)!=0)
+        return NULL;
+    return s->buf+s->used;
+}
 
-    FILE* png_file; // pointer to the PNG file
-    
-    unsigned int i; // loop counter
+//Add to the output the "length" bytes written in the space returned by sink_reserve
+void sink_commit(struct out_sink* s, size_t length){
+    s->used+=length;
+}
 
-    int read_a_file=0; // flag to check if a PNG file is read used to flag the unique presence of "--" in the command lines
+//Print the bytes data[0..length-1]
+void sink_write(struct out_sink* s, const void* data, size_t length){
+    if(s->capacity-s->used>=length){
+        memcpy(s->buf+s->used,data,length);
+        s->used+=length;
+        return;
+    }
+    //Large block: write the buffer and the block together without copying the block
+    if(s->fd>=0 && length>=s->capacity/2){
+        struct iovec iov[2]={{s->buf,s->used},{(void*)data,length}};
+        write_all(s->fd,iov,2);
+        s->flushed+=s->used+length;
+        s->used=0;
+        return;
+    }
+    if(sink_room(s,length)==0){
+        memcpy(s->buf+s->used,data,length);
+        s->used+=length;
+    }
+}
 
-    // loop through all the line arguments
-    for (i = 1; i < argc; i++){
+//Print the null terminated string "str"
+void sink_puts(struct out_sink* s, const char* str){
+    sink_write(s,str,strlen(str));
+}
 
-        // check if the argument is the optional parameter "--"
-        if(strncmp(argv[i],"--",2)==0){
-            if(read_a_file){
-                printf("Error, the \"--\" parameter is not allowed after a PNG file name\n");
-                return 0; // exit the program
-            }else{
-                i++;
-                //compute the next arguments as PNG file names
-                goto all_files;
-            }
-        }
+//Print the character "c"
+void sink_putc(struct out_sink* s, char c){
+    if(s->used<s->capacity || sink_room(s,1)==0)
+        s->buf[s->used++]=c;
+}
 
-        //Update the reference to the format values
+//Print a formatted string, used for the error messages
+void sink_printf(struct out_sink* s, const char* format, ...){
+    va_list args;
+    va_start(args,format);
+    int length=vsnprintf(NULL,0,format,args);
+    va_end(args);
+    if(length<0)
+        return;
 
-        //Check if the argument is the optional parameter "p=" for setting up the "pformat" value
-        if(strncmp(argv[i],"p=",2)==0){
-            pformat = argv[i]+2; // set the "pformat" value to the format specified in the argument
-            argv[strlen(argv[i])-1]='\0'; // remove the last character of the "pformat" value (which is a single quote)
-            continue;
-        }
-        if(strncmp(argv[i],"c=",2)==0){
-            cformat = argv[i]+2; // set the "cformat" value to the format specified in the argument
-            argv[strlen(argv[i])-1]='\0'; // remove the last character of the "cformat" value (which is a single quote)
-            continue;
-        }
-        if(strncmp(argv[i],"k=",2)==0){
-            kformat = argv[i]+2; // set the "kformat" value to the format specified in the argument
-            argv[strlen(argv[i])-1]='\0'; // remove the last character of the "kformat" value (which is a single quote)
-            continue;
-        }
+    char* dst=sink_reserve(s,(size_t)length+1); // vsnprintf writes the null terminator too
+    if(dst==NULL)
+        return;
+    va_start(args,format);
+    vsnprintf(dst,(size_t)length+1,format,args);
+    va_end(args);
+    sink_commit(s,(size_t)length);
+}
 
-        // read the PNG file name        
-        png_file = fopen(argv[i],"rb"); // open the PNG file in read binary mode
-        if(png_file == NULL){
-            printf("Error, can't open the file %s\n",argv[i]);
-            continue;
-        }
-        read_a_file=1; // set the flag to 1 to indicate that a PNG file is read and the "--" parameter is not allowed anymore
+//Print the error "message" of kind "kind" found in the PNG file, the kind is counted in the statistics and saved in the
+//validation cache with the message
+void report_error(struct png_context* ctx, enum stats_error kind, const char* message){
+    STATS_ERROR(kind);
+    ctx->error_kind=kind;
+    sink_puts(ctx->out,message);
+}
 
-        pformat_output._f = argv[i]; // set the file name in the pformat output struct
+//Return the kind of error of the pngq library status "status"
+static enum stats_error status_error_kind(int status){
+    switch(status){
+        case PNGQ_ERR_OPEN: return STATS_ERR_OPEN;
+        case PNGQ_ERR_MEMORY: return STATS_ERR_MEMORY;
+        case PNGQ_ERR_SIGNATURE_SHORT: case PNGQ_ERR_SIGNATURE: return STATS_ERR_SIGNATURE;
+        case PNGQ_ERR_LENGTH_FIELD: case PNGQ_ERR_TYPE_FIELD: case PNGQ_ERR_DATA_FIELD: case PNGQ_ERR_CRC_FIELD: return STATS_ERR_TRUNCATED;
+        case PNGQ_ERR_CHUNK_TYPE: return STATS_ERR_CHUNK_TYPE;
+        case PNGQ_ERR_CRC: return STATS_ERR_CRC;
+        case PNGQ_ERR_IHDR: return STATS_ERR_IHDR;
+        case PNGQ_ERR_NO_IDAT: case PNGQ_ERR_IDAT_SPLIT: case PNGQ_ERR_ZLIB_HEADER: case PNGQ_ERR_ZLIB_DATA:
+        case PNGQ_ERR_ZLIB_TRUNCATED: case PNGQ_ERR_ADLER: case PNGQ_ERR_FILTER: case PNGQ_ERR_IMAGE_LARGE:
+        case PNGQ_ERR_IMAGE_SMALL: case PNGQ_ERR_IMAGE_EXTRA: return STATS_ERR_IMAGE;
+        default: return STATS_ERR_OTHER;
+    }
+}
 
-        struct chunk* chunks =readPNGfile(png_file); // read the PNG file 
+//Print the error of the pngq library status "status", with the same message as the other errors
+void report_status(struct png_context* ctx, int status){
+    char message[160];
+    snprintf(message,sizeof(message),"Error, %s\n",pngq_strerror(status));
+    report_error(ctx,status_error_kind(status),message);
+}
 
-        if(chunks==NULL){
-            printf("Error, can't read the PNG file %s\n",argv[i]);
-            continue;
-        }
-        //print the chunks information following the formats
-        if(print_info(chunks,pformat,cformat,kformat)==-1){
-            printf("Error, the bit depth field value is not valid for the color type field value for the PNG file %s\n",pformat_output._f);
-        }
+//Hexadecimal representation of each byte in the layout of the data chunk dump: values below 0x10 are printed as " x ",
+//the other ones as "xx ", so every byte takes 3 characters (the 4th character is padding for 4-byte copies)
+static const char hex_triplets[256][4] = {
+    " 0 ", " 1 ", " 2 ", " 3 ", " 4 ", " 5 ", " 6 ", " 7 ", " 8 ", " 9 ", " a ", " b ", " c ", " d ", " e ", " f ",
+    "10 ", "11 ", "12 ", "13 ", "14 ", "15 ", "16 ", "17 ", "18 ", "19 ", "1a ", "1b ", "1c ", "1d ", "1e ", "1f ",
+    "20 ", "21 ", "22 ", "23 ", "24 ", "25 ", "26 ", "27 ", "28 ", "29 ", "2a ", "2b ", "2c ", "2d ", "2e ", "2f ",
+    "30 ", "31 ", "32 ", "33 ", "34 ", "35 ", "36 ", "37 ", "38 ", "39 ", "3a ", "3b ", "3c ", "3d ", "3e ", "3f ",
+    "40 ", "41 ", "42 ", "43 ", "44 ", "45 ", "46 ", "47 ", "48 ", "49 ", "4a ", "4b ", "4c ", "4d ", "4e ", "4f ",
+    "50 ", "51 ", "52 ", "53 ", "54 ", "55 ", "56 ", "57 ", "58 ", "59 ", "5a ", "5b ", "5c ", "5d ", "5e ", "5f ",
+    "60 ", "61 ", "62 ", "63 ", "64 ", "65 ", "66 ", "67 ", "68 ", "69 ", "6a ", "6b ", "6c ", "6d ", "6e ", "6f ",
+    "70 ", "71 ", "72 ", "73 ", "74 ", "75 ", "76 ", "77 ", "78 ", "79 ", "7a ", "7b ", "7c ", "7d ", "7e ", "7f ",
+    "80 ", "81 ", "82 ", "83 ", "84 ", "85 ", "86 ", "87 ", "88 ", "89 ", "8a ", "8b ", "8c ", "8d ", "8e ", "8f ",
+    "90 ", "91 ", "92 ", "93 ", "94 ", "95 ", "96 ", "97 ", "98 ", "99 ", "9a ", "9b ", "9c ", "9d ", "9e ", "9f ",
+    "a0 ", "a1 ", "a2 ", "a3 ", "a4 ", "a5 ", "a6 ", "a7 ", "a8 ", "a9 ", "aa ", "ab ", "ac ", "ad ", "ae ", "af ",
+    "b0 ", "b1 ", "b2 ", "b3 ", "b4 ", "b5 ", "b6 ", "b7 ", "b8 ", "b9 ", "ba ", "bb ", "bc ", "bd ", "be ", "bf ",
+    "c0 ", "c1 ", "c2 ", "c3 ", "c4 ", "c5 ", "c6 ", "c7 ", "c8 ", "c9 ", "ca ", "cb ", "cc ", "cd ", "ce ", "cf ",
+    "d0 ", "d1 ", "d2 ", "d3 ", "d4 ", "d5 ", "d6 ", "d7 ", "d8 ", "d9 ", "da ", "db ", "dc ", "dd ", "de ", "df ",
+    "e0 ", "e1 ", "e2 ", "e3 ", "e4 ", "e5 ", "e6 ", "e7 ", "e8 ", "e9 ", "ea ", "eb ", "ec ", "ed ", "ee ", "ef ",
+    "f0 ", "f1 ", "f2 ", "f3 ", "f4 ", "f5 ", "f6 ", "f7 ", "f8 ", "f9 ", "fa ", "fb ", "fc ", "fd ", "fe ", "ff "
+};
 
-        dealloc_mem(png_file,chunks); // deallocate memory for the array of chunks and close the file
-    
-        memset(&pformat_output, 0, sizeof(pformat_output)); // reset the pformat_output struct to the default values
-    }
+//Print the bytes data[0..count-1] of a chunk data field of "length" bytes, data[0] being the byte number "first" of the data field
+//The bytes are printed as hexadecimal values in lines of at most 16 values, like a whole call of "print_dataChunk"
+//Each block of bytes is encoded in a single pass with the "hex_triplets" table directly into the output buffer
+void print_dataRange(struct png_context* ctx, const unsigned char* data, unsigned int first, unsigned int count, unsigned int length){
+    const unsigned int block=4096; // bytes encoded for each reservation of the output buffer
 
-    return 0;
+    for(unsigned int done=0;done<count;){
+        unsigned int n=count-done < block ? count-done : block;
+        //3 characters per byte, a new line every 16 bytes and the padding of the last 4-byte copy
+        char* dst=sink_reserve(ctx->out,(size_t)n*3+n/16+2);
+        if(dst==NULL)
+            return;
+        char* q=dst;
 
-    all_files:
-    // loop through all the line arguments and process all files
-    for (; i < argc; i++){
-        png_file = fopen(argv[i],"rb"); // open the PNG file in read binary mode
-        if(png_file == NULL){
-            printf("Error, can't open the file %s\n",argv[i]);
-            continue;
+        for(unsigned int j=0;j<n;j++){
+            unsigned int i=first+done+j; // index of the byte in the data field
+            memcpy(q,hex_triplets[data[done+j]],4);
+            q+=3;
+            if((i+1)%16==0 && i+1<length)
+                *q++='\n';
         }
+        sink_commit(ctx->out,(size_t)(q-dst));
+        done+=n;
+    }
+}
 
-        pformat_output._f = argv[i]; // set the file name in the pformat output struct
-        struct chunk* chunks =readPNGfile(png_file); // read the PNG file 
+//Print the data chunk on the standard output in at line of at most 16 hexadecimal values (bytes)
+void print_dataChunk(struct png_context* ctx, unsigned char* data, unsigned int length){
+    if(length==0)
+        sink_putc(ctx->out,'\n');
 
-        if(chunks==NULL){
-            printf("Error, can't read the PNG file %s\n",argv[i]);
-            continue;
-        }
+    print_dataRange(ctx,data,0,length,length);
+}
 
-        //print the chunks information following the formats
-        if(print_info(chunks,pformat,cformat,kformat)==-1){ // in case of error
-            printf("Error, the bit depth field value is not valid for the color type field value for the PNG file %s\n",pformat_output._f);
-        }
+/*
+    Format programs
+    The formats pformat, cformat and kformat are compiled once, when they are read from the command line, into a list of operations:
+    runs of literal characters and fields to print. Printing a file or a chunk only runs these operations,
+    the format string is never parsed again.
+*/
 
-        dealloc_mem(png_file,chunks); // deallocate memory for the array of chunks and close the file
+//Print the unsigned integer "value" in decimal
+static void print_uint(struct out_sink* out, unsigned int value){
+    char digits[10];
+    int n=sizeof(digits);
 
-        memset(&pformat_output, 0, sizeof(pformat_output)); // set the pformat_output struct to the default values*/
+    do{
+        digits[--n]=(char)('0'+value%10);
+        value/=10;
+    }while(value!=0);
+    sink_write(out,digits+n,sizeof(digits)-n);
+}
 
-    } 
+//Print the format program "prog" for the chunk "ch" (the IHDR chunk for pformat), "text" are the text chunk fields for kformat
+void run_format(struct png_context* ctx, const struct format_program* prog, const struct chunk* ch, const struct text_fields* text){
+    struct out_sink* out=ctx->out;
 
-    return 0;
+    for(const struct format_op* op=prog->ops;op<prog->ops+prog->count;op++){
+        switch(op->code){
+            case OP_LITERAL:
+                sink_write(out,op->text,op->length); // print the run of characters
+                break;
+            case OP_FILE:
+                sink_puts(out,ctx->pformat_output._f); //print the file name
+                break;
+            case OP_WIDTH:
+                print_uint(out,ctx->pformat_output._w); //print the image width
+                break;
+            case OP_HEIGHT:
+                print_uint(out,ctx->pformat_output._h); //print the image height
+                break;
+            case OP_DEPTH:
+                print_uint(out,ctx->pformat_output._d); //print the image bit depth
+                break;
+            case OP_COLOR:
+                //print the image color type string
+                if(ctx->pformat_output._c<sizeof(colorTypeStrings)/sizeof(colorTypeStrings[0]))
+                    sink_puts(out,colorTypeStrings[ctx->pformat_output._c]);
+                break;
+            case OP_NCHUNKS:
+                print_uint(out,ctx->pformat_output._N); //print the number of chunks of the PNG file
+                break;
+            case OP_NUM:
+                print_uint(out,ch->num); // print the chunk number
+                break;
+            case OP_TYPE:
+                sink_write(out,ch->type,4); // print the chunk type string
+                break;
+            case OP_LENGTH:
+                print_uint(out,ch->length); // print the chunk length
+                break;
+            case OP_CRC:
+                print_uint(out,ch->crc); // print the chunk CRC
+                break;
+            case OP_DATA:
+                if(ch->data==NULL)
+                    stream_print_dataChunk(ctx,ch); // the data chunk is larger than the streaming buffer, print it from the file
+                else
+                    print_dataChunk(ctx,ch->data,ch->length); // print the data chunk
+                break;
+            case OP_KEYWORD:
+                sink_write(out,text->keyword,text->keyword_length); // print the keyword
+                break;
+            case OP_TEXT:
+                sink_write(out,text->text,text->text_length); // print the text string
+                break;
+            case OP_LANGUAGE:
+                sink_write(out,text->language,text->language_length); // print the language tag
+                break;
+            case OP_TRANSLATED:
+                sink_write(out,text->translated,text->translated_length); // print the translated keyword
+                break;
+        }
+    }
+}
+
+//Compile the format string "format" of the given kind into a format program, return NULL if the memory allocation fails
+//The program only references the format string, which must stay valid as long as the program is used
+struct format_program* compile_format(const char* format, enum format_kind kind){
+    size_t max_ops=strlen(format)+1; // each character produces at most one operation
+
+    //The program and its operations are allocated in a single block, released with free()
+    struct format_program* prog=malloc(sizeof(struct format_program)+sizeof(struct format_op)*max_ops);
+    if(prog==NULL)
+        return NULL;
+    memset(prog,0,sizeof(struct format_program));
+    prog->ops=(struct format_op*)(prog+1);
+
+    const char* literal=format; // start of the current run of literal characters
+    const char* p=format;
+    for(;*p!='\0';p++){
+        //In pformat the new line character before a final "_K" is not printed
+        if(kind==PFORMAT && *p=='\n' && strcmp(p+1,"_K")==0){
+            if(p>literal)
+                prog->ops[prog->count++]=(struct format_op){OP_LITERAL,literal,(size_t)(p-literal)};
+            literal=p+1;
+            continue;
+        }
+        if(*p!='_')
+            continue;
+
+        //End of the run of literal characters
+        if(p>literal)
+            prog->ops[prog->count++]=(struct format_op){OP_LITERAL,literal,(size_t)(p-literal)};
+        p++;
+        if(*p=='\0'){
+            literal=p;
+            break;
+        }
+        literal=p+1;
+
+        int code=-1; // operation of the field, -1 for the keywords that are not defined in the format specification
+        switch(kind){
+            case PFORMAT:
+                switch(*p){
+                    case 'f': code=OP_FILE; break;
+                    case 'w': code=OP_WIDTH; break;
+                    case 'h': code=OP_HEIGHT; break;
+                    case 'd': code=OP_DEPTH; break;
+                    case 'c': code=OP_COLOR; break;
+                    case 'N': code=OP_NCHUNKS; prog->uses_N=1; break;
+                    case 'C': prog->set_C=1; break;
+                    case 'K': prog->set_K=1; break;
+                    default: break;
+                }
+                break;
+            case CFORMAT:
+                switch(*p){
+                    case 'n': code=OP_NUM; break;
+                    case 't': code=OP_TYPE; break;
+                    case 'l': code=OP_LENGTH; break;
+                    case 'c': code=OP_CRC; break;
+                    case 'D': code=OP_DATA; prog->uses_D=1; break;
+                    default: break;
+                }
+                break;
+            case KFORMAT:
+                switch(*p){
+                    case 'k': code=OP_KEYWORD; prog->uses_text=1; break;
+                    case 't': code=OP_TEXT; prog->uses_text=1; prog->uses_text_string=1; break;
+                    case 'l': code=OP_LANGUAGE; prog->uses_text=1; break;
+                    case 'x': code=OP_TRANSLATED; prog->uses_text=1; break;
+                    default: break;
+                }
+                break;
+        }
+        if(code>=0)
+            prog->ops[prog->count++]=(struct format_op){(enum format_opcode)code,NULL,0};
+    }
+    if(p>literal)
+        prog->ops[prog->count++]=(struct format_op){OP_LITERAL,literal,(size_t)(p-literal)};
+
+    return prog;
+}
+
+//Read the IHDR chunk fields in the pformat_output struct and check them, return -1 if the bit depth is not valid for the color type
+int check_IHDR(struct png_context* ctx, const struct chunk* IHDR_ch){
+    //Reading IHDR_ch data
+    unsigned char* data=IHDR_ch->data;
+
+    //Save the image width, height, bit depth and color type in the pformat_output struct
+
+    //Reading the image width 
+    ctx->pformat_output._w=(unsigned int)data[0] << 24 | (unsigned int)data[1] << 16 | (unsigned int)data[2] << 8 
+    | (unsigned int)data[3]; // convert the image width from network byte order to host byte order (little endian to big endian)
+
+    //Reading the image height
+     ctx->pformat_output._h=(unsigned int)data[4] << 24 | (unsigned int)data[5] << 16 | (unsigned int)data[6] << 8 
+    | (unsigned int)data[7]; // convert the image width from network byte order to host byte order (little endian to big endian)
+
+    //Reading the image bit depth
+    ctx->pformat_output._d=data[8];
+
+    //Reading the image color type
+    ctx->pformat_output._c=data[9];
+    
+    //Check if the bit depth field value is valid for the color type, the methods are checked by the deep validation only
+    struct pngq_ihdr ihdr={ctx->pformat_output._w,ctx->pformat_output._h,data[8],data[9],0,0,0};
+    if(pngq_check_ihdr(&ihdr)==PNGQ_ERR_IHDR)
+        return -1;
+
+    return 0;
+}
+
+//Read IHDR data, update the value of the struct "pformat_output" for the printing and,finally,
+//print the information contained in that struct to the standard output according to the format defined by "pformat"
+int print_pformat(struct png_context* ctx, const struct chunk* IHDR_ch, const struct format_program* pformat){
+    if(check_IHDR(ctx,IHDR_ch)==-1)
+        return -1;
+
+    //Print the information about the PNG file in the specified format
+    run_format(ctx,pformat,IHDR_ch,NULL);
+
+    //Set the flags to indicate if the chunks information and the keywords and corrisponding text of the tEXt chunks must be printed
+    if(pformat->set_C)
+        ctx->pformat_output._C=1;
+    if(pformat->set_K)
+        ctx->pformat_output._K=1;
+
+    return 0;
+}
+
+//Print the information about the chunk in the specified format specified by "cformat"
+void print_cformat(struct png_context* ctx, const struct chunk* ch, const struct format_program* cformat){
+    run_format(ctx,cformat,ch,NULL);
+}
+
+//Check if the chunk type is one of the text chunks printed with kformat
+int is_text_chunk(const unsigned char* type){
+    return memcmp(type,"tEXt",4)==0 || memcmp(type,"zTXt",4)==0 || memcmp(type,"iTXt",4)==0;
+}
+
+//Find the keyword and the text string of the tEXt chunk "ch"
+void read_text_fields(const struct chunk* ch, struct text_fields* text){
+    //The keyword is followed by a null separator, it's at most 79 characters long
+    unsigned i =0;
+    while(i<79 && i<ch->length && ch->data[i]!='\0')
+        i++;
+    text->keyword=ch->data;
+    text->keyword_length=i;
+
+    //The text string is the rest of the data field, it's printed up to the first null character (if any)
+    if(i+1<ch->length){
+        text->text=ch->data+i+1;
+        text->text_length=strnlen((const char*)text->text,ch->length-i-1);
+    }else{
+        text->text=(const unsigned char*)"";
+        text->text_length=0;
+    }
+}
+
+//Find the fields of the text chunk "ch": tEXt (keyword, text), zTXt (keyword, compression method, compressed text) or
+//iTXt (keyword, compression flag and method, language tag, translated keyword, text that may be compressed)
+//The compressed text is decompressed in the text buffer of the context only if "need_text" is set
+//The fields that are missing in a malformed chunk are empty
+void read_text_chunk(struct png_context* ctx, const struct chunk* ch, struct text_fields* text, int need_text){
+    read_text_fields(ch,text);
+    text->language=(const unsigned char*)"";
+    text->language_length=0;
+    text->translated=(const unsigned char*)"";
+    text->translated_length=0;
+    if(memcmp(ch->type,"tEXt",4)==0)
+        return;
+
+    text->text=(const unsigned char*)"";
+    text->text_length=0;
+    const unsigned char* data=ch->data;
+    size_t length=ch->length;
+    size_t pos=text->keyword_length;
+    if(pos>=length || data[pos]!='\0')
+        return;
+    pos++;
+
+    if(memcmp(ch->type,"zTXt",4)==0){
+        //Compression method 0 (zlib) is the only one defined
+        if(pos<length && data[pos]==0 && need_text){
+            inflate_text(ctx,data+pos+1,length-pos-1);
+            if(ctx->inflated.used>0){
+                text->text=ctx->inflated.buf;
+                text->text_length=ctx->inflated.used;
+            }
+        }
+        return;
+    }
+
+    if(length-pos<2)
+        return;
+    int compressed=data[pos];
+    int method=data[pos+1];
+    pos+=2;
+
+    //Language tag and translated keyword, each one followed by a null separator
+    size_t n=strnlen((const char*)data+pos,length-pos);
+    if(n==length-pos)
+        return;
+    text->language=data+pos;
+    text->language_length=n;
+    pos+=n+1;
+    n=strnlen((const char*)data+pos,length-pos);
+    if(n==length-pos)
+        return;
+    text->translated=data+pos;
+    text->translated_length=n;
+    pos+=n+1;
+
+    if(!compressed){
+        text->text=data+pos;
+        text->text_length=length-pos;
+    }else if(method==0 && need_text){
+        inflate_text(ctx,data+pos,length-pos);
+        if(ctx->inflated.used>0){
+            text->text=ctx->inflated.buf;
+            text->text_length=ctx->inflated.used;
+        }
+    }
+}
+
+//Print the fields of the text chunk (tEXt, zTXt, iTXt) in the specified format specified by "kformat"
+void print_kformat(struct png_context* ctx, const struct chunk* ch, const struct format_program* kformat){
+    struct text_fields text;
+    //The data field of the text chunk is read only if kformat prints one of its fields, it may not be loaded otherwise
+    if(kformat->uses_text)
+        read_text_chunk(ctx,ch,&text,kformat->uses_text_string);
+    else
+        text=(struct text_fields){(const unsigned char*)"",0,(const unsigned char*)"",0,(const unsigned char*)"",0,(const unsigned char*)"",0};
+
+    //Print the information about the text chunk in the specified format
+    run_format(ctx,kformat,ch,&text);
+}
+//Parse the chunk selector "list": chunk types and chunk numbers or ranges separated by commas (e.g. "tEXt,iTXt,1-10,4812,100-")
+//Return NULL if the list is not valid or the memory allocation fails
+struct chunk_selector* parse_chunk_selector(const char* list){
+    size_t count=1;
+    for(const char* c=list; *c!='\0'; c++)
+        count+=*c==',';
+    struct chunk_selector* selector=malloc(sizeof(struct chunk_selector)+count*sizeof(struct chunk_range));
+    if(selector==NULL)
+        return NULL;
+    selector->count=count;
+
+    const char* item=list;
+    for(size_t i=0;i<count;i++){
+        struct chunk_range* range=&selector->items[i];
+        size_t length=strcspn(item,",");
+        char* end;
+        if(length==4 && pngq_valid_chunk_type((const unsigned char*)item) && !(item[0]>='0' && item[0]<='9')){
+            range->by_type=1;
+            memcpy(range->type,item,4);
+        }else if(item[0]>='0' && item[0]<='9'){
+            //Chunk number "N", range "N-M" or open range "N-"
+            range->by_type=0;
+            unsigned long first=strtoul(item,&end,10);
+            unsigned long last=first;
+            if(*end=='-'){
+                end++;
+                last=UINT32_MAX;
+                if(end!=item+length && *end>='0' && *end<='9')
+                    last=strtoul(end,&end,10);
+            }
+            if(end!=item+length || first==0 || first>last || last>UINT32_MAX){
+                free(selector);
+                return NULL;
+            }
+            range->first=(unsigned int)first;
+            range->last=(unsigned int)last;
+        }else{
+            free(selector);
+            return NULL;
+        }
+        item+=length+1;
+    }
+    return selector;
+}
+
+//Check if the chunk number "num" of type "type" is selected by the chunk selector "selector" (NULL selects all the chunks)
+int chunk_selected(const struct chunk_selector* selector, unsigned int num, const unsigned char* type){
+    if(selector==NULL)
+        return 1;
+    for(size_t i=0;i<selector->count;i++){
+        const struct chunk_range* range=&selector->items[i];
+        if(range->by_type ? memcmp(range->type,type,4)==0 : num>=range->first && num<=range->last)
+            return 1;
+    }
+    return 0;
+}
+
+//Print the information about a single chunk in the specified formats (pformat,cformat,kformat)
+//"flag" is updated with the result of the IHDR chunk fields check when the chunk is the IHDR chunk
+void print_chunk_info(struct png_context* ctx, const struct chunk* p,const struct format_program* pformat,const struct format_program* cformat,const struct format_program* kformat,int* flag){
+    if(memcmp(p->type,"IHDR",4)==0){
+        *flag=print_pformat(ctx,p,pformat); //print the IHDR chunk information following the format "pformat"
+    }
+
+    //The chunks that are not selected (option "--chunks") are only counted
+    if(!chunk_selected(ctx->select,p->num,p->type))
+        return;
+
+    if(ctx->pformat_output._C){
+        print_cformat(ctx,p,cformat); //print the chunk information following the format "cformat"
+    }
+    if(ctx->pformat_output._K && is_text_chunk(p->type)){
+        print_kformat(ctx,p,kformat); //print the fields of the text chunk following the format "kformat"
+    }
+}
+
+//Return the view of the chunk number i+1 of the chunk index, used by the checking and printing functions
+struct chunk index_chunk(const struct chunk_index* index, unsigned int i){
+    struct chunk ch;
+
+    ch.num=i+1;
+    ch.length=index->lengths[i];
+    memcpy(ch.type,index->types[i],4);
+    ch.data=(unsigned char*)index->base+index->offsets[i];
+    ch.crc=index->crcs[i];
+    return ch;
+}
+
+//Add a chunk at the end of the chunk index, growing its arrays if needed, return -1 if the memory allocation fails
+int index_add(struct chunk_index* index, const unsigned char* type, unsigned int length, size_t offset, unsigned int crc){
+    if(index->count==index->capacity){
+        STATS_TIMER(timer);
+        unsigned int capacity=index->capacity==0 ? 64 : index->capacity*2;
+        unsigned char (*types)[4]=realloc(index->types,sizeof(*types)*capacity);
+        if(types!=NULL)
+            index->types=types;
+        unsigned int* lengths=realloc(index->lengths,sizeof(*lengths)*capacity);
+        if(lengths!=NULL)
+            index->lengths=lengths;
+        size_t* offsets=realloc(index->offsets,sizeof(*offsets)*capacity);
+        if(offsets!=NULL)
+            index->offsets=offsets;
+        unsigned int* crcs=realloc(index->crcs,sizeof(*crcs)*capacity);
+        if(crcs!=NULL)
+            index->crcs=crcs;
+        STATS_PHASE(timer, STATS_ALLOC);
+        if(types==NULL || lengths==NULL || offsets==NULL || crcs==NULL)
+            return -1;
+        index->capacity=capacity;
+    }
+
+    memcpy(index->types[index->count],type,4);
+    index->lengths[index->count]=length;
+    index->offsets[index->count]=offset;
+    index->crcs[index->count]=crc;
+    index->count++;
+    return 0;
+}
+
+//Reserve "length" bytes at the end of the arena, sized to hold "expected" bytes at least, and return their offset
+//Return -1 if the memory allocation fails
+long long arena_alloc(struct arena* arena, size_t length, size_t expected){
+    if(arena->capacity-arena->used<length){
+        STATS_TIMER(timer);
+        size_t capacity=arena->capacity==0 ? ARENA_MIN_SIZE : arena->capacity;
+        if(capacity<expected)
+            capacity=expected;
+        while(capacity-arena->used<length){
+            if(capacity>SIZE_MAX/2)
+                return -1;
+            capacity*=2;
+        }
+        unsigned char* buf=realloc(arena->buf,capacity);
+        STATS_PHASE(timer, STATS_ALLOC);
+        if(buf==NULL)
+            return -1;
+        arena->buf=buf;
+        arena->capacity=capacity;
+    }
+    size_t offset=arena->used;
+    arena->used+=length;
+    return (long long)offset;
+}
+
+//Release the memory of the chunk index, the arena and the streaming buffer of a context at the end of the run
+void free_context(struct png_context* ctx){
+    free(ctx->index.types);
+    free(ctx->index.lengths);
+    free(ctx->index.offsets);
+    free(ctx->index.crcs);
+    free(ctx->arena.buf);
+    free(ctx->stream.buffer);
+    free(ctx->messages.buf);
+    free(ctx->record_text.buf);
+    pngq_inflater_free(ctx->inflate);
+    free(ctx->inflated.buf);
+}
+
+//Print the information about the PNG file in the specified formats (pformat,cformat,kformat)
+int print_info(struct png_context* ctx,const struct format_program* pformat,const struct format_program* cformat,const struct format_program* kformat){
+
+    int flag=0; // flag to check if the IHDR chunk fields are valid
+
+    //Print the chunk information 
+    for(unsigned int i =0; i < ctx->index.count; i++){
+        struct chunk p=index_chunk(&ctx->index,i);
+        print_chunk_info(ctx,&p,pformat,cformat,kformat,&flag);
+    }
+
+    return flag;
+
+
+
+}
+
+/*
+    Deep validation of the image data (option "--deep") and decompression of the zTXt and iTXt text
+    Both decode the zlib streams with the streaming inflater of the pngq library: the input is pulled from the data fields of
+    the IDAT chunks (or the compressed text) and the output is handed to a callback every 32 KiB, so neither the compressed
+    nor the decompressed data is ever copied in a single buffer.
+*/
+
+//Return the decoder of the context, it's allocated the first time and kept for the next files, NULL if the allocation fails
+struct pngq_inflater* context_inflater(struct png_context* ctx){
+    if(ctx->inflate == NULL)
+        ctx->inflate = pngq_inflater_new();
+    return ctx->inflate;
+}
+
+//Define the struct for the input of the deep validation: the IDAT chunks of the chunk index
+struct deep_input{
+    const struct chunk_index* index;    // chunk index of the PNG file
+    unsigned int next;                  // next chunk of the index to read
+};
+
+//Input callback: the data fields of the IDAT chunks, one after the other
+static int deep_input(void* arg, const unsigned char** data, size_t* length){
+    struct deep_input* in = arg;
+    if(in->next >= in->index->count || memcmp(in->index->types[in->next], "IDAT", 4) != 0)
+        return 0;
+    struct chunk ch = index_chunk(in->index, in->next++);
+    *data = ch.data;
+    *length = ch.length;
+    return 1;
+}
+
+//Decode the image data of the PNG file read in the chunk index and check its zlib stream, Adler-32, scanline filter types and
+//size against the IHDR chunk fields, without keeping the decoded image
+//Return 0 if the image data is valid, -1 after printing the error otherwise
+int deep_check_image(struct png_context* ctx){
+    STATS_TIMER(timer);
+    const struct chunk_index* index = &ctx->index;
+
+    //IHDR fields: a bit depth not valid for the color type is reported by print_info
+    if(index->count == 0 || memcmp(index->types[0], "IHDR", 4) != 0 || index->lengths[0] < 13){
+        report_error(ctx, STATS_ERR_IMAGE, "Error, the image data can't be checked without the IHDR chunk\n");
+        return -1;
+    }
+    struct chunk ihdr_ch = index_chunk(index, 0);
+    struct pngq_ihdr ihdr;
+    pngq_parse_ihdr(ihdr_ch.data, ihdr_ch.length, &ihdr);
+    int status = pngq_check_ihdr(&ihdr);
+    if(status == PNGQ_ERR_IHDR)
+        return 0;
+    if(status != PNGQ_OK){
+        //The fields the decoding depends on
+        char message[160];
+        snprintf(message, sizeof(message), "Error, the image data can't be checked, %s\n", pngq_strerror(status));
+        report_error(ctx, STATS_ERR_IMAGE, message);
+        return -1;
+    }
+
+    //The IDAT chunks must be consecutive
+    unsigned int first = 0;
+    while(first < index->count && memcmp(index->types[first], "IDAT", 4) != 0)
+        first++;
+    if(first == index->count)
+        status = PNGQ_ERR_NO_IDAT;
+    for(unsigned int i = first + 1; i < index->count && status == PNGQ_OK; i++){
+        if(memcmp(index->types[i], "IDAT", 4) == 0 && memcmp(index->types[i-1], "IDAT", 4) != 0)
+            status = PNGQ_ERR_IDAT_SPLIT;
+    }
+
+    if(status == PNGQ_OK){
+        struct pngq_inflater* z = context_inflater(ctx);
+        if(z == NULL){
+            report_error(ctx, STATS_ERR_MEMORY, "Error, can't allocate memory for the image data decoder\n");
+            return -1;
+        }
+        struct deep_input in = {index, first};
+        status = pngq_check_image_data(z, &ihdr, deep_input, &in);
+        STATS_PHASE(timer, STATS_INFLATE);
+    }
+
+    if(status != PNGQ_OK){
+        report_status(ctx, status);
+        return -1;
+    }
+    return 0;
+}
+
+//Maximum size of the decompressed text of a zTXt or iTXt chunk, the text is printed up to this size
+//A compressed text can be about 1000 times larger than its chunk, so the limit bounds the memory used by a hostile file
+#define TEXT_INFLATE_LIMIT (1024*1024)
+
+//Input callback of the compressed text: a single segment
+struct text_input{
+    const unsigned char* data;      // compressed text, NULL once it has been returned
+    size_t length;                  // length of the compressed text
+};
+
+static int text_input(void* arg, const unsigned char** data, size_t* length){
+    struct text_input* in = arg;
+    if(in->data == NULL)
+        return 0;
+    *data = in->data;
+    *length = in->length;
+    in->data = NULL;
+    return 1;
+}
+
+//Output callback of the compressed text: append the decoded bytes to the text buffer, the decoding stops at the size limit
+static int text_output(void* arg, const unsigned char* data, size_t length){
+    struct text_buffer* text = arg;
+    size_t n = TEXT_INFLATE_LIMIT - text->used;
+    if(n > length)
+        n = length;
+    if(text->capacity - text->used < n){
+        size_t capacity = text->capacity == 0 ? 4096 : text->capacity;
+        while(capacity - text->used < n)
+            capacity *= 2;
+        if(capacity > TEXT_INFLATE_LIMIT)
+            capacity = TEXT_INFLATE_LIMIT;
+        unsigned char* buf = realloc(text->buf, capacity);
+        if(buf == NULL)
+            return -1;
+        text->buf = buf;
+        text->capacity = capacity;
+    }
+    memcpy(text->buf + text->used, data, n);
+    text->used += n;
+    return n < length ? -1 : 0;
+}
+
+//Decompress the zlib stream data[0..length-1] of a text chunk in the text buffer of the context, up to TEXT_INFLATE_LIMIT bytes
+//The text is decoded incrementally through the window of the decoder, the text decoded before an error in the stream is kept
+void inflate_text(struct png_context* ctx, const unsigned char* data, size_t length){
+    ctx->inflated.used = 0;
+    struct pngq_inflater* z = context_inflater(ctx);
+    if(z == NULL)
+        return;
+    STATS_TIMER(timer);
+    struct text_input in = {data, length};
+    uint32_t adler;
+    pngq_inflate_zlib(z, text_input, &in, text_output, &ctx->inflated, &adler);
+    STATS_PHASE(timer, STATS_INFLATE);
+}
+
+/*
+    Machine output (option "--output")
+    The information about each PNG file is written as a single record: a JSON object on its own line ("ndjson") or a
+    length-prefixed binary record ("binary"). The records are serialized directly in the output sink, without printf.
+*/
+
+//Escape of each byte in a JSON string: 0 if it's copied, the character following the backslash otherwise ('u' for \u00XX)
+static const char json_escape[256] = {
+    [0 ... 7] = 'u', ['\b'] = 'b', ['\t'] = 't', ['\n'] = 'n', [0x0b] = 'u', ['\f'] = 'f', ['\r'] = 'r', [0x0e ... 0x1f] = 'u',
+    ['"'] = '"', ['\\'] = '\\', [0x7f] = 'u',
+};
+
+//Print the bytes data[0..length-1] as a JSON string
+//The keywords and the text strings of the text chunks are Latin-1 and are converted to UTF-8 ("latin1"), file names are copied
+static void json_string(struct out_sink* out, const unsigned char* data, size_t length, int latin1){
+    static const char hex[] = "0123456789abcdef";
+    char* dst=sink_reserve(out,length*6+2);
+    if(dst==NULL)
+        return;
+    char* p=dst;
+    *p++='"';
+    for(size_t i=0;i<length;i++){
+        unsigned char c=data[i];
+        char escape=json_escape[c];
+        if(escape==0){
+            if(c>=0x80 && latin1){
+                *p++=(char)(0xC0 | c>>6);
+                *p++=(char)(0x80 | (c & 0x3F));
+            }else{
+                *p++=(char)c;
+            }
+            continue;
+        }
+        *p++='\\';
+        *p++=escape;
+        if(escape=='u'){
+            *p++='0';
+            *p++='0';
+            *p++=hex[c>>4];
+            *p++=hex[c & 0xF];
+        }
+    }
+    *p++='"';
+    sink_commit(out,(size_t)(p-dst));
+}
+
+//Status of a record
+enum record_status {RECORD_VALID, RECORD_BAD_IHDR, RECORD_READ_ERROR, RECORD_OPEN_ERROR};
+
+//Error message of the IHDR check
+static const char ihdr_error[] = "the bit depth field value is not valid for the color type field value";
+
+//Remove the "Error, " prefix and the line feed from the error message[0..*length-1] printed by the readers
+static const char* record_error(const char* message, size_t* length){
+    if(*length>=7 && memcmp(message,"Error, ",7)==0){
+        message+=7;
+        *length-=7;
+    }
+    while(*length>0 && message[*length-1]=='\n')
+        (*length)--;
+    return message;
+}
+
+//Find the keyword and the text string of the text chunk number "i" of the chunk index for the records
+//The compressed text of the zTXt and iTXt chunks is decompressed in the text buffer of the context, up to TEXT_INFLATE_LIMIT bytes
+static void record_text(struct png_context* ctx, unsigned int i, struct text_fields* text){
+    struct chunk ch=index_chunk(&ctx->index,i);
+    read_text_chunk(ctx,&ch,text,1);
+}
+
+//Print the record of the file read in the chunk index (error==NULL) or of the file that can't be read because of "error"
+//in the JSON format, on a single line
+void print_ndjson(struct png_context* ctx, enum record_status status, const char* error, size_t error_length){
+    struct out_sink* out=ctx->out;
+    const char* file_name=ctx->pformat_output._f;
+
+    sink_puts(out,"{\"file\":");
+    json_string(out,(const unsigned char*)file_name,strlen(file_name),0);
+    sink_puts(out,status==RECORD_VALID ? ",\"valid\":true" : ",\"valid\":false");
+    if(error!=NULL){
+        sink_puts(out,",\"error\":");
+        json_string(out,(const unsigned char*)error,error_length,0);
+    }
+    if(status==RECORD_READ_ERROR || status==RECORD_OPEN_ERROR){
+        sink_puts(out,"}\n");
+        return;
+    }
+
+    sink_puts(out,",\"width\":");
+    print_uint(out,ctx->pformat_output._w);
+    sink_puts(out,",\"height\":");
+    print_uint(out,ctx->pformat_output._h);
+    sink_puts(out,",\"bit_depth\":");
+    print_uint(out,ctx->pformat_output._d);
+    sink_puts(out,",\"color_type\":");
+    print_uint(out,ctx->pformat_output._c);
+    sink_puts(out,",\"chunks\":[");
+    for(unsigned int i=0;i<ctx->index.count;i++){
+        //The chunk type is made of letters and digits, it doesn't need to be escaped
+        char* dst=sink_reserve(out,16);
+        if(dst==NULL)
+            return;
+        memcpy(dst,i==0 ? "{\"type\":\"" : ",{\"type\":\"",i==0 ? 9 : 10);
+        memcpy(dst+(i==0 ? 9 : 10),ctx->index.types[i],4);
+        sink_commit(out,i==0 ? 13 : 14);
+        sink_puts(out,"\",\"length\":");
+        print_uint(out,ctx->index.lengths[i]);
+        sink_puts(out,",\"crc\":");
+        print_uint(out,ctx->index.crcs[i]);
+        sink_putc(out,'}');
+    }
+    sink_puts(out,"],\"text\":[");
+    int first=1;
+    for(unsigned int i=0;i<ctx->index.count;i++){
+        if(!is_text_chunk(ctx->index.types[i]))
+            continue;
+        struct text_fields text;
+        record_text(ctx,i,&text);
+        sink_puts(out,first ? "{\"keyword\":" : ",{\"keyword\":");
+        json_string(out,text.keyword,text.keyword_length,1);
+        sink_puts(out,",\"text\":");
+        //The text string of the iTXt chunks is already UTF-8
+        json_string(out,text.text,text.text_length,memcmp(ctx->index.types[i],"iTXt",4)!=0);
+        sink_putc(out,'}');
+        first=0;
+    }
+    sink_puts(out,"]}\n");
+}
+
+//Write little endian values
+static unsigned char* put_le16(unsigned char* p, unsigned int v){
+    p[0]=(unsigned char)v;
+    p[1]=(unsigned char)(v>>8);
+    return p+2;
+}
+static unsigned char* put_le32(unsigned char* p, uint32_t v){
+    p[0]=(unsigned char)v;
+    p[1]=(unsigned char)(v>>8);
+    p[2]=(unsigned char)(v>>16);
+    p[3]=(unsigned char)(v>>24);
+    return p+4;
+}
+
+//Print the record of the file read in the chunk index (error==NULL) or of the file that can't be read because of "error"
+//as a binary record, all the integers are little endian:
+//    u32 length of the rest of the record
+//    u8 status (0 valid, 1 IHDR fields not valid, 2 read error, 3 open error), u8 color type, u8 bit depth, u8 0
+//    u32 width, u32 height, u32 number of chunks, u32 number of text chunks
+//    u16 length and bytes of the file name, u16 length and bytes of the error message
+//    for each chunk: 4 bytes type, u32 length, u32 CRC
+//    for each text chunk (tEXt, zTXt, iTXt): u8 length and bytes of the keyword, u32 length and bytes of the text string
+//    (decompressed, Latin-1 for tEXt and zTXt, UTF-8 for iTXt)
+void print_binary(struct png_context* ctx, enum record_status status, const char* error, size_t error_length){
+    const char* file_name=ctx->pformat_output._f;
+    size_t name_length=strlen(file_name);
+    if(name_length>0xFFFF)
+        name_length=0xFFFF;
+    if(error_length>0xFFFF)
+        error_length=0xFFFF;
+
+    //The text section is written first in a buffer of the context, so that each compressed text is decompressed once
+    unsigned int chunks=status==RECORD_READ_ERROR || status==RECORD_OPEN_ERROR ? 0 : ctx->index.count;
+    unsigned int texts=0;
+    struct out_sink* section=&ctx->record_text;
+    if(section->buf==NULL && sink_init(section,-1)!=0)
+        return;
+    section->used=0;
+    for(unsigned int i=0;i<chunks;i++){
+        if(!is_text_chunk(ctx->index.types[i]))
+            continue;
+        struct text_fields text;
+        record_text(ctx,i,&text);
+        unsigned char* p=(unsigned char*)sink_reserve(section,1+text.keyword_length+4+text.text_length);
+        if(p==NULL)
+            return;
+        *p++=(unsigned char)text.keyword_length;
+        memcpy(p,text.keyword,text.keyword_length);
+        p=put_le32(p+text.keyword_length,(uint32_t)text.text_length);
+        if(text.text_length>0)
+            memcpy(p,text.text,text.text_length);
+        sink_commit(section,1+text.keyword_length+4+text.text_length);
+        texts++;
+    }
+
+    //Size of the record
+    size_t length=4+4*4+2+name_length+2+error_length+(size_t)chunks*12+section->used;
+    unsigned char* dst=(unsigned char*)sink_reserve(ctx->out,4+length);
+    if(dst==NULL)
+        return;
+    unsigned char* p=put_le32(dst,(uint32_t)length);
+    *p++=(unsigned char)status;
+    *p++=chunks ? (unsigned char)ctx->pformat_output._c : 0;
+    *p++=chunks ? (unsigned char)ctx->pformat_output._d : 0;
+    *p++=0;
+    p=put_le32(p,chunks ? ctx->pformat_output._w : 0);
+    p=put_le32(p,chunks ? ctx->pformat_output._h : 0);
+    p=put_le32(p,chunks);
+    p=put_le32(p,texts);
+    p=put_le16(p,(unsigned int)name_length);
+    memcpy(p,file_name,name_length);
+    p+=name_length;
+    p=put_le16(p,(unsigned int)error_length);
+    if(error_length>0)
+        memcpy(p,error,error_length);
+    p+=error_length;
+    for(unsigned int i=0;i<chunks;i++){
+        memcpy(p,ctx->index.types[i],4);
+        p=put_le32(p+4,ctx->index.lengths[i]);
+        p=put_le32(p,ctx->index.crcs[i]);
+    }
+    if(section->used>0)
+        memcpy(p,section->buf,section->used);
+    sink_commit(ctx->out,4+length);
+}
+
+//Print the record of a file in the output mode "mode", see print_ndjson and print_binary
+//The IHDR chunk fields of a file read are checked like with pformat, return -1 if they are not valid, 0 otherwise
+int print_record(struct png_context* ctx, enum output_mode mode, enum record_status status, const char* error, size_t error_length){
+    int result=0;
+    if(status==RECORD_VALID && ctx->index.count>0){
+        struct chunk ihdr=index_chunk(&ctx->index,0);
+        if(memcmp(ihdr.type,"IHDR",4)==0 && ihdr.length>=13 && check_IHDR(ctx,&ihdr)==-1){
+            status=RECORD_BAD_IHDR;
+            error=ihdr_error;
+            error_length=sizeof(ihdr_error)-1;
+            result=-1;
+        }
+    }
+    if(error!=NULL)
+        error=record_error(error,&error_length);
+    if(mode==OUTPUT_BINARY)
+        print_binary(ctx,status,error,error_length);
+    else
+        print_ndjson(ctx,status,error,error_length);
+    return result;
+}
+
+//Print the information about the PNG file read in the chunk index following the formats or as a record of the output mode
+void print_file(struct png_context* ctx, enum output_mode mode, const struct format_program* pformat,const struct format_program* cformat,const struct format_program* kformat){
+    STATS_TIMER(timer);
+    int flag = mode==OUTPUT_TEXT ? print_info(ctx,pformat,cformat,kformat) : print_record(ctx,mode,RECORD_VALID,NULL,0);
+    STATS_PHASE(timer, STATS_FORMAT);
+    //A file with IHDR fields not valid is counted as an error, not as a valid file
+    if(flag==-1){ // in case of error
+        if(mode==OUTPUT_TEXT)
+            sink_printf(ctx->out,"Error, the bit depth field value is not valid for the color type field value for the PNG file %s\n",ctx->pformat_output._f);
+        STATS_ADD(errors[STATS_ERR_IHDR], 1);
+    }else{
+        STATS_ADD(valid, 1);
+    }
+}
+
+//Close the PNG file and release the memory of its chunks: the mapping of the file is removed at once,
+//the chunk index and the arena are only reset so that the next file read with the same context reuses them
+int dealloc_mem(struct png_context* ctx, FILE* png_file){
+    //Close the PNG file, the files loaded by the io_uring backend are already closed
+    if(png_file!=NULL)
+        fclose(png_file);
+
+    if(ctx->mapping.addr!=NULL){
+        if(ctx->mapping.loaded==1)
+            free(ctx->mapping.addr);
+        else if(ctx->mapping.loaded==0)
+            munmap(ctx->mapping.addr,ctx->mapping.size);
+        ctx->mapping.addr=NULL;
+        ctx->mapping.loaded=0;
+    }
+    ctx->index.count=0;
+    ctx->index.base=NULL;
+    ctx->arena.used=0;
+
+    //Don't keep a very large arena for the rest of the run
+    if(ctx->arena.capacity>ARENA_KEEP_MAX){
+        free(ctx->arena.buf);
+        ctx->arena.buf=NULL;
+        ctx->arena.capacity=0;
+    }
+    
+    return -1;
+
+}
+
+//Map the whole PNG file in memory, or read it in the arena if it's smaller than MMAP_MIN_SIZE
+//Return 0 on success and -1 if the file can't be mapped (pipes, empty or special files)
+int map_png_file(struct png_context* ctx, FILE* png_file){
+    struct stat st;
+    int fd=fileno(png_file);
+
+    if(fstat(fd,&st)!=0 || !S_ISREG(st.st_mode) || st.st_size==0)
+        return -1;
+
+    STATS_TIMER(timer);
+    if(st.st_size<MMAP_MIN_SIZE){
+        long long offset=arena_alloc(&ctx->arena,(size_t)st.st_size,0);
+        if(offset<0)
+            return -1;
+        size_t size=0;
+        while(size<(size_t)st.st_size){
+            ssize_t n=pread(fd,ctx->arena.buf+offset+size,(size_t)st.st_size-size,(off_t)size);
+            if(n<0 && errno==EINTR)
+                continue;
+            if(n<=0)
+                break;
+            size+=(size_t)n;
+        }
+        STATS_PHASE(timer, STATS_OPEN);
+        //A file truncated while it's read is parsed as it is
+        ctx->mapping.addr=ctx->arena.buf+offset;
+        ctx->mapping.size=size;
+        ctx->mapping.loaded=2;
+        return 0;
+    }
+
+    void* addr=mmap(NULL,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    if(addr==MAP_FAILED)
+        return -1;
+
+    //The file is read only once from the start to the end
+    madvise(addr,(size_t)st.st_size,MADV_SEQUENTIAL);
+    STATS_PHASE(timer, STATS_OPEN);
+
+    ctx->mapping.addr=addr;
+    ctx->mapping.size=(size_t)st.st_size;
+    return 0;
+}
+
+//Read a big endian 32 bit value
+static unsigned int read_be32(const unsigned char* p){
+    return (unsigned int)p[0] << 24 | (unsigned int)p[1] << 16 | (unsigned int)p[2] << 8 | (unsigned int)p[3];
+}
+
+//Print the error "message" of kind "kind" found in the mapped PNG file and release the file
+//When the CRC check is deferred to the parallel check, the CRC of the chunks read before the error are checked first,
+//so that the reported error is the same as with the sequential check
+int mapped_error(struct png_context* ctx, FILE* png_file, int deferred_crc, enum stats_error kind, const char* message){
+    if(deferred_crc && parallel_crc_check(&ctx->index,ctx->index.count,ctx->crc_threads)>=0){
+        kind=STATS_ERR_CRC;
+        message="Error, the chunk CRC field is not correct\n";
+    }
+    report_error(ctx,kind,message);
+    return dealloc_mem(ctx,png_file);
+}
+
+//Read the PNG file mapped in memory by "map_png_file" and fill the chunk index, return 0 if the PNG file is valid and -1 otherwise
+//The chunks are parsed by a reader of the pngq library on the mapping: their data fields are not copied, the chunk index
+//references them in the mapping which is released by "dealloc_mem"
+//The CRC are checked here rather than by the reader, so that they are timed and, for large files, checked in parallel
+int readPNGmapped(struct png_context* ctx, FILE* png_file){
+    struct pngq_reader* reader;
+    ctx->index.base=ctx->mapping.addr;
+
+    //PNG signature check
+    STATS_TIMER(timer);
+    int status=pngq_open_memory(&reader,ctx->mapping.addr,ctx->mapping.size,PNGQ_NO_CRC);
+    if(status!=PNGQ_OK){
+        report_status(ctx,status);
+        return dealloc_mem(ctx,png_file);
+    }
+    STATS_PHASE(timer, STATS_SIGNATURE);
+    STATS_ADD(bytes, 8);
+
+    //Large files have their CRC checked in parallel by "crc_threads" threads after all the chunks are read
+    int deferred_crc=ctx->crc_threads>1 && ctx->mapping.size>=CRC_PARALLEL_MIN;
+
+    /* Read and save chunk information till the IEND chunk */
+    struct pngq_chunk c;
+    while((status=pngq_next_chunk(reader,&c))==1){
+        struct chunk new_chunk={c.num,c.length,{c.type[0],c.type[1],c.type[2],c.type[3]},(unsigned char*)c.data,c.crc};
+
+        //Check if the CRC is correct, unless all the CRC are checked in parallel once the chunks are read
+        if(!deferred_crc && PNG_crc_check(new_chunk,4)!=new_chunk.crc){
+            pngq_close(reader);
+            return mapped_error(ctx,png_file,0,STATS_ERR_CRC,"Error, the chunk CRC field is not correct\n");
+        }
+
+        if(index_add(&ctx->index,new_chunk.type,new_chunk.length,(size_t)(new_chunk.data-ctx->mapping.addr),new_chunk.crc)!=0){
+            pngq_close(reader);
+            return mapped_error(ctx,png_file,deferred_crc,STATS_ERR_MEMORY,"Error, can't allocate memory for the array of chunks\n");
+        }
+
+        //Increment the number of chunks of the PNG file
+        ctx->pformat_output._N+=1;
+        STATS_ADD(chunks, 1);
+        STATS_ADD(bytes, new_chunk.length+12);
+    }
+    pngq_close(reader);
+
+    if(status!=PNGQ_OK){
+        char message[160];
+        snprintf(message,sizeof(message),"Error, %s\n",pngq_strerror(status));
+        return mapped_error(ctx,png_file,deferred_crc,status_error_kind(status),message);
+    }
+
+    if(deferred_crc && parallel_crc_check(&ctx->index,ctx->index.count,ctx->crc_threads)>=0){
+        report_error(ctx,STATS_ERR_CRC,"Error, the chunk CRC field is not correct\n");
+        return dealloc_mem(ctx,png_file);
+    }
+
+    return 0;
+}
+
+//Read the PNG file and fill the chunk index of the context, return 0 if the PNG file is valid and -1 otherwise
+//The chunk data fields are copied one after the other in the arena of the context, which is sized from the file length
+int readPNGfile(struct png_context* ctx, FILE* png_file){
+
+    //Zero-copy mode for regular files, fread is kept for pipes and the other files that can't be mapped
+    if(ctx->use_mmap && map_png_file(ctx,png_file)==0)
+        return readPNGmapped(ctx,png_file);
+
+    //Check if the PNG file is valid
+
+    //PNG signature check
+    const unsigned char png_signature[8] = {0x89,0x50,0x4E,0x47,0x0D,0x0A,0x1A,0x0A}; // PNG signature
+    unsigned char png_signature_read[8]; // PNG signature read from the PNG file
+    
+    //Read the PNG signature from the PNG file
+    STATS_TIMER(timer);
+    if(fread(png_signature_read,8,1,png_file)!=1){
+        report_error(ctx,STATS_ERR_SIGNATURE,"Error, can't read the PNG signature\n");
+        return dealloc_mem(ctx,png_file);
+    }
+
+    //Check if the PNG signature is correct
+    if(memcmp(png_signature,png_signature_read,8)!=0){
+        report_error(ctx,STATS_ERR_SIGNATURE,"Error, the file is not a valid PNG file\n");
+        return dealloc_mem(ctx,png_file);
+    }
+    STATS_PHASE(timer, STATS_SIGNATURE);
+    STATS_ADD(bytes, 8);
+
+    //The data fields of a regular file fit in an arena of the file size, the arena of pipes grows while they are read
+    struct stat st;
+    size_t expected=0;
+    if(fstat(fileno(png_file),&st)==0 && S_ISREG(st.st_mode))
+        expected=(size_t)st.st_size;
+
+    //Reading the PNG file chunks
+
+    unsigned char check_chunk_type[4]="IHDR"; //used to flag the type of the current chunk and check if it is the IEND chunk
+    unsigned i =0;
+
+    /* Read and save chunk information till the end of file */
+    while(memcmp(check_chunk_type,"IEND",4)!=0 && !feof(png_file)){
+
+        struct chunk new_chunk;
+
+        //Assign the chunk number to the new chunk
+        new_chunk.num=i+1;
+        
+        // Read the chunk length field
+        if(fread(&new_chunk.length,4,1,png_file)!=1){
+            report_error(ctx,STATS_ERR_TRUNCATED,"Error, can't read the chunk length field\n");
+            return dealloc_mem(ctx,png_file);
+        }
+
+        new_chunk.length=htonl(new_chunk.length); // convert the chunk length field from network byte order to host byte order
+        
+        //Read the chunk type field
+        if(fread(new_chunk.type,4,1,png_file)!=1){ 
+            report_error(ctx,STATS_ERR_TRUNCATED,"Error, can't read the chunk type field\n");
+            return dealloc_mem(ctx,png_file);
+        } 
+
+        //Check if the chunk type field is valid
+        if(!pngq_valid_chunk_type(new_chunk.type)){
+            report_error(ctx,STATS_ERR_CHUNK_TYPE,"Error, the chunk type field is not valid\n");
+            return dealloc_mem(ctx,png_file);
+        }
+        
+        //Reading the chunk data, its space is taken from the arena
+        long long offset=arena_alloc(&ctx->arena,new_chunk.length,expected);
+
+        //Check if the memory allocation was successful
+        if(offset<0){
+            report_error(ctx,STATS_ERR_MEMORY,"Error, can't allocate memory for the chunk data field\n");
+            return dealloc_mem(ctx,png_file);
+        }
+        new_chunk.data=ctx->arena.buf+offset;
+
+        //Read the chunk data field
+        if(fread(new_chunk.data,sizeof(unsigned char),new_chunk.length,png_file)!=new_chunk.length){ // read the IHDR chunk data)
+            report_error(ctx,STATS_ERR_TRUNCATED,"Error, can't read the chunk data field\n");
+            return dealloc_mem(ctx,png_file);
+        } 
+
+        //Reading the chunk CRC field
+        if(fread(&new_chunk.crc,4,1,png_file)!=1){
+            report_error(ctx,STATS_ERR_TRUNCATED,"Error, can't read the chunk CRC field\n");
+            return dealloc_mem(ctx,png_file);
+        }
+        new_chunk.crc=htonl(new_chunk.crc); // convert the chunk CRC field from network byte order to host byte order
+
+
+        //Check if the CRC is correct
+        if(PNG_crc_check(new_chunk,4)!=new_chunk.crc){
+            report_error(ctx,STATS_ERR_CRC,"Error, the chunk CRC field is not correct\n");
+            return dealloc_mem(ctx,png_file);
+        }
+
+        if(index_add(&ctx->index,new_chunk.type,new_chunk.length,(size_t)offset,new_chunk.crc)!=0){
+            report_error(ctx,STATS_ERR_MEMORY,"Error, can't allocate memory for the array of chunks\n");
+            return dealloc_mem(ctx,png_file);
+        }
+
+        //Update the check_chunk_type value
+        memcpy(check_chunk_type,new_chunk.type,4);
+
+        i++;
+
+        //Increment the number of chunks of the PNG file
+        ctx->pformat_output._N+=1;
+        STATS_ADD(chunks, 1);
+        STATS_ADD(bytes, new_chunk.length+12);
+    }
+
+    //The arena may have moved while it grew, the data fields are referenced by their offset
+    ctx->index.base=ctx->arena.buf;
+    return 0;
+}
+
+
+//Read the PNG file trusting the CRC of its chunks (option "--trust-crc"): only the data that the formats print is read
+//The signature and the chunk headers are read with pread and the data fields of the other chunks are skipped, the query stops
+//after the IHDR chunk when the formats don't print anything else. Only the CRC of the IHDR chunk is checked.
+//Return 0 if the PNG file is valid, -1 if it's not and -2 if the file is not seekable (it must be read with "readPNGfile")
+int readPNGheaders(struct png_context* ctx, FILE* png_file,const struct format_program* pformat,const struct format_program* cformat,const struct format_program* kformat){
+    const unsigned char png_signature[8] = {0x89,0x50,0x4E,0x47,0x0D,0x0A,0x1A,0x0A}; // PNG signature
+    int fd=fileno(png_file);
+    struct stat st;
+
+    if(fstat(fd,&st)!=0 || !S_ISREG(st.st_mode))
+        return -2;
+    off_t file_size=st.st_size;
+
+    //Data needed by the formats: the IHDR chunk is always read, the other data fields only if they are printed
+    int ihdr_only=!pformat->set_C && !pformat->set_K && !pformat->uses_N;
+    int need_all_data=pformat->set_C && cformat->uses_D;
+    int need_text=pformat->set_K && kformat->uses_text;
+
+    unsigned char buf[12]; // CRC field of a chunk followed by the length and type fields of the next one
+    STATS_TIMER(timer);
+    ssize_t n=pread(fd,buf,8,0);
+    if(n!=8){
+        report_error(ctx,STATS_ERR_SIGNATURE,"Error, can't read the PNG signature\n");
+        return dealloc_mem(ctx,png_file);
+    }
+    if(memcmp(png_signature,buf,8)!=0){
+        report_error(ctx,STATS_ERR_SIGNATURE,"Error, the file is not a valid PNG file\n");
+        return dealloc_mem(ctx,png_file);
+    }
+    STATS_PHASE(timer, STATS_SIGNATURE);
+    STATS_ADD(bytes, 8);
+
+    off_t offset=8; // file offset of the current chunk
+    n=pread(fd,buf+4,8,offset); // the chunk header is always kept at buf[4..11]
+
+    unsigned i =0;
+    for(;;){
+        struct chunk new_chunk;
+        new_chunk.num=i+1;
+
+        //Read the chunk length and type fields
+        if(n<4){
+            report_error(ctx,STATS_ERR_TRUNCATED,"Error, can't read the chunk length field\n");
+            return dealloc_mem(ctx,png_file);
+        }
+        if(n<8){
+            report_error(ctx,STATS_ERR_TRUNCATED,"Error, can't read the chunk type field\n");
+            return dealloc_mem(ctx,png_file);
+        }
+        new_chunk.length=read_be32(buf+4);
+        memcpy(new_chunk.type,buf+8,4);
+        if(!pngq_valid_chunk_type(new_chunk.type)){
+            report_error(ctx,STATS_ERR_CHUNK_TYPE,"Error, the chunk type field is not valid\n");
+            return dealloc_mem(ctx,png_file);
+        }
+
+        off_t data_offset=offset+8;
+        if(data_offset+(off_t)new_chunk.length>file_size){
+            report_error(ctx,STATS_ERR_TRUNCATED,"Error, can't read the chunk data field\n");
+            return dealloc_mem(ctx,png_file);
+        }
+
+        //Read the data field only if it's needed, otherwise it's skipped
+        int is_ihdr=memcmp(new_chunk.type,"IHDR",4)==0;
+        long long data=0;
+        new_chunk.data=NULL;
+        if(is_ihdr || need_all_data || (need_text && is_text_chunk(new_chunk.type))){
+            data=arena_alloc(&ctx->arena,new_chunk.length,0);
+            if(data<0){
+                report_error(ctx,STATS_ERR_MEMORY,"Error, can't allocate memory for the chunk data field\n");
+                return dealloc_mem(ctx,png_file);
+            }
+            new_chunk.data=ctx->arena.buf+data;
+            if(pread(fd,new_chunk.data,new_chunk.length,data_offset)!=(ssize_t)new_chunk.length){
+                report_error(ctx,STATS_ERR_TRUNCATED,"Error, can't read the chunk data field\n");
+                return dealloc_mem(ctx,png_file);
+            }
+        }
+
+        //Read the CRC field together with the header of the next chunk
+        n=pread(fd,buf,12,data_offset+new_chunk.length);
+        if(n<4){
+            report_error(ctx,STATS_ERR_TRUNCATED,"Error, can't read the chunk CRC field\n");
+            return dealloc_mem(ctx,png_file);
+        }
+        new_chunk.crc=read_be32(buf);
+        n-=4;
+
+        if(is_ihdr && PNG_crc_check(new_chunk,4)!=new_chunk.crc){
+            report_error(ctx,STATS_ERR_CRC,"Error, the chunk CRC field is not correct\n");
+            return dealloc_mem(ctx,png_file);
+        }
+
+        if(index_add(&ctx->index,new_chunk.type,new_chunk.length,(size_t)data,new_chunk.crc)!=0){
+            report_error(ctx,STATS_ERR_MEMORY,"Error, can't allocate memory for the array of chunks\n");
+            return dealloc_mem(ctx,png_file);
+        }
+        ctx->pformat_output._N+=1;
+        STATS_ADD(chunks, 1);
+        STATS_ADD(bytes, new_chunk.length+12);
+        i++;
+
+        if(memcmp(new_chunk.type,"IEND",4)==0 || (ihdr_only && is_ihdr))
+            break;
+        offset=data_offset+new_chunk.length+4;
+    }
+
+    ctx->index.base=ctx->arena.buf;
+    return 0;
+}
+
+//Count the chunks of the PNG file skipping their data fields, used by the streaming mode to know "_N" before printing the IHDR chunk
+//The file position is restored at the first chunk, return -1 if the file is not seekable
+int stream_count_chunks(FILE* png_file, unsigned int* count){
+    unsigned char header[8]; // chunk length and type fields
+    *count=0;
+
+    if(fseek(png_file,8,SEEK_SET)!=0)
+        return -1;
+
+    while(fread(header,8,1,png_file)==1){
+        *count+=1;
+        if(memcmp(header+4,"IEND",4)==0)
+            break;
+        if(fseek(png_file,(long)read_be32(header)+4,SEEK_CUR)!=0)
+            break;
+    }
+
+    clearerr(png_file);
+    return fseek(png_file,8,SEEK_SET);
+}
+
+//Print the data field of a chunk larger than the streaming buffer reading it again from the file, piece by piece
+void stream_print_dataChunk(struct png_context* ctx, const struct chunk* ch){
+    long resume=ftell(ctx->stream.file); // position after the chunk, where the reading continues
+
+    if(ch->length==0)
+        sink_putc(ctx->out,'\n');
+
+    fseek(ctx->stream.file,ctx->stream.data_offset,SEEK_SET);
+    for(unsigned int done=0;done<ch->length;){
+        size_t piece=ch->length-done < ctx->stream.limit ? ch->length-done : ctx->stream.limit;
+        if(fread(ctx->stream.buffer,1,piece,ctx->stream.file)!=piece)
+            break;
+        print_dataRange(ctx,ctx->stream.buffer,done,piece,ch->length);
+        done+=piece;
+    }
+    fseek(ctx->stream.file,resume,SEEK_SET);
+}
+
+//Read the PNG file through the streaming buffer and print the information about each chunk as soon as its CRC is checked
+//Return 0 if the PNG file is valid, -1 if it can't be read and -2 if the IHDR chunk fields are not valid
+int readPNGstream(struct png_context* ctx, FILE* png_file,const struct format_program* pformat,const struct format_program* cformat,const struct format_program* kformat){
+    const unsigned char png_signature[8] = {0x89,0x50,0x4E,0x47,0x0D,0x0A,0x1A,0x0A}; // PNG signature
+    unsigned char header[8]; // chunk length and type fields
+    int flag=0; // flag to check if the IHDR chunk fields are valid
+
+    //PNG signature check
+    STATS_TIMER(timer);
+    if(fread(header,8,1,png_file)!=1){
+        report_error(ctx,STATS_ERR_SIGNATURE,"Error, can't read the PNG signature\n");
+        return -1;
+    }
+    if(memcmp(png_signature,header,8)!=0){
+        report_error(ctx,STATS_ERR_SIGNATURE,"Error, the file is not a valid PNG file\n");
+        return -1;
+    }
+    STATS_PHASE(timer, STATS_SIGNATURE);
+    STATS_ADD(bytes, 8);
+
+    //The number of chunks is printed with the IHDR chunk, before the other chunks are read
+    if(pformat->uses_N && stream_count_chunks(png_file,&ctx->pformat_output._N)!=0){
+        report_error(ctx,STATS_ERR_STREAM,"Error, the streaming mode needs a seekable file to count the chunks\n");
+        return -1;
+    }
+
+    ctx->stream.file=png_file;
+    int seekable=ftell(png_file)>=0;
+    int print_data=cformat->uses_D;
+
+    unsigned char check_chunk_type[4]="IHDR"; //used to flag the type of the current chunk and check if it is the IEND chunk
+    unsigned i =0;
+
+    while(memcmp(check_chunk_type,"IEND",4)!=0){
+        struct chunk new_chunk;
+        new_chunk.num=i+1;
+
+        //Read the chunk length and type fields
+        if(fread(header,4,1,png_file)!=1){
+            report_error(ctx,STATS_ERR_TRUNCATED,"Error, can't read the chunk length field\n");
+            return -1;
+        }
+        new_chunk.length=read_be32(header);
+        if(fread(new_chunk.type,4,1,png_file)!=1){
+            report_error(ctx,STATS_ERR_TRUNCATED,"Error, can't read the chunk type field\n");
+            return -1;
+        }
+        if(!pngq_valid_chunk_type(new_chunk.type)){
+            report_error(ctx,STATS_ERR_CHUNK_TYPE,"Error, the chunk type field is not valid\n");
+            return -1;
+        }
+
+        ctx->stream.data_offset=seekable ? ftell(png_file) : -1;
+
+        //Read the chunk data field through the buffer updating the CRC, the data is kept only if it fits in the buffer
+        uint32_t crc=pngq_crc32_update(0xffffffffU,new_chunk.type,4);
+        for(unsigned int done=0;done<new_chunk.length;){
+            size_t piece=new_chunk.length-done < ctx->stream.limit ? new_chunk.length-done : ctx->stream.limit;
+            if(fread(ctx->stream.buffer,1,piece,png_file)!=piece){
+                report_error(ctx,STATS_ERR_TRUNCATED,"Error, can't read the chunk data field\n");
+                return -1;
+            }
+            STATS_TIMER(timer);
+            crc=pngq_crc32_update(crc,ctx->stream.buffer,piece);
+            STATS_PHASE(timer, STATS_CRC);
+            done+=piece;
+        }
+        new_chunk.data=new_chunk.length<=ctx->stream.limit ? ctx->stream.buffer : NULL;
+
+        //Reading the chunk CRC field
+        if(fread(header,4,1,png_file)!=1){
+            report_error(ctx,STATS_ERR_TRUNCATED,"Error, can't read the chunk CRC field\n");
+            return -1;
+        }
+        new_chunk.crc=read_be32(header);
+        if((crc ^ 0xffffffffU)!=new_chunk.crc){
+            report_error(ctx,STATS_ERR_CRC,"Error, the chunk CRC field is not correct\n");
+            return -1;
+        }
+
+        //Chunks larger than the buffer can only be printed if their data is not needed or can be read again
+        if(new_chunk.data==NULL){
+            if(memcmp(new_chunk.type,"IHDR",4)==0 || (ctx->pformat_output._K && is_text_chunk(new_chunk.type))){
+                sink_printf(ctx->out,"Error, the %.4s chunk is larger than the streaming memory limit\n",new_chunk.type);
+                STATS_ADD(errors[STATS_ERR_STREAM], 1);
+                return -1;
+            }
+            if(ctx->pformat_output._C && print_data && !seekable){
+                report_error(ctx,STATS_ERR_STREAM,"Error, the streaming mode needs a seekable file to print the data of chunks larger than the memory limit\n");
+                return -1;
+            }
+        }
+
+        if(!pformat->uses_N)
+            ctx->pformat_output._N+=1;
+        STATS_ADD(chunks, 1);
+        STATS_ADD(bytes, new_chunk.length+12);
+        print_chunk_info(ctx,&new_chunk,pformat,cformat,kformat,&flag);
+
+        memcpy(check_chunk_type,new_chunk.type,4);
+        i++;
+    }
+
+    return flag==-1 ? -2 : 0;
+}
+
+//Parse the memory limit of the option "--stream=SIZE", the size is in bytes and can be followed by the suffix K, M or G
+//Return 0 if the size is not valid
+size_t parse_stream_limit(const char* size){
+    char* end;
+    unsigned long long value=strtoull(size,&end,10);
+
+    switch(*end){
+        case 'K': case 'k': value<<=10; end++; break;
+        case 'M': case 'm': value<<=20; end++; break;
+        case 'G': case 'g': value<<=30; end++; break;
+        default: break;
+    }
+    if(end==size || *end!='\0' || value<STREAM_MIN_LIMIT)
+        return 0;
+    return (size_t)value;
+}
+
+/*
+    Validation cache (option "--cache")
+*/
+
+//The result of the validation of a PNG file is saved in a cache file, so that the next runs print the information
+//about the unchanged files without reading them. A file is identified by its device, inode, size and modification time.
+//Valid files keep their chunk table (type, length, CRC) and the data fields printed by pformat and kformat
+//(IHDR and the text chunks), invalid files keep the error message. The chunk data printed by "_D" isn't saved, so the
+//cache is only read when cformat doesn't contain "_D".
+//
+//The cache file is an open addressing hash table followed by the records, in the byte order of the machine:
+//it's mapped in memory once and a lookup only reads a few slots. The records of the files read during the run are
+//collected in memory and merged with the current cache file at the end of the run, under a lock on "FILE.lock";
+//the new cache file replaces the old one with a rename, so the runs reading it at the same time are not affected.
+
+#define CACHE_MAGIC "PNGQCACH"
+#define CACHE_VERSION 2
+#define CACHE_BYTE_ORDER 0x01020304
+#define CACHE_NO_DATA 0xFFFFFFFFu
+
+//Define the struct for the identity of a PNG file, a changed file gets a new size or modification time
+struct cache_key{
+    uint64_t dev;               // device
+    uint64_t ino;               // inode
+    uint64_t size;              // file size
+    uint64_t mtime_ns;          // modification time in nanoseconds
+};
+
+//Define the struct for the header of the cache file
+struct cache_header{
+    char magic[8];              // CACHE_MAGIC
+    uint32_t version;           // CACHE_VERSION
+    uint32_t byte_order;        // CACHE_BYTE_ORDER written in the byte order of the machine
+    uint64_t slot_count;        // number of slots of the hash table, a power of 2
+    uint64_t entry_count;       // number of files in the cache
+    uint64_t file_size;         // size of the cache file
+};
+
+//Define the struct for a slot of the hash table, it's empty if "length" is 0
+struct cache_slot{
+    struct cache_key key;       // identity of the file
+    uint64_t offset;            // offset of the record in the cache file
+    uint64_t length;            // length of the record
+};
+
+//Define the struct for the start of a record, followed by "count" chunks and the data fields (valid file)
+//or by the error message (invalid file)
+struct cache_record{
+    uint32_t status;            // 0 if the file is valid, 1 + the kind of the error (enum stats_error) otherwise
+    uint32_t count;             // number of chunks
+    uint32_t message_length;    // length of the error message
+    uint32_t data_length;       // length of the saved data fields
+};
+
+//Define the struct for a chunk of a record
+struct cache_chunk{
+    unsigned char type[4];      // chunk type field
+    uint32_t length;            // chunk length field
+    uint32_t crc;               // chunk CRC field
+    uint32_t data_offset;       // offset of the data field in the saved data fields, CACHE_NO_DATA if it isn't saved
+};
+
+//Define the struct for a record of a file read during the run, waiting to be saved
+struct cache_update{
+    struct cache_key key;       // identity of the file
+    unsigned char* record;      // record
+    size_t length;              // length of the record
+};
+
+//Define the struct for the validation cache
+struct validation_cache{
+    const char* path;           // name of the cache file
+    unsigned char* map;         // mapping of the cache file read at the start of the run, NULL if there is none
+    size_t map_size;            // size of the mapping
+    pthread_mutex_t lock;       // protects the updates, the files are read by several threads (option "-j")
+    struct cache_update* updates;   // records of the files read during the run
+    size_t update_count;        // number of records
+    size_t update_capacity;     // size of the array of records
+};
+
+//Build the identity of a file from its status
+void cache_key_from_stat(struct cache_key* key, const struct stat* st){
+    key->dev=(uint64_t)major(st->st_dev)<<32 | minor(st->st_dev);
+    key->ino=(uint64_t)st->st_ino;
+    key->size=(uint64_t)st->st_size;
+    key->mtime_ns=(uint64_t)st->st_mtim.tv_sec*1000000000u+(uint64_t)st->st_mtim.tv_nsec;
+}
+
+//Hash of the device and inode, the slot of a file doesn't depend on its size and modification time so that a changed file
+//replaces its old record
+static uint64_t cache_hash(const struct cache_key* key){
+    uint64_t h=key->dev*0x9E3779B97F4A7C15u ^ key->ino;
+    h^=h>>31;
+    h*=0xBF58476D1CE4E5B9u;
+    h^=h>>29;
+    return h;
+}
+
+//Check that a record of "length" bytes is consistent, so that a damaged cache file can't be read out of bounds
+static int cache_record_valid(const unsigned char* record, uint64_t length){
+    const struct cache_record* r=(const struct cache_record*)record;
+    if(length<sizeof(*r))
+        return 0;
+    if(r->status!=0)
+        return r->status<=STATS_ERRORS && sizeof(*r)+(uint64_t)r->message_length<=length;
+    uint64_t needed=sizeof(*r)+(uint64_t)r->count*sizeof(struct cache_chunk)+r->data_length;
+    if(needed>length)
+        return 0;
+    const struct cache_chunk* chunks=(const struct cache_chunk*)(record+sizeof(*r));
+    for(uint32_t i=0;i<r->count;i++){
+        if(chunks[i].data_offset!=CACHE_NO_DATA && (uint64_t)chunks[i].data_offset+chunks[i].length>r->data_length)
+            return 0;
+    }
+    return 1;
+}
+
+//Map the cache file "path", return its header or NULL if the file doesn't exist or isn't a valid cache file
+static const struct cache_header* cache_map(const char* path, unsigned char** map, size_t* map_size){
+    *map=NULL;
+    *map_size=0;
+    int fd=open(path,O_RDONLY|O_CLOEXEC);
+    if(fd<0)
+        return NULL;
+    struct stat st;
+    if(fstat(fd,&st)!=0 || !S_ISREG(st.st_mode) || (size_t)st.st_size<sizeof(struct cache_header)){
+        close(fd);
+        return NULL;
+    }
+    void* addr=mmap(NULL,(size_t)st.st_size,PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    if(addr==MAP_FAILED)
+        return NULL;
+
+    const struct cache_header* header=addr;
+    if(memcmp(header->magic,CACHE_MAGIC,8)!=0 || header->version!=CACHE_VERSION || header->byte_order!=CACHE_BYTE_ORDER ||
+       header->file_size!=(uint64_t)st.st_size || header->slot_count==0 || (header->slot_count & (header->slot_count-1))!=0 ||
+       header->slot_count>((uint64_t)st.st_size-sizeof(*header))/sizeof(struct cache_slot)){
+        munmap(addr,(size_t)st.st_size);
+        return NULL;
+    }
+    *map=addr;
+    *map_size=(size_t)st.st_size;
+    return header;
+}
+
+//Find the record of the file "key" in the mapped cache file, return NULL if there is none
+static const unsigned char* cache_find(const unsigned char* map, size_t map_size, const struct cache_key* key, size_t* length){
+    const struct cache_header* header=(const struct cache_header*)map;
+    const struct cache_slot* slots=(const struct cache_slot*)(map+sizeof(*header));
+    uint64_t mask=header->slot_count-1;
+
+    for(uint64_t n=0, i=cache_hash(key)&mask; n<=mask; n++, i=(i+1)&mask){
+        const struct cache_slot* slot=&slots[i];
+        if(slot->length==0)
+            return NULL;
+        if(slot->key.dev==key->dev && slot->key.ino==key->ino){
+            if(slot->key.size!=key->size || slot->key.mtime_ns!=key->mtime_ns)
+                return NULL;
+            if(slot->offset>map_size || slot->length>map_size-slot->offset || !cache_record_valid(map+slot->offset,slot->length))
+                return NULL;
+            *length=(size_t)slot->length;
+            return map+slot->offset;
+        }
+    }
+    return NULL;
+}
+
+//Open the validation cache "path", a missing cache file is created at the end of the run
+struct validation_cache* cache_open(const char* path){
+    struct validation_cache* cache=calloc(1,sizeof(struct validation_cache));
+    if(cache==NULL)
+        return NULL;
+    cache->path=path;
+    cache_map(path,&cache->map,&cache->map_size);
+    pthread_mutex_init(&cache->lock,NULL);
+    return cache;
+}
+
+//Find the record of the file "key" saved by a previous run, return NULL if the file isn't in the cache or has changed
+const unsigned char* cache_lookup(struct validation_cache* cache, const struct cache_key* key, size_t* length){
+    if(cache->map==NULL)
+        return NULL;
+    return cache_find(cache->map,cache->map_size,key,length);
+}
+
+//Add the record of a file read during the run, it's saved at the end of the run
+static void cache_add(struct validation_cache* cache, const struct cache_key* key, unsigned char* record, size_t length){
+    pthread_mutex_lock(&cache->lock);
+    if(cache->update_count==cache->update_capacity){
+        size_t capacity=cache->update_capacity ? 2*cache->update_capacity : 64;
+        struct cache_update* updates=realloc(cache->updates,capacity*sizeof(struct cache_update));
+        if(updates==NULL){
+            pthread_mutex_unlock(&cache->lock);
+            free(record);
+            return;
+        }
+        cache->updates=updates;
+        cache->update_capacity=capacity;
+    }
+    cache->updates[cache->update_count].key=*key;
+    cache->updates[cache->update_count].record=record;
+    cache->updates[cache->update_count].length=length;
+    cache->update_count++;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+//The data fields printed by pformat and kformat are saved, the other ones are only printed by "_D"
+static int cache_keeps_data(const unsigned char* type){
+    return memcmp(type,"IHDR",4)==0 || is_text_chunk(type);
+}
+
+//Save the chunk table of the valid file "key" read in the chunk index
+void cache_store_valid(struct validation_cache* cache, const struct cache_key* key, const struct chunk_index* index){
+    size_t data_length=0;
+    for(unsigned int i=0;i<index->count;i++){
+        if(cache_keeps_data(index->types[i]))
+            data_length+=index->lengths[i];
+    }
+    if(data_length>=CACHE_NO_DATA)
+        return;
+
+    size_t length=sizeof(struct cache_record)+index->count*sizeof(struct cache_chunk)+data_length;
+    unsigned char* record=malloc(length);
+    if(record==NULL)
+        return;
+    struct cache_record* r=(struct cache_record*)record;
+    struct cache_chunk* chunks=(struct cache_chunk*)(record+sizeof(*r));
+    unsigned char* data=record+sizeof(*r)+index->count*sizeof(struct cache_chunk);
+    r->status=0;
+    r->count=index->count;
+    r->message_length=0;
+    r->data_length=(uint32_t)data_length;
+
+    size_t offset=0;
+    for(unsigned int i=0;i<index->count;i++){
+        memcpy(chunks[i].type,index->types[i],4);
+        chunks[i].length=index->lengths[i];
+        chunks[i].crc=index->crcs[i];
+        chunks[i].data_offset=CACHE_NO_DATA;
+        if(cache_keeps_data(index->types[i])){
+            memcpy(data+offset,index->base+index->offsets[i],index->lengths[i]);
+            chunks[i].data_offset=(uint32_t)offset;
+            offset+=index->lengths[i];
+        }
+    }
+    cache_add(cache,key,record,length);
+}
+
+//Save the error message of kind "kind" printed for the invalid file "key"
+void cache_store_failed(struct validation_cache* cache, const struct cache_key* key, enum stats_error kind, const char* message, size_t message_length){
+    //Running out of memory doesn't depend on the file
+    if(kind==STATS_ERR_MEMORY)
+        return;
+    size_t length=sizeof(struct cache_record)+message_length;
+    unsigned char* record=malloc(length);
+    if(record==NULL)
+        return;
+    struct cache_record* r=(struct cache_record*)record;
+    r->status=1+(uint32_t)kind;
+    r->count=0;
+    r->message_length=(uint32_t)message_length;
+    r->data_length=0;
+    memcpy(record+sizeof(*r),message,message_length);
+    cache_add(cache,key,record,length);
+}
+
+//Print the information about the PNG file "file_name" saved in the cache record, like "process_png_file" does
+void cache_replay(struct png_context* ctx, const unsigned char* record, const char* file_name, enum output_mode mode,const struct format_program* pformat,const struct format_program* cformat,const struct format_program* kformat){
+    const struct cache_record* r=(const struct cache_record*)record;
+    if(r->status!=0){
+        STATS_ERROR(r->status-1);
+        if(mode!=OUTPUT_TEXT){
+            print_record(ctx,mode,RECORD_READ_ERROR,(const char*)record+sizeof(*r),r->message_length);
+            return;
+        }
+        sink_write(ctx->out,record+sizeof(*r),r->message_length);
+        sink_printf(ctx->out,"Error, can't read the PNG file %s\n",file_name);
+        return;
+    }
+
+    const struct cache_chunk* chunks=(const struct cache_chunk*)(record+sizeof(*r));
+    ctx->index.base=record+sizeof(*r)+(size_t)r->count*sizeof(struct cache_chunk);
+    for(uint32_t i=0;i<r->count;i++){
+        //The data fields that aren't saved are never printed, they reference the start of the saved ones
+        size_t offset=chunks[i].data_offset==CACHE_NO_DATA ? 0 : chunks[i].data_offset;
+        if(index_add(&ctx->index,chunks[i].type,chunks[i].length,offset,chunks[i].crc)!=0){
+            static const char message[]="Error, can't allocate memory for the array of chunks\n";
+            if(mode!=OUTPUT_TEXT){
+                STATS_ERROR(STATS_ERR_MEMORY);
+                print_record(ctx,mode,RECORD_READ_ERROR,message,sizeof(message)-1);
+            }else{
+                report_error(ctx,STATS_ERR_MEMORY,message);
+                sink_printf(ctx->out,"Error, can't read the PNG file %s\n",file_name);
+            }
+            dealloc_mem(ctx,NULL);
+            return;
+        }
+    }
+    ctx->pformat_output._N=r->count;
+    print_file(ctx,mode,pformat,cformat,kformat);
+    dealloc_mem(ctx,NULL);
+}
+
+//Insert the record "key" in the hash table of a new cache file, unless a record of the same file is already there
+//Return the slot of the record, -1 if it isn't inserted
+static int64_t cache_insert(struct cache_slot* slots, uint64_t mask, const struct cache_key* key, uint64_t length){
+    for(uint64_t i=cache_hash(key)&mask;;i=(i+1)&mask){
+        if(slots[i].length==0){
+            slots[i].key=*key;
+            slots[i].length=length;
+            return (int64_t)i;
+        }
+        if(slots[i].key.dev==key->dev && slots[i].key.ino==key->ino)
+            return -1;
+    }
+}
+
+//Merge the records of the files read during the run with the current cache file and replace it, return 0 on success
+int cache_save(struct validation_cache* cache){
+    if(cache->update_count==0)
+        return 0;
+
+    //The cache file can be updated by another run at the same time: it's read again under the lock
+    size_t lock_length=strlen(cache->path)+16;
+    char* lock_path=malloc(lock_length);
+    char* tmp_path=malloc(lock_length+16);
+    if(lock_path==NULL || tmp_path==NULL){
+        free(lock_path);
+        free(tmp_path);
+        return -1;
+    }
+    snprintf(lock_path,lock_length,"%s.lock",cache->path);
+    snprintf(tmp_path,lock_length+16,"%s.tmp.XXXXXX",cache->path);
+    int lock_fd=open(lock_path,O_RDWR|O_CREAT|O_CLOEXEC,0644);
+    free(lock_path);
+    if(lock_fd<0 || flock(lock_fd,LOCK_EX)!=0){
+        if(lock_fd>=0)
+            close(lock_fd);
+        free(tmp_path);
+        return -1;
+    }
+
+    unsigned char* old=NULL;
+    size_t old_size=0;
+    const struct cache_header* old_header=cache_map(cache->path,&old,&old_size);
+    uint64_t old_count=old_header!=NULL ? old_header->entry_count : 0;
+
+    //Hash table at most half full
+    uint64_t slot_count=16;
+    while(slot_count<2*(cache->update_count+old_count))
+        slot_count*=2;
+    struct cache_slot* slots=calloc(slot_count,sizeof(struct cache_slot));
+    const unsigned char** records=calloc(slot_count,sizeof(unsigned char*));
+    int result=-1;
+    if(slots==NULL || records==NULL)
+        goto done;
+
+    //The records of this run replace the old ones, the last record of a file read several times is kept
+    uint64_t entries=0;
+    for(size_t u=cache->update_count;u-->0;){
+        struct cache_update* update=&cache->updates[u];
+        int64_t i=cache_insert(slots,slot_count-1,&update->key,update->length);
+        if(i>=0){
+            records[i]=update->record;
+            entries++;
+        }
+    }
+    if(old_header!=NULL){
+        const struct cache_slot* old_slots=(const struct cache_slot*)(old+sizeof(*old_header));
+        for(uint64_t s=0;s<old_header->slot_count;s++){
+            const struct cache_slot* slot=&old_slots[s];
+            if(slot->length==0 || slot->offset>old_size || slot->length>old_size-slot->offset || !cache_record_valid(old+slot->offset,slot->length))
+                continue;
+            int64_t i=cache_insert(slots,slot_count-1,&slot->key,slot->length);
+            if(i>=0){
+                records[i]=old+slot->offset;
+                entries++;
+            }
+        }
+    }
+
+    //Layout of the new cache file: header, hash table, records aligned to 8 bytes
+    uint64_t size=sizeof(struct cache_header)+slot_count*sizeof(struct cache_slot);
+    for(uint64_t i=0;i<slot_count;i++){
+        if(slots[i].length==0)
+            continue;
+        slots[i].offset=size;
+        size+=(slots[i].length+7)&~(uint64_t)7;
+    }
+    struct cache_header header;
+    memset(&header,0,sizeof(header));
+    memcpy(header.magic,CACHE_MAGIC,8);
+    header.version=CACHE_VERSION;
+    header.byte_order=CACHE_BYTE_ORDER;
+    header.slot_count=slot_count;
+    header.entry_count=entries;
+    header.file_size=size;
+
+    //The temporary file is created exclusively with a name of its own, an existing file or symbolic link is never followed
+    int fd=mkstemp(tmp_path);
+    if(fd>=0 && (fcntl(fd,F_SETFD,FD_CLOEXEC)!=0 || fchmod(fd,0644)!=0)){
+        close(fd);
+        unlink(tmp_path);
+        fd=-1;
+    }
+    FILE* file=fd>=0 ? fdopen(fd,"wb") : NULL;
+    if(file==NULL){
+        if(fd>=0){
+            close(fd);
+            unlink(tmp_path);
+        }
+        goto done;
+    }
+    static const unsigned char padding[8];
+    int written=fwrite(&header,sizeof(header),1,file)==1 && fwrite(slots,sizeof(struct cache_slot),slot_count,file)==slot_count;
+    for(uint64_t i=0;written && i<slot_count;i++){
+        if(slots[i].length==0)
+            continue;
+        size_t pad=((slots[i].length+7)&~(uint64_t)7)-slots[i].length;
+        written=fwrite(records[i],1,slots[i].length,file)==slots[i].length && fwrite(padding,1,pad,file)==pad;
+    }
+    //The new cache file is complete on the disk before it replaces the old one
+    written=written && fflush(file)==0 && fsync(fd)==0;
+    if(fclose(file)!=0 || !written || rename(tmp_path,cache->path)!=0){
+        unlink(tmp_path);
+        goto done;
+    }
+    result=0;
+
+done:
+    if(old!=NULL)
+        munmap(old,old_size);
+    free(slots);
+    free(records);
+    free(tmp_path);
+    flock(lock_fd,LOCK_UN);
+    close(lock_fd);
+    return result;
+}
+
+//Release the validation cache
+void cache_free(struct validation_cache* cache){
+    if(cache==NULL)
+        return;
+    for(size_t u=0;u<cache->update_count;u++)
+        free(cache->updates[u].record);
+    free(cache->updates);
+    if(cache->map!=NULL)
+        munmap(cache->map,cache->map_size);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+/*
+    Chunk offset index (option "--index")
+    The PNG file is read in two passes. The first one builds the chunk index from the chunk headers only (type, length, CRC
+    and offset of each data field), reading them with pread and skipping the data fields; the index is saved next to the file
+    in the sidecar file FILE.pngqi, which the next runs use as long as the file is unchanged (same device, inode, size and
+    modification time), so they don't read the chunk headers again. The second pass reads with pread only the data fields
+    that are printed: the IHDR chunk, and the chunks selected (option "--chunks") when cformat prints "_D" or when kformat
+    prints the fields of their text chunk. A query on a multi-GB file reads the bytes it prints.
+    Like "--trust-crc", only the CRC of the IHDR chunk is checked.
+*/
+
+#define INDEX_MAGIC "PNGQINDX"
+#define INDEX_VERSION 1
+#define INDEX_SUFFIX ".pngqi"
+
+//Define the struct for the header of a sidecar index file, followed by "count" entries
+struct index_file_header{
+    char magic[8];              // INDEX_MAGIC
+    uint32_t version;           // INDEX_VERSION
+    uint32_t byte_order;        // CACHE_BYTE_ORDER written in the byte order of the machine
+    struct cache_key key;       // identity of the PNG file indexed
+    uint64_t count;             // number of chunks
+};
+
+//Define the struct for a chunk of a sidecar index file
+struct index_file_entry{
+    unsigned char type[4];      // chunk type field
+    uint32_t length;            // chunk length field
+    uint64_t offset;            // file offset of the data field
+    uint32_t crc;               // chunk CRC field
+    uint32_t reserved;          // 0
+};
+
+//Load the chunk index of the PNG file whose identity is "key" from the sidecar index file "path"
+//The offsets of the index are file offsets; return 0 on success, -1 if the sidecar is missing, stale or not valid
+static int index_load(struct png_context* ctx, const char* path, const struct cache_key* key){
+    int fd=open(path,O_RDONLY|O_CLOEXEC);
+    if(fd<0)
+        return -1;
+    struct stat st;
+    void* map=MAP_FAILED;
+    if(fstat(fd,&st)==0 && (size_t)st.st_size>=sizeof(struct index_file_header))
+        map=mmap(NULL,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if(map==MAP_FAILED)
+        return -1;
+
+    int result=-1;
+    const struct index_file_header* header=map;
+    const struct index_file_entry* entries=(const struct index_file_entry*)(header+1);
+    if(memcmp(header->magic,INDEX_MAGIC,8)!=0 || header->version!=INDEX_VERSION || header->byte_order!=CACHE_BYTE_ORDER ||
+       memcmp(&header->key,key,sizeof(*key))!=0 || header->count>UINT32_MAX ||
+       header->count!=((size_t)st.st_size-sizeof(*header))/sizeof(*entries) || ((size_t)st.st_size-sizeof(*header))%sizeof(*entries)!=0)
+        goto done;
+
+    for(uint64_t i=0;i<header->count;i++){
+        const struct index_file_entry* e=&entries[i];
+        if(!pngq_valid_chunk_type(e->type) || e->offset>key->size || e->length>key->size-e->offset ||
+           index_add(&ctx->index,e->type,e->length,(size_t)e->offset,e->crc)!=0){
+            ctx->index.count=0;
+            goto done;
+        }
+    }
+    result=0;
+
+done:
+    munmap(map,(size_t)st.st_size);
+    return result;
+}
+
+//Save the chunk index of the PNG file whose identity is "key", whose offsets are file offsets, in the sidecar index file "path"
+//The sidecar is replaced atomically, it's not saved if the directory is read-only
+static void index_save(const struct chunk_index* index, const char* path, const struct cache_key* key){
+    size_t length=strlen(path)+32;
+    char* tmp_path=malloc(length);
+    if(tmp_path==NULL)
+        return;
+    //The temporary file is created exclusively with a name of its own: the sidecars are written next to the PNG files,
+    //maybe in shared directories, and the workers of the option "-j" may index the same file
+    snprintf(tmp_path,length,"%s.tmp.XXXXXX",path);
+    int fd=mkstemp(tmp_path);
+    if(fd>=0 && (fcntl(fd,F_SETFD,FD_CLOEXEC)!=0 || fchmod(fd,0644)!=0)){
+        close(fd);
+        unlink(tmp_path);
+        fd=-1;
+    }
+    FILE* file=fd>=0 ? fdopen(fd,"wb") : NULL;
+    if(file==NULL){
+        if(fd>=0){
+            close(fd);
+            unlink(tmp_path);
+        }
+        free(tmp_path);
+        return;
+    }
+
+    struct index_file_header header;
+    memset(&header,0,sizeof(header));
+    memcpy(header.magic,INDEX_MAGIC,8);
+    header.version=INDEX_VERSION;
+    header.byte_order=CACHE_BYTE_ORDER;
+    header.key=*key;
+    header.count=index->count;
+    int written=fwrite(&header,sizeof(header),1,file)==1;
+    for(unsigned int i=0;written && i<index->count;i++){
+        struct index_file_entry e;
+        memcpy(e.type,index->types[i],4);
+        e.length=index->lengths[i];
+        e.offset=index->offsets[i];
+        e.crc=index->crcs[i];
+        e.reserved=0;
+        written=fwrite(&e,sizeof(e),1,file)==1;
+    }
+    if(fclose(file)!=0 || !written || rename(tmp_path,path)!=0)
+        unlink(tmp_path);
+    free(tmp_path);
+}
+
+//Build the chunk index of the PNG file from its chunk headers, read with pread up to the IEND chunk
+//The offsets of the index are file offsets; return 0 on success, -1 after printing the error otherwise
+static int index_scan(struct png_context* ctx, int fd, off_t file_size){
+    const unsigned char png_signature[8] = {0x89,0x50,0x4E,0x47,0x0D,0x0A,0x1A,0x0A}; // PNG signature
+    unsigned char buf[12]; // CRC field of a chunk followed by the length and type fields of the next one
+
+    STATS_TIMER(timer);
+    if(pread(fd,buf,8,0)!=8){
+        report_error(ctx,STATS_ERR_SIGNATURE,"Error, can't read the PNG signature\n");
+        return -1;
+    }
+    if(memcmp(png_signature,buf,8)!=0){
+        report_error(ctx,STATS_ERR_SIGNATURE,"Error, the file is not a valid PNG file\n");
+        return -1;
+    }
+    STATS_PHASE(timer, STATS_SIGNATURE);
+
+    off_t offset=8; // file offset of the current chunk
+    ssize_t n=pread(fd,buf+4,8,offset); // the chunk header is always kept at buf[4..11]
+    for(;;){
+        if(n<4){
+            report_error(ctx,STATS_ERR_TRUNCATED,"Error, can't read the chunk length field\n");
+            return -1;
+        }
+        if(n<8){
+            report_error(ctx,STATS_ERR_TRUNCATED,"Error, can't read the chunk type field\n");
+            return -1;
+        }
+        unsigned int length=read_be32(buf+4);
+        unsigned char type[4];
+        memcpy(type,buf+8,4);
+        if(!pngq_valid_chunk_type(type)){
+            report_error(ctx,STATS_ERR_CHUNK_TYPE,"Error, the chunk type field is not valid\n");
+            return -1;
+        }
+        off_t data_offset=offset+8;
+        if(data_offset+(off_t)length>file_size){
+            report_error(ctx,STATS_ERR_TRUNCATED,"Error, can't read the chunk data field\n");
+            return -1;
+        }
+
+        //Read the CRC field together with the header of the next chunk
+        n=pread(fd,buf,12,data_offset+length);
+        if(n<4){
+            report_error(ctx,STATS_ERR_TRUNCATED,"Error, can't read the chunk CRC field\n");
+            return -1;
+        }
+        n-=4;
+        if(index_add(&ctx->index,type,length,(size_t)data_offset,read_be32(buf))!=0){
+            report_error(ctx,STATS_ERR_MEMORY,"Error, can't allocate memory for the array of chunks\n");
+            return -1;
+        }
+        if(memcmp(type,"IEND",4)==0)
+            return 0;
+        offset=data_offset+length+4;
+    }
+}
+
+//Read the PNG file through its chunk offset index (option "--index"), the sidecar index file of "file_name" is used or saved
+//Only the data fields printed by the formats are read, only the CRC of the IHDR chunk is checked
+//Return 0 if the PNG file is valid, -1 if it's not and -2 if the file is not seekable (it must be read with "readPNGfile")
+int readPNGindexed(struct png_context* ctx, FILE* png_file, const char* file_name,const struct format_program* pformat,const struct format_program* cformat,const struct format_program* kformat){
+    int fd=fileno(png_file);
+    struct stat st;
+    if(fstat(fd,&st)!=0 || !S_ISREG(st.st_mode))
+        return -2;
+    struct cache_key key;
+    cache_key_from_stat(&key,&st);
+
+    //First pass: the chunk index, from the sidecar if it's up to date
+    size_t path_length=strlen(file_name)+sizeof(INDEX_SUFFIX);
+    char* sidecar=malloc(path_length);
+    if(sidecar==NULL){
+        report_error(ctx,STATS_ERR_MEMORY,"Error, can't allocate memory for the array of chunks\n");
+        return dealloc_mem(ctx,png_file);
+    }
+    snprintf(sidecar,path_length,"%s%s",file_name,INDEX_SUFFIX);
+    STATS_TIMER(timer);
+    if(index_load(ctx,sidecar,&key)!=0){
+        if(index_scan(ctx,fd,st.st_size)!=0){
+            free(sidecar);
+            return dealloc_mem(ctx,png_file);
+        }
+        index_save(&ctx->index,sidecar,&key);
+    }
+    free(sidecar);
+    STATS_PHASE(timer, STATS_READ);
+
+    //Second pass: the data fields printed, the other ones are left empty
+    int need_all_data=pformat->set_C && cformat->uses_D;
+    int need_text=pformat->set_K && kformat->uses_text;
+    struct chunk_index* index=&ctx->index;
+    for(unsigned int i=0;i<index->count;i++){
+        size_t offset=index->offsets[i];
+        int is_ihdr=memcmp(index->types[i],"IHDR",4)==0;
+        index->offsets[i]=0;
+        if(!is_ihdr && !((need_all_data || (need_text && is_text_chunk(index->types[i]))) && chunk_selected(ctx->select,i+1,index->types[i])))
+            continue;
+
+        long long data=arena_alloc(&ctx->arena,index->lengths[i],0);
+        if(data<0){
+            report_error(ctx,STATS_ERR_MEMORY,"Error, can't allocate memory for the chunk data field\n");
+            return dealloc_mem(ctx,png_file);
+        }
+        index->offsets[i]=(size_t)data;
+        if(pread(fd,ctx->arena.buf+data,index->lengths[i],(off_t)offset)!=(ssize_t)index->lengths[i]){
+            report_error(ctx,STATS_ERR_TRUNCATED,"Error, can't read the chunk data field\n");
+            return dealloc_mem(ctx,png_file);
+        }
+        STATS_ADD(bytes, index->lengths[i]);
+        if(is_ihdr){
+            struct chunk ch=index_chunk(index,i);
+            ch.data=ctx->arena.buf+data;
+            if(PNG_crc_check(ch,4)!=ch.crc){
+                report_error(ctx,STATS_ERR_CRC,"Error, the chunk CRC field is not correct\n");
+                return dealloc_mem(ctx,png_file);
+            }
+        }
+    }
+    index->base=ctx->arena.buf;
+    ctx->pformat_output._N=index->count;
+    STATS_ADD(chunks, index->count);
+    return 0;
+}
+
+/*
+    Recovery scanner (option "--recover")
+    When a PNG file can't be read, its content is scanned again from the start to find the chunks that can be salvaged:
+    the chunks are followed one after the other while their structure and CRC are correct, and after a damaged chunk the
+    scanner looks ahead for the next plausible chunk header: a length field not larger than the rest of the file followed
+    by a type field of four letters or digits, whose CRC field matches and which is followed by another type field (or the
+    end of the file). The type fields are searched 61 positions at a time: the letters and digits of 64 bytes are classified
+    at once (SSE2 compares, or a table elsewhere) in a bit mask, whose runs of four bits are the candidates.
+    The report lists the ranges of the file: the signature, the runs of valid chunks and the damaged ranges with the reason
+    of the damage, so the valid data can be cut out of a damaged upload.
+*/
+
+//Largest chunk length accepted when resynchronizing: a false candidate costs a CRC over its length, the chunks followed
+//one after the other from a valid chunk can be as long as the PNG specification allows
+#define RECOVER_MAX_LENGTH (64*1024*1024)
+#define RECOVER_MAX_CHUNK 0x7fffffffu
+
+//Bit mask of the bytes of p[0..63] that are letters or digits, bit i for p[i]
+static uint64_t recover_alnum_mask(const unsigned char* p){
+#if defined(__SSE2__)
+    uint64_t mask=0;
+    for(int k=0;k<4;k++){
+        __m128i c=_mm_loadu_si128((const __m128i*)(p+16*k));
+        //Unsigned range checks done with signed compares: (c - low) + 0x80 < count + 0x80 - 256
+        __m128i letter=_mm_add_epi8(_mm_sub_epi8(_mm_or_si128(c,_mm_set1_epi8(0x20)),_mm_set1_epi8('a')),_mm_set1_epi8((char)0x80));
+        __m128i digit=_mm_add_epi8(_mm_sub_epi8(c,_mm_set1_epi8('0')),_mm_set1_epi8((char)0x80));
+        __m128i is_letter=_mm_cmplt_epi8(letter,_mm_set1_epi8((char)(0x80+26)));
+        __m128i is_digit=_mm_cmplt_epi8(digit,_mm_set1_epi8((char)(0x80+10)));
+        mask|=(uint64_t)(uint16_t)_mm_movemask_epi8(_mm_or_si128(is_letter,is_digit))<<(16*k);
+    }
+    return mask;
+#else
+    static unsigned char alnum[256];
+    static int built=0;
+    if(!__atomic_load_n(&built,__ATOMIC_ACQUIRE)){
+        for(int c=0;c<256;c++)
+            alnum[c]=(c>='A' && c<='Z') || (c>='a' && c<='z') || (c>='0' && c<='9');
+        __atomic_store_n(&built,1,__ATOMIC_RELEASE);
+    }
+    uint64_t mask=0;
+    for(int i=0;i<64;i++)
+        mask|=(uint64_t)alnum[p[i]]<<i;
+    return mask;
+#endif
+}
+
+//Check the chunk at buf[pos..]: return NULL if it's complete with a correct CRC, the reason of the damage otherwise
+static const char* recover_check_chunk(const unsigned char* buf, size_t size, size_t pos, uint32_t max_length){
+    if(size-pos<12)
+        return "the chunk is truncated";
+    uint32_t length=read_be32(buf+pos);
+    if(length>max_length)
+        return "the chunk length field is not valid";
+    if(!pngq_valid_chunk_type(buf+pos+4))
+        return "the chunk type field is not valid";
+    if(length>size-pos-12)
+        return "the chunk is truncated";
+    if((pngq_crc32_update(0xffffffffu,buf+pos+4,(size_t)length+4)^0xffffffffu)!=read_be32(buf+pos+8+length))
+        return "the chunk CRC field is not correct";
+    return NULL;
+}
+
+//Check if the type field found at buf[t..t+3] starts a plausible chunk, confirmed by its CRC
+static int recover_candidate(const unsigned char* buf, size_t size, size_t t){
+    size_t pos=t-4;
+    if(size-pos<12)
+        return 0;
+    uint32_t length=read_be32(buf+pos);
+    if(length>RECOVER_MAX_LENGTH || length>size-pos-12)
+        return 0;
+    //The next chunk must start with a type field too (unless the file ends there), it's cheaper than the CRC
+    size_t next=pos+12+length;
+    if(next+8<=size && !pngq_valid_chunk_type(buf+next+4))
+        return 0;
+    return recover_check_chunk(buf,size,pos,RECOVER_MAX_LENGTH)==NULL;
+}
+
+//Find the first plausible chunk header at or after buf[from], return its offset or "size" if there is none
+static size_t recover_resync(const unsigned char* buf, size_t size, size_t from){
+    size_t t=from+4; // offset of the type field of the candidate
+    for(; t+64<=size; t+=61){
+        uint64_t m=recover_alnum_mask(buf+t);
+        //Bit i is set when the four bytes from buf[t+i] are letters or digits, only the first 61 positions are complete
+        uint64_t runs=m & m>>1 & m>>2 & m>>3 & 0x1fffffffffffffffu;
+        while(runs!=0){
+            size_t candidate=t+(size_t)__builtin_ctzll(runs);
+            if(recover_candidate(buf,size,candidate))
+                return candidate-4;
+            runs&=runs-1;
+        }
+    }
+    for(; t+8<=size; t++){
+        if(pngq_valid_chunk_type(buf+t) && recover_candidate(buf,size,t))
+            return t-4;
+    }
+    return size;
+}
+
+//Print a valid range of chunks found by the recovery scanner
+static void recover_print_run(struct png_context* ctx, size_t start, size_t end, unsigned int first, unsigned int last, const unsigned char* first_type, const unsigned char* last_type){
+    sink_printf(ctx->out,"\t%zu-%zu: chunks %u-%u (%.4s to %.4s)\n",start,end-1,first,last,(const char*)first_type,(const char*)last_type);
+}
+
+//Scan the PNG file "file_name" that can't be read and print the ranges of chunks that can be salvaged and the damaged ones
+void recover_file(struct png_context* ctx, const char* file_name){
+    static const unsigned char png_signature[8] = {0x89,0x50,0x4E,0x47,0x0D,0x0A,0x1A,0x0A}; // PNG signature
+    int fd=open(file_name,O_RDONLY|O_CLOEXEC);
+    struct stat st;
+    if(fd<0 || fstat(fd,&st)!=0 || !S_ISREG(st.st_mode)){
+        sink_printf(ctx->out,"Error, the PNG file %s can't be recovered, it's not a regular file\n",file_name);
+        if(fd>=0)
+            close(fd);
+        return;
+    }
+    size_t size=(size_t)st.st_size;
+    unsigned char* buf = size>0 ? mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0) : NULL;
+    close(fd);
+    if(buf==MAP_FAILED){
+        sink_printf(ctx->out,"Error, the PNG file %s can't be recovered, it can't be mapped in memory\n",file_name);
+        return;
+    }
+    madvise(buf,size,MADV_SEQUENTIAL);
+    STATS_TIMER(timer);
+
+    //The report is printed after the summary, which is known at the end of the scan
+    struct out_sink* out=ctx->out;
+    struct out_sink ranges;
+    if(sink_init(&ranges,-1)!=0){
+        sink_printf(out,"Error, can't allocate memory for the recovery of the PNG file %s\n",file_name);
+        if(buf!=NULL)
+            munmap(buf,size);
+        return;
+    }
+    ctx->out=&ranges;
+
+    unsigned int chunks=0, damaged_ranges=0;
+    size_t damaged=0;
+    size_t pos=0;
+    if(size>=8 && memcmp(buf,png_signature,8)==0){
+        sink_puts(&ranges,"\t0-7: signature\n");
+        pos=8;
+    }
+    //Chunks of the current valid run, "run_chunks" is 0 outside of a run
+    size_t run_start=pos;
+    unsigned int run_chunks=0;
+    unsigned char first_type[4], last_type[4];
+    int ended=0; // boolean value, the IEND chunk has been found
+
+    while(pos<size && !ended){
+        const char* reason = pos==0 ? "the file doesn't start with the PNG signature" : recover_check_chunk(buf,size,pos,RECOVER_MAX_CHUNK);
+        if(reason==NULL){
+            if(run_chunks==0){
+                run_start=pos;
+                memcpy(first_type,buf+pos+4,4);
+            }
+            memcpy(last_type,buf+pos+4,4);
+            run_chunks++;
+            chunks++;
+            ended=memcmp(last_type,"IEND",4)==0;
+            pos+=(size_t)read_be32(buf+pos)+12;
+            continue;
+        }
+
+        //Damaged range up to the next plausible chunk header
+        if(run_chunks>0)
+            recover_print_run(ctx,run_start,pos,chunks-run_chunks+1,chunks,first_type,last_type);
+        run_chunks=0;
+        size_t next=recover_resync(buf,size,pos+1);
+        sink_printf(&ranges,"\t%zu-%zu: damaged, %zu bytes, %s\n",pos,next-1,next-pos,reason);
+        damaged+=next-pos;
+        damaged_ranges++;
+        pos=next;
+    }
+    if(run_chunks>0)
+        recover_print_run(ctx,run_start,pos,chunks-run_chunks+1,chunks,first_type,last_type);
+    if(ended && pos<size){
+        sink_printf(&ranges,"\t%zu-%zu: %zu bytes after the IEND chunk\n",pos,size-1,size-pos);
+        damaged+=size-pos;
+        damaged_ranges++;
+    }
+
+    ctx->out=out;
+    sink_printf(out,"Recovery of %s: %zu bytes, %u chunks salvageable, %u damaged ranges (%zu bytes)%s\n",file_name,size,chunks,damaged_ranges,damaged,ended ? "" : ", no IEND chunk");
+    sink_write(out,ranges.buf,ranges.used);
+    free(ranges.buf);
+    if(buf!=NULL)
+        munmap(buf,size);
+    STATS_PHASE(timer, STATS_CRC);
+}
+
+//Define the struct for the options given on the command line before a PNG file name (or a list of PNG file names)
+struct read_settings{
+    const struct format_program* pformat;   // pformat used for the file
+    const struct format_program* cformat;   // cformat used for the file
+    const struct format_program* kformat;   // kformat used for the file
+    int use_mmap;               // map the file in memory (option "--no-mmap")
+    int trust_crc;              // read only the data printed by the formats, without checking the CRC (option "--trust-crc")
+    int use_index;              // read the files through a sidecar chunk offset index (option "--index")
+    int recover;                // scan the files that can't be read for the chunks that can be salvaged (option "--recover")
+    int rewrite;                // write the files again instead of printing them (option "--rewrite")
+    const char* rewrite_dir;    // directory of the files written, NULL to replace them (option "--rewrite=DIR")
+    struct rewrite_targets* rewrite_targets; // files written in the directories of the option "--rewrite=DIR" during the run
+    const struct chunk_selector* strip;     // chunks not written (option "--strip"), NULL for none
+    int fix_crc;                // write the correct CRC fields instead of the wrong ones (option "--fix-crc")
+    const struct chunk_selector* select;    // chunks printed with cformat and kformat (option "--chunks"), NULL for all
+    size_t stream_limit;        // memory limit of the streaming mode (option "--stream"), 0 if disabled
+    unsigned int crc_threads;   // number of threads checking the CRC of the chunks (option "--crc-threads")
+    struct validation_cache* cache; // validation cache (option "--cache"), NULL if disabled
+    enum output_mode output;    // output mode (option "--output")
+    int deep;                   // decode the image data and check it (option "--deep")
+};
+
+//Define the kinds of entries of the command line and of jobs
+enum job_kind{
+    JOB_FILE,                   // PNG file
+    JOB_DASHES,                 // "--" parameter given after PNG file names
+    JOB_LIST,                   // list of PNG file names (option "-@"), as a job it's a list that can't be opened
+    JOB_DIR                     // directory tree (option "-r"), as a job it's a directory that can't be opened
+};
+
+//Define the struct for the patterns selecting the files of a directory tree (options "--include" and "--exclude")
+struct walk_filter{
+    char** include;             // patterns of the files to read, all the files if there are none
+    size_t include_count;
+    char** exclude;             // patterns of the files and directories to skip
+    size_t exclude_count;
+};
+
+//Define the struct for an entry of the command line: a PNG file name, a list of PNG file names, a directory tree or a misplaced "--"
+struct cmd_entry{
+    enum job_kind kind;             // kind of entry
+    char* name;                     // PNG file name, file name of the list ("-" for the standard input) or directory
+    char separator;                 // separator of the file names of the list, '\n' or '\0' (option "-0")
+    struct walk_filter filter;      // patterns of the directory tree
+    struct read_settings settings;  // options in force for the entry
+};
+
+//Define the struct for a PNG file to process
+struct png_job{
+    enum job_kind kind;         // kind of job
+    char* file_name;            // PNG file name
+    int owns_name;              // boolean value, the file name has been allocated for the job (it comes from a list)
+    const struct read_settings* settings;   // options used for the file
+    int opened;                 // boolean value, the file has been opened
+    int done;                   // boolean value, the file has been processed by a worker thread
+    char* output;               // information printed by a worker thread, waiting to be printed in order
+    size_t output_size;         // size of the buffered output
+    int loaded;                 // 1 if the file has been read in "data" by the io_uring backend, -1 if it can't be opened, 0 otherwise
+    unsigned char* data;        // content of the file read by the io_uring backend, handed over to the context that parses it
+    size_t data_size;           // size of the file read by the io_uring backend
+    int has_key;                // boolean value, "key" has been filled by the io_uring backend
+    struct cache_key key;       // identity of the file for the validation cache
+};
+
+/*
+    Directory walker (option "-r")
+    The directory trees are walked by a few threads while the files already found are processed. Each thread keeps the
+    directories it has found in its own deque and takes the last one (depth first, the entries are still in the cache), a
+    thread without directories steals the first one of another thread (the largest subtree left). The directories are read
+    with getdents64 in large batches and the files are opened relative to their directory (openat), a cheap pread of the first
+    8 bytes compares them to the PNG signature so the files that aren't PNG files are skipped without being read.
+    The names found are handed over to the processing through a bounded queue, so the memory doesn't depend on the size of
+    the trees; their order depends on the scheduling of the threads.
+*/
+
+//Number of threads walking a tree, size of the queue of file names found and size of the getdents64 buffer
+#define WALK_THREADS 4
+#define WALK_QUEUE_SIZE 1024
+#define WALK_DIRENT_BUFFER (64*1024)
+
+//Entry returned by getdents64, dirent.h only declares the function with _GNU_SOURCE
+struct walk_dirent{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+//Define the struct for the directories found by a walker thread
+struct walk_deque{
+    pthread_mutex_t lock;
+    char** dirs;                // paths of the directories, the owner takes the last one and the thieves the first one
+    size_t head;                // first directory
+    size_t tail;                // end of the directories
+    size_t capacity;            // size of "dirs"
+};
+
+//Define the struct for the arguments of a walker thread
+struct walk_thread_arg{
+    struct dir_walker* walker;
+    unsigned int self;          // number of the thread, it owns deques[self]
+};
+
+//Define the struct for the walk of a directory tree
+struct dir_walker{
+    const struct walk_filter* filter;   // include and exclude patterns
+    size_t root_length;         // length of the root path, the patterns with a '/' match the path relative to it
+    pthread_t threads[WALK_THREADS];
+    struct walk_thread_arg args[WALK_THREADS];
+    unsigned int started;       // number of threads started
+    struct walk_deque deques[WALK_THREADS];
+    pthread_mutex_t lock;       // lock of the counters and of the queue of names
+    pthread_cond_t work;        // signaled when a directory is added or the walk is finished
+    pthread_cond_t changed;     // signaled when a name is added or taken, or the walk is finished
+    size_t queued;              // number of directories in the deques
+    size_t pending;             // number of directories found and not read completely yet
+    int stop;                   // boolean value, the processing doesn't need more names
+    char* names[WALK_QUEUE_SIZE];   // names found and not taken yet, name number n is at names[n % WALK_QUEUE_SIZE]
+    size_t produced;            // number of names found
+    size_t taken;               // number of names taken
+};
+
+//Check if the pattern "pattern" matches the path "path": the whole path relative to the root if the pattern has a '/',
+//the last component otherwise
+static int walk_match(const char* pattern, const char* path, const char* name){
+    return fnmatch(pattern, strchr(pattern,'/')!=NULL ? path : name, FNM_PATHNAME)==0;
+}
+
+//Check if the entry "name" at "path" (relative to the root) is kept by the patterns, the include patterns apply only to the files
+static int walk_filter_keep(const struct walk_filter* filter, const char* path, const char* name, int is_dir){
+    for(size_t i=0;i<filter->exclude_count;i++){
+        if(walk_match(filter->exclude[i],path,name))
+            return 0;
+    }
+    if(is_dir || filter->include_count==0)
+        return 1;
+    for(size_t i=0;i<filter->include_count;i++){
+        if(walk_match(filter->include[i],path,name))
+            return 1;
+    }
+    return 0;
+}
+
+//Add the directory "path" to the deque of the thread "self", return 0 on success
+static int walk_push_dir(struct dir_walker* w, unsigned int self, char* path){
+    struct walk_deque* d=&w->deques[self];
+    pthread_mutex_lock(&d->lock);
+    if(d->tail==d->capacity){
+        //Reuse the room of the directories stolen before growing the deque
+        if(d->head>0){
+            memmove(d->dirs,d->dirs+d->head,(d->tail-d->head)*sizeof(char*));
+            d->tail-=d->head;
+            d->head=0;
+        }
+        if(d->tail>=d->capacity/2){
+            size_t capacity = d->capacity ? 2*d->capacity : 64;
+            char** dirs=realloc(d->dirs,capacity*sizeof(char*));
+            if(dirs==NULL){
+                pthread_mutex_unlock(&d->lock);
+                return -1;
+            }
+            d->dirs=dirs;
+            d->capacity=capacity;
+        }
+    }
+    d->dirs[d->tail++]=path;
+    pthread_mutex_unlock(&d->lock);
+
+    pthread_mutex_lock(&w->lock);
+    w->queued++;
+    w->pending++;
+    pthread_cond_signal(&w->work);
+    pthread_mutex_unlock(&w->lock);
+    return 0;
+}
+
+//Take a directory: the last one of the deque of the thread "self", or the first one of the deque of another thread
+//Return NULL if all the deques are empty
+static char* walk_take_dir(struct dir_walker* w, unsigned int self){
+    char* path=NULL;
+    for(unsigned int k=0; k<WALK_THREADS && path==NULL; k++){
+        struct walk_deque* d=&w->deques[(self+k)%WALK_THREADS];
+        pthread_mutex_lock(&d->lock);
+        if(d->head<d->tail)
+            path = k==0 ? d->dirs[--d->tail] : d->dirs[d->head++];
+        pthread_mutex_unlock(&d->lock);
+    }
+    if(path!=NULL){
+        pthread_mutex_lock(&w->lock);
+        w->queued--;
+        pthread_mutex_unlock(&w->lock);
+    }
+    return path;
+}
+
+//Add the name of a PNG file found to the queue, waiting while the queue is full
+//Return -1 if the processing doesn't need more names ("path" is released)
+static int walk_push_name(struct dir_walker* w, char* path){
+    pthread_mutex_lock(&w->lock);
+    while(w->produced-w->taken==WALK_QUEUE_SIZE && !w->stop)
+        pthread_cond_wait(&w->changed,&w->lock);
+    if(w->stop){
+        pthread_mutex_unlock(&w->lock);
+        free(path);
+        return -1;
+    }
+    w->names[w->produced++%WALK_QUEUE_SIZE]=path;
+    pthread_cond_broadcast(&w->changed);
+    pthread_mutex_unlock(&w->lock);
+    return 0;
+}
+
+//Check if the file "name" of the directory "dir_fd" starts with the PNG signature
+static int walk_has_signature(int dir_fd, const char* name){
+    static const unsigned char png_signature[8] = {0x89,0x50,0x4E,0x47,0x0D,0x0A,0x1A,0x0A}; // PNG signature
+    unsigned char signature[8];
+    int fd=openat(dir_fd,name,O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+    if(fd<0)
+        return 0;
+    int result = pread(fd,signature,8,0)==8 && memcmp(signature,png_signature,8)==0;
+    close(fd);
+    return result;
+}
+
+//Read the directory "path": the subdirectories are added to the deque of the thread "self", the PNG files to the queue of names
+//Return -1 if the processing doesn't need more names
+static int walk_directory(struct dir_walker* w, unsigned int self, const char* path, char* buffer){
+    int dir_fd=openat(AT_FDCWD,path,O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dir_fd<0)
+        return 0; // the directory has been removed or can't be read, it's skipped like the files that aren't PNG files
+    size_t path_length = strcmp(path,"/")==0 ? 0 : strlen(path); // the children of the root "/" are "/NAME"
+    long n;
+    while((n=syscall(SYS_getdents64,dir_fd,buffer,WALK_DIRENT_BUFFER))>0){
+        for(long pos=0; pos<n; ){
+            struct walk_dirent* e=(struct walk_dirent*)(buffer+pos);
+            pos+=e->d_reclen;
+            if(e->d_name[0]=='.' && (e->d_name[1]=='\0' || (e->d_name[1]=='.' && e->d_name[2]=='\0')))
+                continue;
+
+            //The symbolic links are not followed, the file systems that don't give the type need a stat
+            unsigned char type=e->d_type;
+            if(type==DT_UNKNOWN){
+                struct stat st;
+                if(fstatat(dir_fd,e->d_name,&st,AT_SYMLINK_NOFOLLOW)!=0)
+                    continue;
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+            }
+            if(type!=DT_DIR && type!=DT_REG)
+                continue;
+
+            size_t name_length=strlen(e->d_name);
+            char* child=malloc(path_length+name_length+2);
+            if(child==NULL)
+                continue;
+            memcpy(child,path,path_length);
+            child[path_length]='/';
+            memcpy(child+path_length+1,e->d_name,name_length+1);
+            const char* relative=child+w->root_length+1;
+
+            if(!walk_filter_keep(w->filter,relative,e->d_name,type==DT_DIR) || (type==DT_REG && !walk_has_signature(dir_fd,e->d_name))){
+                free(child);
+                continue;
+            }
+            if(type==DT_DIR){
+                if(walk_push_dir(w,self,child)!=0)
+                    free(child);
+            }else if(walk_push_name(w,child)!=0){
+                close(dir_fd);
+                return -1;
+            }
+        }
+    }
+    close(dir_fd);
+    return 0;
+}
+
+//Walker thread: read the directories of its deque, or stolen from the other threads, until the whole tree has been read
+static void* walk_thread(void* arg){
+    struct dir_walker* w=((struct walk_thread_arg*)arg)->walker;
+    unsigned int self=((struct walk_thread_arg*)arg)->self;
+    char* buffer=malloc(WALK_DIRENT_BUFFER);
+
+    for(;;){
+        char* path=walk_take_dir(w,self);
+        if(path==NULL){
+            //Wait for another thread to find a directory, or for the end of the walk
+            pthread_mutex_lock(&w->lock);
+            while(w->queued==0 && w->pending>0 && !w->stop)
+                pthread_cond_wait(&w->work,&w->lock);
+            int finished = w->pending==0 || w->stop;
+            pthread_mutex_unlock(&w->lock);
+            if(finished)
+                break;
+            continue;
+        }
+        int stopped = buffer==NULL || walk_directory(w,self,path,buffer)!=0;
+        free(path);
+
+        pthread_mutex_lock(&w->lock);
+        if(stopped)
+            w->stop=1;
+        if(--w->pending==0 || stopped){
+            pthread_cond_broadcast(&w->work);
+            pthread_cond_broadcast(&w->changed);
+        }
+        pthread_mutex_unlock(&w->lock);
+    }
+    free(buffer);
+    return NULL;
+}
+
+//Stop the walk and release the walker
+void walk_free(struct dir_walker* w){
+    if(w==NULL)
+        return;
+    pthread_mutex_lock(&w->lock);
+    w->stop=1;
+    pthread_cond_broadcast(&w->work);
+    pthread_cond_broadcast(&w->changed);
+    pthread_mutex_unlock(&w->lock);
+    for(unsigned int t=0; t<w->started; t++)
+        pthread_join(w->threads[t],NULL);
+
+    for(; w->taken<w->produced; w->taken++)
+        free(w->names[w->taken%WALK_QUEUE_SIZE]);
+    for(unsigned int t=0; t<WALK_THREADS; t++){
+        struct walk_deque* d=&w->deques[t];
+        for(size_t i=d->head; i<d->tail; i++)
+            free(d->dirs[i]);
+        free(d->dirs);
+        pthread_mutex_destroy(&d->lock);
+    }
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->work);
+    pthread_cond_destroy(&w->changed);
+    free(w);
+}
+
+//Start the walk of the directory tree "root" with the patterns "filter"
+//Return NULL if the directory can't be opened or the walker can't be allocated
+struct dir_walker* walk_start(const char* root, const struct walk_filter* filter){
+    int fd=openat(AT_FDCWD,root,O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd<0)
+        return NULL;
+    close(fd);
+    struct dir_walker* w=calloc(1,sizeof(struct dir_walker));
+    if(w==NULL)
+        return NULL;
+    w->filter=filter;
+    pthread_mutex_init(&w->lock,NULL);
+    pthread_cond_init(&w->work,NULL);
+    pthread_cond_init(&w->changed,NULL);
+    for(unsigned int t=0; t<WALK_THREADS; t++)
+        pthread_mutex_init(&w->deques[t].lock,NULL);
+
+    //The root is named without its trailing slashes, so the paths found have a single slash between their components
+    size_t length=strlen(root);
+    while(length>1 && root[length-1]=='/')
+        length--;
+    char* path=malloc(length+1);
+    if(path!=NULL){
+        memcpy(path,root,length);
+        path[length]='\0';
+    }
+    if(path==NULL || walk_push_dir(w,0,path)!=0){
+        free(path);
+        walk_free(w);
+        return NULL;
+    }
+    w->root_length = length==1 && root[0]=='/' ? 0 : length;
+
+    for(; w->started<WALK_THREADS; w->started++){
+        w->args[w->started].walker=w;
+        w->args[w->started].self=w->started;
+        if(pthread_create(&w->threads[w->started],NULL,walk_thread,&w->args[w->started])!=0)
+            break;
+    }
+    if(w->started==0){
+        walk_free(w);
+        return NULL;
+    }
+    return w;
+}
+
+//Take the next PNG file found by the walk, waiting for the walker threads
+//Return NULL when the whole tree has been walked
+char* walk_next(struct dir_walker* w){
+    char* path=NULL;
+    pthread_mutex_lock(&w->lock);
+    while(w->taken==w->produced && w->pending>0 && !w->stop)
+        pthread_cond_wait(&w->changed,&w->lock);
+    if(w->taken<w->produced){
+        path=w->names[w->taken++%WALK_QUEUE_SIZE];
+        pthread_cond_broadcast(&w->changed);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return path;
+}
+
+//Define the struct for the source of the PNG files to process: the entries of the command line, whose lists of
+//file names are read one name at a time when the files are processed, so the memory doesn't depend on the length of the lists
+struct job_source{
+    struct cmd_entry* entries;  // entries of the command line
+    size_t count;               // number of entries
+    size_t next;                // next entry
+    FILE* list;                 // list of file names being read, NULL if none
+    const struct cmd_entry* list_entry; // entry of the list being read
+    char* line;                 // buffer of the file name read from the list
+    size_t line_size;           // size of the buffer
+    struct uring_loader* uring; // io_uring backend reading the files ahead (option "--uring"), NULL if disabled
+    struct dir_walker* walk;    // walk of the directory tree being read, NULL if none
+    const struct cmd_entry* walk_entry; // entry of the directory tree being read
+};
+
+//Get the next PNG file to process from the entries of the command line, return 0 when there are no more files
+int source_next_job(struct job_source* source, struct png_job* job){
+    memset(job,0,sizeof(*job));
+
+    for(;;){
+        //Next file name of the list being read, empty names are skipped
+        if(source->list!=NULL){
+            ssize_t length=getdelim(&source->line,&source->line_size,source->list_entry->separator,source->list);
+            if(length<0){
+                if(source->list!=stdin)
+                    fclose(source->list);
+                source->list=NULL;
+                continue;
+            }
+            if(length>0 && source->line[length-1]==source->list_entry->separator)
+                source->line[--length]='\0';
+            if(length==0)
+                continue;
+            job->kind=JOB_FILE;
+            job->file_name=strdup(source->line);
+            job->owns_name=1;
+            job->settings=&source->list_entry->settings;
+            if(job->file_name==NULL){
+                //Not enough memory for the name, report it as a file that can't be opened
+                job->file_name=source->list_entry->name;
+                job->owns_name=0;
+            }
+            return 1;
+        }
+
+        //Next PNG file found in the directory tree being walked
+        if(source->walk!=NULL){
+            char* path=walk_next(source->walk);
+            if(path==NULL){
+                walk_free(source->walk);
+                source->walk=NULL;
+                continue;
+            }
+            job->kind=JOB_FILE;
+            job->file_name=path;
+            job->owns_name=1;
+            job->settings=&source->walk_entry->settings;
+            return 1;
+        }
+
+        if(source->next>=source->count)
+            return 0;
+        const struct cmd_entry* entry=&source->entries[source->next++];
+
+        if(entry->kind==JOB_LIST){
+            source->list=strcmp(entry->name,"-")==0 ? stdin : fopen(entry->name,"rb");
+            source->list_entry=entry;
+            if(source->list==NULL){
+                //The error is printed in order, as the result of a job
+                job->kind=JOB_LIST;
+                job->file_name=entry->name;
+                job->settings=&entry->settings;
+                return 1;
+            }
+            continue;
+        }
+
+        if(entry->kind==JOB_DIR){
+            source->walk=walk_start(entry->name,&entry->filter);
+            source->walk_entry=entry;
+            if(source->walk==NULL){
+                job->kind=JOB_DIR;
+                job->file_name=entry->name;
+                job->settings=&entry->settings;
+                return 1;
+            }
+            continue;
+        }
+
+        job->kind=entry->kind;
+        job->file_name=entry->name;
+        job->settings=&entry->settings;
+        return 1;
+    }
+}
+
+/*
+    io_uring backend (option "--uring")
+*/
+
+//The blocking path opens and reads one file at a time, so only one read is ever in flight. The io_uring backend keeps
+//up to "depth" files in flight: the open, the size query and the reads of the next files of the source are submitted
+//together and the kernel completes them while the files already read are parsed and printed.
+//The files are handed over in the source order with their whole content, which is parsed like a mapped file.
+//liburing isn't required, the rings are set up with the raw system calls. Without io_uring (old kernels, seccomp)
+//the files are read with the blocking path.
+
+//Default and maximum number of files in flight
+#define URING_DEFAULT_DEPTH 32
+#define URING_MAX_DEPTH 4096
+//Larger files are left to the blocking path, mapping them is cheaper than copying them
+#define URING_MAX_FILE (8*1024*1024)
+//statx of an open file descriptor, fcntl.h only defines it with _GNU_SOURCE
+#ifndef AT_EMPTY_PATH
+#define AT_EMPTY_PATH 0x1000
+#endif
+
+//Define the states of a file in flight
+enum uring_state{
+    URING_OPENING,      // openat submitted
+    URING_STATING,      // statx submitted
+    URING_READING,      // read submitted
+    URING_DONE          // the job can be handed over
+};
+
+//Define the struct for a file in flight
+struct uring_slot{
+    struct png_job job;         // job of the file
+    enum uring_state state;     // state of the file
+    int fd;                     // file descriptor, -1 if not opened
+    size_t offset;              // number of bytes read
+    struct statx stx;           // size and type of the file
+};
+
+//Define the struct for the io_uring backend
+struct uring_loader{
+    int ring_fd;                // file descriptor of the io_uring instance
+    unsigned char* sq_ring;     // mapping of the submission queue ring
+    unsigned char* cq_ring;     // mapping of the completion queue ring (the same as sq_ring with IORING_FEAT_SINGLE_MMAP)
+    struct io_uring_sqe* sqes;  // mapping of the submission queue entries
+    size_t sq_ring_size, cq_ring_size, sqes_size;   // sizes of the mappings
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;       // submission queue ring fields
+    unsigned *cq_head, *cq_tail, *cq_mask;                  // completion queue ring fields
+    struct io_uring_cqe* cqes;  // completion queue entries
+    unsigned int to_submit;     // number of entries queued and not submitted yet
+    unsigned int inflight;      // number of operations submitted and not completed
+    struct uring_slot* slots;   // files in flight, file number n is at slots[n % depth]
+    unsigned int depth;         // maximum number of files in flight
+    size_t head;                // next file to hand over
+    size_t tail;                // number of files taken from the source
+    int source_done;            // boolean value, all the files of the source have been taken
+    int failed;                 // boolean value, the ring failed and the files are read with the blocking path
+    unsigned char** orphans;    // buffers of the reads in flight when the ring failed, released by uring_free
+    unsigned int orphan_count;  // number of buffers in "orphans"
+};
+
+static int uring_setup(unsigned int entries, struct io_uring_params* params){
+    return (int)syscall(__NR_io_uring_setup,entries,params);
+}
+
+static int uring_enter(int ring_fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags){
+    return (int)syscall(__NR_io_uring_enter,ring_fd,to_submit,min_complete,flags,NULL,0);
+}
+
+//Check that the kernel supports the operations used by the backend (openat, statx and read need Linux 5.6)
+static int uring_probe(int ring_fd){
+    size_t size=sizeof(struct io_uring_probe)+256*sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe=calloc(1,size);
+    if(probe==NULL)
+        return 0;
+    int ok=syscall(__NR_io_uring_register,ring_fd,IORING_REGISTER_PROBE,probe,256)==0;
+    const int ops[3]={IORING_OP_OPENAT,IORING_OP_STATX,IORING_OP_READ};
+    for(int i=0;ok && i<3;i++)
+        ok=ops[i]<=probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return ok;
+}
+
+//Release the io_uring backend, the operations still in flight are completed first since they write into the slots
+void uring_free(struct uring_loader* u){
+    if(u==NULL)
+        return;
+    if(u->ring_fd>=0){
+        if(u->to_submit>0 && uring_enter(u->ring_fd,u->to_submit,0,0)>=0)
+            u->inflight+=u->to_submit;
+        while(u->inflight>0){
+            if(uring_enter(u->ring_fd,0,1,IORING_ENTER_GETEVENTS)<0 && errno!=EINTR)
+                break;
+            unsigned head=*u->cq_head;
+            while(head!=__atomic_load_n(u->cq_tail,__ATOMIC_ACQUIRE)){
+                head++;
+                u->inflight--;
+            }
+            __atomic_store_n(u->cq_head,head,__ATOMIC_RELEASE);
+        }
+    }
+    if(u->slots!=NULL){
+        for(size_t n=u->head;n<u->tail;n++){
+            struct uring_slot* slot=&u->slots[n%u->depth];
+            if(slot->fd>=0)
+                close(slot->fd);
+            free(slot->job.data);
+            if(slot->job.owns_name)
+                free(slot->job.file_name);
+        }
+        free(u->slots);
+    }
+    for(unsigned int i=0;i<u->orphan_count;i++)
+        free(u->orphans[i]);
+    free(u->orphans);
+    if(u->sqes!=NULL)
+        munmap(u->sqes,u->sqes_size);
+    if(u->cq_ring!=NULL && u->cq_ring!=u->sq_ring)
+        munmap(u->cq_ring,u->cq_ring_size);
+    if(u->sq_ring!=NULL)
+        munmap(u->sq_ring,u->sq_ring_size);
+    if(u->ring_fd>=0)
+        close(u->ring_fd);
+    free(u);
+}
+
+//Create the io_uring backend keeping "depth" files in flight, return NULL if io_uring isn't available
+struct uring_loader* uring_init(unsigned int depth){
+    struct uring_loader* u=calloc(1,sizeof(struct uring_loader));
+    if(u==NULL)
+        return NULL;
+    u->ring_fd=-1;
+    u->depth=depth;
+
+    struct io_uring_params params;
+    memset(&params,0,sizeof(params));
+    u->ring_fd=uring_setup(depth,&params);
+    if(u->ring_fd<0 || !uring_probe(u->ring_fd)){
+        uring_free(u);
+        return NULL;
+    }
+
+    //Map the rings and the submission queue entries
+    u->sq_ring_size=params.sq_off.array+params.sq_entries*sizeof(unsigned);
+    u->cq_ring_size=params.cq_off.cqes+params.cq_entries*sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        if(u->cq_ring_size>u->sq_ring_size)
+            u->sq_ring_size=u->cq_ring_size;
+        u->cq_ring_size=u->sq_ring_size;
+    }
+    void* sq=mmap(NULL,u->sq_ring_size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,u->ring_fd,IORING_OFF_SQ_RING);
+    if(sq==MAP_FAILED){
+        uring_free(u);
+        return NULL;
+    }
+    u->sq_ring=sq;
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        u->cq_ring=u->sq_ring;
+    }else{
+        void* cq=mmap(NULL,u->cq_ring_size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,u->ring_fd,IORING_OFF_CQ_RING);
+        if(cq==MAP_FAILED){
+            uring_free(u);
+            return NULL;
+        }
+        u->cq_ring=cq;
+    }
+    u->sqes_size=params.sq_entries*sizeof(struct io_uring_sqe);
+    void* sqes=mmap(NULL,u->sqes_size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,u->ring_fd,IORING_OFF_SQES);
+    if(sqes==MAP_FAILED){
+        uring_free(u);
+        return NULL;
+    }
+    u->sqes=sqes;
+
+    u->sq_head=(unsigned*)(u->sq_ring+params.sq_off.head);
+    u->sq_tail=(unsigned*)(u->sq_ring+params.sq_off.tail);
+    u->sq_mask=(unsigned*)(u->sq_ring+params.sq_off.ring_mask);
+    u->sq_array=(unsigned*)(u->sq_ring+params.sq_off.array);
+    u->cq_head=(unsigned*)(u->cq_ring+params.cq_off.head);
+    u->cq_tail=(unsigned*)(u->cq_ring+params.cq_off.tail);
+    u->cq_mask=(unsigned*)(u->cq_ring+params.cq_off.ring_mask);
+    u->cqes=(struct io_uring_cqe*)(u->cq_ring+params.cq_off.cqes);
+
+    u->slots=calloc(depth,sizeof(struct uring_slot));
+    u->orphans=calloc(depth,sizeof(unsigned char*));
+    if(u->slots==NULL || u->orphans==NULL){
+        uring_free(u);
+        return NULL;
+    }
+    return u;
+}
+
+//Queue a submission queue entry for the file number "n", it's submitted by the next "uring_enter"
+//There is at most one operation in flight per file, so the submission queue (depth entries) is never full
+static struct io_uring_sqe* uring_queue(struct uring_loader* u, size_t n, int opcode){
+    unsigned tail=*u->sq_tail;
+    unsigned index=tail & *u->sq_mask;
+    struct io_uring_sqe* sqe=&u->sqes[index];
+    memset(sqe,0,sizeof(*sqe));
+    sqe->opcode=opcode;
+    sqe->user_data=n;
+    u->sq_array[index]=index;
+    __atomic_store_n(u->sq_tail,tail+1,__ATOMIC_RELEASE);
+    u->to_submit++;
+    return sqe;
+}
+
+//Hand the file over to the blocking path, used for the files that aren't worth reading in a buffer
+static void uring_fallback(struct uring_slot* slot){
+    if(slot->fd>=0)
+        close(slot->fd);
+    slot->fd=-1;
+    free(slot->job.data);
+    slot->job.data=NULL;
+    slot->job.loaded=0;
+    slot->state=URING_DONE;
+}
+
+//Queue the read of the rest of the file
+static void uring_queue_read(struct uring_loader* u, size_t n){
+    struct uring_slot* slot=&u->slots[n%u->depth];
+    size_t remaining=slot->job.data_size-slot->offset;
+    struct io_uring_sqe* sqe=uring_queue(u,n,IORING_OP_READ);
+    sqe->fd=slot->fd;
+    sqe->addr=(unsigned long)(slot->job.data+slot->offset);
+    sqe->len=(unsigned)remaining;
+    sqe->off=slot->offset;
+    slot->state=URING_READING;
+}
+
+//Move the file number "n" to its next state with the result "res" of its last operation
+static void uring_complete(struct uring_loader* u, size_t n, int res){
+    struct uring_slot* slot=&u->slots[n%u->depth];
+
+    switch(slot->state){
+    case URING_OPENING:
+        if(res<0){
+            //Reported in order as a file that can't be opened
+            slot->job.loaded=-1;
+            slot->state=URING_DONE;
+            return;
+        }
+        slot->fd=res;
+        struct io_uring_sqe* sqe=uring_queue(u,n,IORING_OP_STATX);
+        sqe->fd=slot->fd;
+        sqe->addr=(unsigned long)"";
+        sqe->len=STATX_TYPE|STATX_SIZE|STATX_INO|STATX_MTIME;
+        sqe->statx_flags=AT_EMPTY_PATH;
+        sqe->off=(unsigned long)&slot->stx;
+        slot->state=URING_STATING;
+        return;
+
+    case URING_STATING:
+        //Empty, special and large files are read with the blocking path
+        if(res<0 || !S_ISREG(slot->stx.stx_mode) || slot->stx.stx_size==0 || slot->stx.stx_size>URING_MAX_FILE){
+            uring_fallback(slot);
+            return;
+        }
+        //A file found in the validation cache isn't read
+        if(slot->job.settings->cache!=NULL && (slot->stx.stx_mask & (STATX_INO|STATX_MTIME))==(STATX_INO|STATX_MTIME)){
+            size_t length;
+            slot->job.key.dev=(uint64_t)slot->stx.stx_dev_major<<32 | slot->stx.stx_dev_minor;
+            slot->job.key.ino=slot->stx.stx_ino;
+            slot->job.key.size=slot->stx.stx_size;
+            slot->job.key.mtime_ns=(uint64_t)slot->stx.stx_mtime.tv_sec*1000000000u+slot->stx.stx_mtime.tv_nsec;
+            slot->job.has_key=1;
+            if(!slot->job.settings->cformat->uses_D && cache_lookup(slot->job.settings->cache,&slot->job.key,&length)!=NULL){
+                uring_fallback(slot);
+                return;
+            }
+        }
+        slot->job.data_size=(size_t)slot->stx.stx_size;
+        slot->job.data=malloc(slot->job.data_size);
+        if(slot->job.data==NULL){
+            uring_fallback(slot);
+            return;
+        }
+        slot->offset=0;
+        uring_queue_read(u,n);
+        return;
+
+    case URING_READING:
+        if(res<0){
+            uring_fallback(slot);
+            return;
+        }
+        slot->offset+=(size_t)res;
+        //Short read: read the rest, a file shrunk while it's read is parsed up to its new end
+        if(res>0 && slot->offset<slot->job.data_size){
+            uring_queue_read(u,n);
+            return;
+        }
+        slot->job.data_size=slot->offset;
+        if(slot->job.data_size==0){
+            uring_fallback(slot);
+            return;
+        }
+        close(slot->fd);
+        slot->fd=-1;
+        slot->job.loaded=1;
+        slot->state=URING_DONE;
+        return;
+
+    case URING_DONE:
+        return;
+    }
+}
+
+//Take the next files of the source until "depth" files are in flight, the files read with the streaming mode or
+//the "--trust-crc" fast path and the other jobs only keep their place in the order
+static void uring_fill(struct uring_loader* u, struct job_source* source){
+    while(!u->source_done && u->tail-u->head<u->depth){
+        struct uring_slot* slot=&u->slots[u->tail%u->depth];
+        memset(slot,0,sizeof(*slot));
+        slot->fd=-1;
+        if(!source_next_job(source,&slot->job)){
+            u->source_done=1;
+            return;
+        }
+        const struct read_settings* settings=slot->job.settings;
+        if(slot->job.kind==JOB_FILE && settings->stream_limit==0 && !settings->trust_crc && !settings->use_index && !settings->recover && !settings->rewrite){
+            struct io_uring_sqe* sqe=uring_queue(u,u->tail,IORING_OP_OPENAT);
+            sqe->fd=AT_FDCWD;
+            sqe->addr=(unsigned long)slot->job.file_name;
+            sqe->open_flags=O_RDONLY|O_CLOEXEC;
+            slot->state=URING_OPENING;
+        }else{
+            slot->state=URING_DONE;
+        }
+        u->tail++;
+    }
+}
+
+//Stop using the ring after an error: the files in flight are handed over to the blocking path in their order
+//The kernel may still write into the buffers of the reads in flight, they are only released by uring_free
+static void uring_disable(struct uring_loader* u){
+    u->failed=1;
+    for(size_t n=u->head;n<u->tail;n++){
+        struct uring_slot* slot=&u->slots[n%u->depth];
+        if(slot->state==URING_DONE)
+            continue;
+        if(slot->state==URING_READING && slot->job.data!=NULL)
+            u->orphans[u->orphan_count++]=slot->job.data;
+        else
+            free(slot->job.data);
+        slot->job.data=NULL;
+        uring_fallback(slot);
+    }
+}
+
+//Get the next PNG file of the source read by the io_uring backend, return 0 when there are no more files
+//Once the ring has failed, the files already taken are handed over first and the next ones are taken from the source
+int uring_next_job(struct uring_loader* u, struct job_source* source, struct png_job* job){
+    if(!u->failed)
+        uring_fill(u,source);
+    if(u->head==u->tail)
+        return u->failed ? source_next_job(source,job) : 0;
+
+    struct uring_slot* slot=&u->slots[u->head%u->depth];
+    while(slot->state!=URING_DONE){
+        //Submit the queued operations and wait for at least one completion
+        int submitted=uring_enter(u->ring_fd,u->to_submit,1,IORING_ENTER_GETEVENTS);
+        if(submitted<0){
+            if(errno==EINTR)
+                continue;
+            //The ring is unusable, the files are read with the blocking path from now on
+            uring_disable(u);
+            break;
+        }
+        u->inflight+=(unsigned)submitted;
+        u->to_submit-=(unsigned)submitted;
+
+        unsigned head=*u->cq_head;
+        while(head!=__atomic_load_n(u->cq_tail,__ATOMIC_ACQUIRE)){
+            struct io_uring_cqe* cqe=&u->cqes[head & *u->cq_mask];
+            head++;
+            u->inflight--;
+            uring_complete(u,(size_t)cqe->user_data,cqe->res);
+        }
+        __atomic_store_n(u->cq_head,head,__ATOMIC_RELEASE);
+    }
+
+    *job=slot->job;
+    memset(&slot->job,0,sizeof(slot->job));
+    u->head++;
+    //Keep the queue full while the file is processed
+    if(u->failed)
+        return 1;
+    uring_fill(u,source);
+    if(u->to_submit>0){
+        int submitted=uring_enter(u->ring_fd,u->to_submit,0,0);
+        if(submitted>0){
+            u->inflight+=(unsigned)submitted;
+            u->to_submit-=(unsigned)submitted;
+        }
+    }
+    return 1;
+}
+
+//Get the next PNG file to process, return 0 when there are no more files
+int next_job(struct job_source* source, struct png_job* job){
+    if(source->uring!=NULL)
+        return uring_next_job(source->uring,source,job);
+    return source_next_job(source,job);
+}
+
+//Release the resources of the source of PNG files
+void free_job_source(struct job_source* source){
+    uring_free(source->uring);
+    source->uring=NULL;
+    walk_free(source->walk);
+    source->walk=NULL;
+    if(source->list!=NULL && source->list!=stdin)
+        fclose(source->list);
+    source->list=NULL;
+    free(source->line);
+    source->line=NULL;
+}
+
+//Read the PNG file of "job" and print its information in the specified formats (pformat,cformat,kformat)
+//Return 0 if the file can't be opened, 1 otherwise
+int process_png_file(struct png_context* ctx, struct png_job* job){
+    char* file_name=job->file_name;
+    const struct read_settings* settings=job->settings;
+    const struct format_program* pformat=settings->pformat;
+    const struct format_program* cformat=settings->cformat;
+    const struct format_program* kformat=settings->kformat;
+    enum output_mode mode=settings->output;
+
+    //The records of the machine output modes need the whole chunk index, so the file is always read completely
+    size_t stream_limit = mode==OUTPUT_TEXT ? settings->stream_limit : 0;
+    //The chunk offset index reads only the data printed too, it's a kind of "--trust-crc" reading
+    //The deep validation reads all the IDAT chunks anyway, so with "--deep" the index isn't used and the file is read completely
+    int trust_crc = mode==OUTPUT_TEXT && (settings->trust_crc || (settings->use_index && !settings->deep));
+    int uses_D = mode==OUTPUT_TEXT && cformat->uses_D;
+
+    //The deep validation needs the data of all the IDAT chunks, it's done for the files read completely in memory
+    int deep = settings->deep && stream_limit==0 && !trust_crc;
+
+    //The validation cache is used for the files read and checked completely, it doesn't record the deep validation
+    struct validation_cache* cache = stream_limit==0 && !trust_crc && !deep && !settings->recover ? settings->cache : NULL;
+    const unsigned char* record=NULL; // record of the file in the validation cache
+    size_t record_length;
+    struct cache_key key=job->key;
+    int has_key=job->has_key;
+
+    //A file found by the io_uring backend in the validation cache isn't opened again
+    if(cache!=NULL && has_key && job->loaded==0 && !uses_D)
+        record=cache_lookup(cache,&key,&record_length);
+
+    //The files read by the io_uring backend are already closed
+    FILE* png_file = NULL;
+    if(job->loaded==0 && record==NULL){
+        STATS_TIMER(timer);
+        png_file = fopen(file_name,"rb"); // open the PNG file in read binary mode
+        STATS_PHASE(timer, STATS_OPEN);
+    }
+    if(job->loaded==-1 || (job->loaded==0 && record==NULL && png_file == NULL)){
+        if(mode!=OUTPUT_TEXT){
+            static const char message[]="can't open the file";
+            ctx->pformat_output._f = file_name;
+            print_record(ctx,mode,RECORD_OPEN_ERROR,message,sizeof(message)-1);
+            ctx->pformat_output._f = NULL;
+        }else{
+            sink_printf(ctx->out,"Error, can't open the file %s\n",file_name);
+        }
+        STATS_ADD(errors[STATS_ERR_OPEN], 1);
+        return 0;
+    }
+    STATS_ADD(files, 1);
+
+    //Identity of the opened file, it's checked in the validation cache before the file is read
+    if(cache!=NULL && png_file!=NULL){
+        struct stat st;
+        has_key=fstat(fileno(png_file),&st)==0;
+        if(has_key){
+            cache_key_from_stat(&key,&st);
+            if(!uses_D)
+                record=cache_lookup(cache,&key,&record_length);
+        }
+    }
+
+    ctx->pformat_output._f = file_name; // set the file name in the pformat output struct
+    ctx->select = mode==OUTPUT_TEXT ? settings->select : NULL;
+
+    if(record!=NULL){
+        //The file is unchanged since it was validated, its information is printed from the cache
+        if(png_file!=NULL)
+            fclose(png_file);
+        free(job->data);
+        job->data=NULL;
+        STATS_ADD(cache_hits, 1);
+        cache_replay(ctx,record,file_name,mode,pformat,cformat,kformat);
+        memset(&ctx->pformat_output, 0, sizeof(ctx->pformat_output));
+        return 1;
+    }
+    ctx->use_mmap = settings->use_mmap;
+    ctx->crc_threads = settings->crc_threads;
+
+    //The streaming buffer of the context is reused as long as the memory limit doesn't change
+    if(stream_limit>0 && stream_limit!=ctx->stream.limit){
+        unsigned char* buffer=realloc(ctx->stream.buffer,stream_limit);
+        if(buffer==NULL){
+            report_error(ctx,STATS_ERR_MEMORY,"Error, can't allocate memory for the streaming buffer\n");
+            sink_printf(ctx->out,"Error, can't read the PNG file %s\n",file_name);
+            fclose(png_file);
+            return 1;
+        }
+        ctx->stream.buffer=buffer;
+        ctx->stream.limit=stream_limit;
+    }
+
+    if(stream_limit>0){
+        //Streaming mode: the information is printed while the file is read
+        STATS_TIMER(timer);
+        int result=readPNGstream(ctx,png_file,pformat,cformat,kformat);
+        STATS_PHASE(timer, STATS_READ);
+        if(result==0)
+            STATS_ADD(valid, 1);
+        if(result==-1){
+            sink_printf(ctx->out,"Error, can't read the PNG file %s\n",file_name);
+            if(settings->recover)
+                recover_file(ctx,file_name);
+        }else if(result==-2){
+            sink_printf(ctx->out,"Error, the bit depth field value is not valid for the color type field value for the PNG file %s\n",ctx->pformat_output._f);
+            STATS_ADD(errors[STATS_ERR_IHDR], 1);
+        }
+        fclose(png_file);
+    }else{
+        //In the machine output modes the error message printed while the file is read becomes a field of the record
+        struct out_sink* out=ctx->out;
+        if(mode!=OUTPUT_TEXT){
+            if(ctx->messages.buf==NULL && sink_init(&ctx->messages,-1)!=0){
+                static const char message[]="Error, can't allocate memory for the error messages\n";
+                STATS_ERROR(STATS_ERR_MEMORY);
+                print_record(ctx,mode,RECORD_READ_ERROR,message,sizeof(message)-1);
+                if(png_file!=NULL)
+                    fclose(png_file);
+                free(job->data);
+                job->data=NULL;
+                memset(&ctx->pformat_output, 0, sizeof(ctx->pformat_output));
+                return 1;
+            }
+            ctx->messages.used=0;
+            ctx->out=&ctx->messages;
+        }
+
+        //The error message printed while the file is read is saved in the validation cache with its kind
+        size_t message_start=ctx->out->used;
+        ctx->error_kind=STATS_ERR_OTHER;
+        size_t flushed=ctx->out->flushed;
+
+        STATS_TIMER(timer);
+        int result;
+        if(job->loaded==1){
+            //The content read by the io_uring backend is parsed like a mapped file, the context releases it
+            ctx->mapping.addr=job->data;
+            ctx->mapping.size=job->data_size;
+            ctx->mapping.loaded=1;
+            job->data=NULL;
+            result=readPNGmapped(ctx,NULL);
+        }else{
+            //Fast path reading only the data printed by the formats, pipes are read completely
+            result=!trust_crc ? -2 : settings->use_index ? readPNGindexed(ctx,png_file,file_name,pformat,cformat,kformat) : readPNGheaders(ctx,png_file,pformat,cformat,kformat);
+            if(result==-2)
+                result=readPNGfile(ctx,png_file); // read the PNG file 
+        }
+        STATS_PHASE(timer, STATS_READ);
+
+        //An image data not valid makes the file not valid, like a chunk error
+        if(result==0 && deep && deep_check_image(ctx)!=0){
+            dealloc_mem(ctx,png_file);
+            result=-1;
+        }
+
+        if(cache!=NULL && has_key){
+            if(result==0)
+                cache_store_valid(cache,&key,&ctx->index);
+            else if(ctx->out->flushed==flushed && ctx->out->used>=message_start)
+                cache_store_failed(cache,&key,(enum stats_error)ctx->error_kind,ctx->out->buf+message_start,ctx->out->used-message_start);
+        }
+        ctx->out=out;
+
+        if(result!=0){
+            if(mode!=OUTPUT_TEXT){
+                print_record(ctx,mode,RECORD_READ_ERROR,ctx->messages.buf,ctx->messages.used);
+            }else{
+                sink_printf(ctx->out,"Error, can't read the PNG file %s\n",file_name);
+                if(settings->recover && job->loaded==0)
+                    recover_file(ctx,file_name);
+            }
+        }else{
+            //print the chunks information following the formats or as a record
+            print_file(ctx,mode,pformat,cformat,kformat);
+
+            dealloc_mem(ctx,png_file); // release the memory of the chunks and close the file
+        }
+    }
+
+    memset(&ctx->pformat_output, 0, sizeof(ctx->pformat_output)); // reset the pformat_output struct to the default values
+    return 1;
+}
+
+/*
+    Rewrite mode (option "--rewrite")
+    The PNG file is written again without the chunks selected by "--strip" and, with "--fix-crc", with the CRC fields that
+    are not correct recomputed. The chunk table is built from the chunk headers (like "--index"), the CRC of the chunks kept
+    is checked on the file mapped in memory and the spans of chunks kept unchanged are copied from file to file by the
+    kernel (copy_file_range, or sendfile), so the data of the IDAT chunks is never copied through user space; only the
+    signature and the CRC fields recomputed are written. The new file is written in a temporary file next to the target,
+    which replaces it with a rename once it's complete, so the target is never left half written. In the directory of the
+    option "--rewrite=DIR" a file written during the run is never replaced by another PNG file with the same base name.
+*/
+
+//Copy length bytes at "offset" of the file "in" at the current position of the file "out", return 0 on success
+static int rewrite_copy(int in, int out, off_t offset, size_t length){
+    //The kernel copies the data between the files (reflinks on the file systems that support them)
+    while(length>0){
+        ssize_t n=syscall(SYS_copy_file_range,in,&offset,out,NULL,length,0u);
+        if(n<=0)
+            break;
+        length-=(size_t)n;
+    }
+    while(length>0){
+        ssize_t n=sendfile(out,in,&offset,length);
+        if(n<=0)
+            break;
+        length-=(size_t)n;
+    }
+    //Last resort for the files that can't be copied by the kernel
+    unsigned char buf[64*1024];
+    while(length>0){
+        ssize_t n=pread(in,buf,length<sizeof(buf) ? length : sizeof(buf),offset);
+        if(n<=0)
+            return -1;
+        struct iovec iov={buf,(size_t)n};
+        if(write_all(out,&iov,1)!=0)
+            return -1;
+        offset+=n;
+        length-=(size_t)n;
+    }
+    return 0;
+}
+
+//Define the actions of the rewrite mode on a chunk
+enum rewrite_action {REWRITE_KEEP, REWRITE_STRIP, REWRITE_FIX};
+
+//Define the struct for the names of the files written in the directories of the option "--rewrite=DIR" during the run, an
+//open addressing hash table shared by the workers of the option "-j": two PNG files with the same base name would be written
+//to the same target, only the first one is written
+struct rewrite_targets{
+    pthread_mutex_t lock;
+    char** names;               // names of the files written, NULL for the empty slots
+    size_t count;               // number of names
+    size_t capacity;            // number of slots, 0 or a power of 2
+};
+
+//Hash of the file name "name" (FNV-1a)
+static uint64_t rewrite_hash(const char* name){
+    uint64_t hash=0xcbf29ce484222325ull;
+    for(;*name!='\0';name++)
+        hash=(hash^(unsigned char)*name)*0x100000001b3ull;
+    return hash;
+}
+
+//Reserve the name "target" for the file being written
+//Return 0 if it's reserved, 1 if another PNG file has already been written with this name, -1 if the memory allocation fails
+static int rewrite_claim(struct rewrite_targets* targets, const char* target){
+    pthread_mutex_lock(&targets->lock);
+    //The table grows when it's half full
+    if(2*(targets->count+1)>targets->capacity){
+        size_t capacity = targets->capacity>0 ? 2*targets->capacity : 64;
+        char** names=calloc(capacity,sizeof(char*));
+        if(names==NULL){
+            pthread_mutex_unlock(&targets->lock);
+            return -1;
+        }
+        for(size_t i=0;i<targets->capacity;i++){
+            if(targets->names[i]==NULL)
+                continue;
+            size_t j=rewrite_hash(targets->names[i])&(capacity-1);
+            while(names[j]!=NULL)
+                j=(j+1)&(capacity-1);
+            names[j]=targets->names[i];
+        }
+        free(targets->names);
+        targets->names=names;
+        targets->capacity=capacity;
+    }
+    size_t mask=targets->capacity-1;
+    size_t i=rewrite_hash(target)&mask;
+    for(;targets->names[i]!=NULL;i=(i+1)&mask){
+        if(strcmp(targets->names[i],target)==0){
+            pthread_mutex_unlock(&targets->lock);
+            return 1;
+        }
+    }
+    targets->names[i]=strdup(target);
+    int result = targets->names[i]!=NULL ? 0 : -1;
+    targets->count += result==0;
+    pthread_mutex_unlock(&targets->lock);
+    return result;
+}
+
+//Release the names of the files written
+static void rewrite_targets_free(struct rewrite_targets* targets){
+    for(size_t i=0;i<targets->capacity;i++)
+        free(targets->names[i]);
+    free(targets->names);
+    targets->names=NULL;
+    targets->count=targets->capacity=0;
+}
+
+//Write the PNG file "fd" of identity "st" as "target" following "action", through a temporary file
+//Return 0 on success, -1 if the file can't be written
+static int rewrite_write(const struct chunk_index* index, const unsigned char* action, int fd, const struct stat* st, const char* target){
+    static const unsigned char png_signature[8] = {0x89,0x50,0x4E,0x47,0x0D,0x0A,0x1A,0x0A}; // PNG signature
+    size_t length=strlen(target)+32;
+    char* tmp_path=malloc(length);
+    if(tmp_path==NULL)
+        return -1;
+    //The temporary file gets a name of its own, created exclusively (never an existing file or a symbolic link), so the
+    //workers of the option "-j" writing the same target don't share it; then it gets the permissions of the PNG file
+    snprintf(tmp_path,length,"%s.tmp.XXXXXX",target);
+    int out=mkstemp(tmp_path);
+    if(out<0){
+        free(tmp_path);
+        return -1;
+    }
+    if(fcntl(out,F_SETFD,FD_CLOEXEC)!=0 || fchmod(out,st->st_mode&07777)!=0){
+        close(out);
+        unlink(tmp_path);
+        free(tmp_path);
+        return -1;
+    }
+
+    struct iovec iov={(void*)png_signature,8};
+    int result=write_all(out,&iov,1);
+    //Span of consecutive chunks copied unchanged, from span_start to span_end
+    off_t span_start=8, span_end=8;
+    for(unsigned int i=0; i<index->count && result==0; i++){
+        off_t start=(off_t)index->offsets[i]-8;
+        off_t end=(off_t)index->offsets[i]+index->lengths[i]+4;
+        if(action[i]==REWRITE_STRIP){
+            result=rewrite_copy(fd,out,span_start,(size_t)(span_end-span_start));
+            span_start=span_end=end;
+            continue;
+        }
+        if(start!=span_end){
+            result=rewrite_copy(fd,out,span_start,(size_t)(span_end-span_start));
+            span_start=start;
+        }
+        span_end=end;
+        if(action[i]==REWRITE_FIX && result==0){
+            //The header and the data field are copied, the CRC field is written
+            uint32_t crc=htonl(index->crcs[i]);
+            iov=(struct iovec){&crc,4};
+            result=rewrite_copy(fd,out,span_start,(size_t)(end-4-span_start))!=0 || write_all(out,&iov,1)!=0 ? -1 : 0;
+            span_start=span_end=end;
+        }
+    }
+    if(result==0)
+        result=rewrite_copy(fd,out,span_start,(size_t)(span_end-span_start));
+
+    //The new file is complete on the disk before it replaces the target
+    if(result==0 && fsync(out)!=0)
+        result=-1;
+    if(close(out)!=0)
+        result=-1;
+    if(result!=0 || rename(tmp_path,target)!=0){
+        unlink(tmp_path);
+        result=-1;
+    }
+    free(tmp_path);
+    return result;
+}
+
+//Rewrite the PNG file of "job" following the options "--strip" and "--fix-crc" and print what has been done
+//Return 0 if the file can't be opened, 1 otherwise
+int rewrite_png_file(struct png_context* ctx, struct png_job* job){
+    const struct read_settings* settings=job->settings;
+    const char* file_name=job->file_name;
+    STATS_TIMER(timer);
+    int fd=open(file_name,O_RDONLY|O_CLOEXEC);
+    STATS_PHASE(timer, STATS_OPEN);
+    if(fd<0){
+        sink_printf(ctx->out,"Error, can't open the file %s\n",file_name);
+        STATS_ADD(errors[STATS_ERR_OPEN], 1);
+        return 0;
+    }
+    STATS_ADD(files, 1);
+
+    struct stat st;
+    unsigned char* map=MAP_FAILED;
+    unsigned char* action=NULL;
+    char* target=NULL;
+    if(fstat(fd,&st)!=0 || !S_ISREG(st.st_mode)){
+        sink_printf(ctx->out,"Error, the PNG file %s can't be rewritten, it's not a regular file\n",file_name);
+        goto done;
+    }
+    if(index_scan(ctx,fd,st.st_size)!=0){
+        sink_printf(ctx->out,"Error, can't read the PNG file %s\n",file_name);
+        goto done;
+    }
+    map=mmap(NULL,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    action=malloc(ctx->index.count);
+    if(map==MAP_FAILED || action==NULL){
+        sink_printf(ctx->out,"Error, can't allocate memory for the rewrite of the PNG file %s\n",file_name);
+        goto done;
+    }
+    madvise(map,(size_t)st.st_size,MADV_SEQUENTIAL);
+
+    //The critical chunks (type starting with an uppercase letter) are never stripped, the CRC of the chunks kept is checked
+    struct chunk_index* index=&ctx->index;
+    unsigned int kept=0, stripped=0, fixed=0;
+    for(unsigned int i=0;i<index->count;i++){
+        int critical=index->types[i][0]>='A' && index->types[i][0]<='Z';
+        if(settings->strip!=NULL && !critical && chunk_selected(settings->strip,i+1,index->types[i])){
+            action[i]=REWRITE_STRIP;
+            stripped++;
+            continue;
+        }
+        STATS_TIMER(crc_timer);
+        uint32_t crc=pngq_crc32_update(0xffffffffu,map+index->offsets[i]-4,(size_t)index->lengths[i]+4)^0xffffffffu;
+        STATS_PHASE(crc_timer, STATS_CRC);
+        action[i]=REWRITE_KEEP;
+        kept++;
+        if(crc!=index->crcs[i]){
+            if(!settings->fix_crc){
+                report_error(ctx,STATS_ERR_CRC,"Error, the chunk CRC field is not correct\n");
+                sink_printf(ctx->out,"Error, can't read the PNG file %s\n",file_name);
+                goto done;
+            }
+            action[i]=REWRITE_FIX;
+            index->crcs[i]=crc;
+            fixed++;
+        }
+    }
+
+    //The file is written in the directory of the option or replaced
+    const char* base=strrchr(file_name,'/');
+    base = base!=NULL ? base+1 : file_name;
+    size_t length=(settings->rewrite_dir!=NULL ? strlen(settings->rewrite_dir) : 0)+strlen(file_name)+2;
+    target=malloc(length);
+    if(target==NULL){
+        sink_printf(ctx->out,"Error, can't allocate memory for the rewrite of the PNG file %s\n",file_name);
+        goto done;
+    }
+    if(settings->rewrite_dir!=NULL)
+        snprintf(target,length,"%s/%s",settings->rewrite_dir,base);
+    else
+        snprintf(target,length,"%s",file_name);
+    //In the directory of the option the PNG files with the same base name would replace each other
+    if(settings->rewrite_dir!=NULL && settings->rewrite_targets!=NULL){
+        int claimed=rewrite_claim(settings->rewrite_targets,target);
+        if(claimed<0){
+            sink_printf(ctx->out,"Error, can't allocate memory for the rewrite of the PNG file %s\n",file_name);
+            goto done;
+        }
+        if(claimed>0){
+            sink_printf(ctx->out,"Error, the PNG file %s is not written, %s has already been written by another PNG file\n",file_name,target);
+            goto done;
+        }
+    }
+    STATS_TIMER(write_timer);
+    int written=rewrite_write(index,action,fd,&st,target);
+    STATS_PHASE(write_timer, STATS_OUTPUT);
+    if(written!=0){
+        sink_printf(ctx->out,"Error, can't write the PNG file %s\n",target);
+        goto done;
+    }
+    sink_printf(ctx->out,"%s: written to %s, %u chunks kept, %u stripped, %u CRC fields fixed\n",file_name,target,kept,stripped,fixed);
+    STATS_ADD(valid, 1);
+    STATS_ADD(chunks, index->count);
+
+done:
+    if(map!=MAP_FAILED)
+        munmap(map,(size_t)st.st_size);
+    free(action);
+    free(target);
+    close(fd);
+    dealloc_mem(ctx,NULL);
+    return 1;
+}
+
+//Run a job: process the PNG file or report a list of file names that can't be opened
+//Return 1 if a PNG file has been opened, 0 otherwise
+int run_job(struct png_context* ctx, struct png_job* job){
+    if(job->kind==JOB_LIST){
+        if(job->settings->output!=OUTPUT_TEXT){
+            static const char message[]="can't open the list of files";
+            ctx->pformat_output._f = job->file_name;
+            print_record(ctx,job->settings->output,RECORD_OPEN_ERROR,message,sizeof(message)-1);
+            ctx->pformat_output._f = NULL;
+            return 0;
+        }
+        sink_printf(ctx->out,"Error, can't open the list of files %s\n",job->file_name);
+        return 0;
+    }
+    if(job->kind==JOB_DIR){
+        if(job->settings->output!=OUTPUT_TEXT){
+            static const char message[]="can't open the directory";
+            ctx->pformat_output._f = job->file_name;
+            print_record(ctx,job->settings->output,RECORD_OPEN_ERROR,message,sizeof(message)-1);
+            ctx->pformat_output._f = NULL;
+            return 0;
+        }
+        sink_printf(ctx->out,"Error, can't open the directory %s\n",job->file_name);
+        return 0;
+    }
+    if(job->settings->rewrite && job->loaded==0)
+        return rewrite_png_file(ctx,job);
+    return process_png_file(ctx,job);
+}
+
+//Define the struct for the queue of PNG files shared by the reader of the source, the worker threads and the printer (option "-j")
+//The jobs are kept in a ring: the reader adds them in the source order, each worker takes the next job as soon as it's free,
+//so small and huge files balance across the workers, and the main thread prints the outputs in the source order.
+//The ring bounds both the file names read ahead and the buffered outputs.
+struct job_queue{
+    struct job_source* source;  // source of the PNG files
+    struct png_job* ring;       // jobs added and not printed yet, job number n is at ring[n % capacity]
+    size_t capacity;            // size of the ring
+    size_t produced;            // number of jobs added by the reader
+    size_t next;                // next job to give to a worker
+    size_t printed;             // number of jobs whose output has been printed
+    int finished;               // boolean value, the reader has added all the jobs
+    int stop;                   // boolean value, the remaining files must not be processed
+    pthread_mutex_t lock;
+    pthread_cond_t changed;     // signaled when a job is added, processed or printed
+};
+
+//Reader thread: read the source of PNG files and add the jobs to the queue, reading the lists overlaps with the processing
+void* job_reader(void* arg){
+    struct job_queue* queue=arg;
+    struct png_job job;
+
+    while(next_job(queue->source,&job)){
+        pthread_mutex_lock(&queue->lock);
+        while(queue->produced>=queue->printed+queue->capacity && !queue->stop)
+            pthread_cond_wait(&queue->changed,&queue->lock);
+        if(queue->stop){
+            pthread_mutex_unlock(&queue->lock);
+            free(job.data);
+            if(job.owns_name)
+                free(job.file_name);
+            break;
+        }
+        queue->ring[queue->produced%queue->capacity]=job;
+        queue->produced++;
+        pthread_cond_broadcast(&queue->changed);
+        pthread_mutex_unlock(&queue->lock);
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    queue->finished=1;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
+
+//Worker thread: process the PNG files of the queue with its own context, buffering their output
+void* png_worker(void* arg){
+    struct job_queue* queue=arg;
+    struct png_context ctx;
+    struct out_sink sink;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.out=&sink;
+    stats_thread_begin("worker");
+
+    pthread_mutex_lock(&queue->lock);
+    for(;;){
+        while(queue->next>=queue->produced && !queue->finished && !queue->stop)
+            pthread_cond_wait(&queue->changed,&queue->lock);
+        if(queue->next>=queue->produced || queue->stop)
+            break;
+        struct png_job* job=&queue->ring[queue->next%queue->capacity];
+        queue->next++;
+
+        if(job->kind!=JOB_DASHES){
+            pthread_mutex_unlock(&queue->lock);
+            //The output of the file is kept in memory and handed over to the main thread
+            if(sink_init(&sink,-1)==0){
+                job->opened=run_job(&ctx,job);
+                job->output=sink.buf;
+                job->output_size=sink.used;
+            }
+            pthread_mutex_lock(&queue->lock);
+        }
+        job->done=1;
+        pthread_cond_broadcast(&queue->changed);
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    free_context(&ctx);
+    return NULL;
+}
+
+int process_serial(struct job_source* source);
+
+//Process the PNG files of the source with "threads" worker threads and print their information in the source order
+//The output is the same as the one of a serial run
+int process_parallel(struct job_source* source, unsigned int threads){
+    struct job_queue queue;
+    memset(&queue, 0, sizeof(queue));
+    queue.source=source;
+    queue.capacity=64*(size_t)threads;
+    pthread_mutex_init(&queue.lock,NULL);
+    pthread_cond_init(&queue.changed,NULL);
+
+    struct out_sink out;
+    queue.ring=calloc(queue.capacity,sizeof(struct png_job));
+    pthread_t* workers=malloc(sizeof(pthread_t)*threads);
+    pthread_t reader;
+    if(queue.ring==NULL || workers==NULL || sink_init(&out,STDOUT_FILENO)!=0){
+        free(queue.ring);
+        free(workers);
+        return process_serial(source);
+    }
+    unsigned int started=0;
+    for(;started<threads;started++){
+        if(pthread_create(&workers[started],NULL,png_worker,&queue)!=0)
+            break;
+    }
+    //Without worker threads (or the reader) the files are processed in this thread
+    if(started==0 || pthread_create(&reader,NULL,job_reader,&queue)!=0){
+        pthread_mutex_lock(&queue.lock);
+        queue.stop=1;
+        pthread_cond_broadcast(&queue.changed);
+        pthread_mutex_unlock(&queue.lock);
+        for(unsigned int t=0;t<started;t++)
+            pthread_join(workers[t],NULL);
+        free(queue.ring);
+        free(workers);
+        free(out.buf);
+        pthread_mutex_destroy(&queue.lock);
+        pthread_cond_destroy(&queue.changed);
+        return process_serial(source);
+    }
+
+    int read_a_file=0; // flag to check if a PNG file is read used to flag the unique presence of "--" in the command lines
+    for(size_t n=0;;n++){
+        pthread_mutex_lock(&queue.lock);
+        while(n>=queue.produced && !queue.finished)
+            pthread_cond_wait(&queue.changed,&queue.lock);
+        if(n>=queue.produced){
+            pthread_mutex_unlock(&queue.lock);
+            break;
+        }
+        struct png_job* job=&queue.ring[n%queue.capacity];
+        while(!job->done && job->kind!=JOB_DASHES)
+            pthread_cond_wait(&queue.changed,&queue.lock);
+        pthread_mutex_unlock(&queue.lock);
+
+        if(job->kind==JOB_DASHES && read_a_file){
+            sink_puts(&out,"Error, the \"--\" parameter is not allowed after a PNG file name\n");
+            pthread_mutex_lock(&queue.lock);
+            queue.stop=1;
+            pthread_cond_broadcast(&queue.changed);
+            pthread_mutex_unlock(&queue.lock);
+            break;
+        }
+        if(job->output!=NULL){
+            sink_write(&out,job->output,job->output_size);
+            free(job->output);
+        }
+        if(job->owns_name)
+            free(job->file_name);
+        read_a_file|=job->opened;
+
+        pthread_mutex_lock(&queue.lock);
+        queue.printed=n+1;
+        pthread_cond_broadcast(&queue.changed);
+        pthread_mutex_unlock(&queue.lock);
+    }
+    sink_flush(&out);
+    free(out.buf);
+
+    pthread_join(reader,NULL);
+    for(unsigned int t=0;t<started;t++)
+        pthread_join(workers[t],NULL);
+
+    //Release the jobs not printed because of a misplaced "--"
+    for(size_t n=queue.printed;n<queue.produced;n++){
+        struct png_job* job=&queue.ring[n%queue.capacity];
+        free(job->output);
+        free(job->data);
+        if(job->owns_name)
+            free(job->file_name);
+    }
+
+    free(queue.ring);
+    free(workers);
+    pthread_mutex_destroy(&queue.lock);
+    pthread_cond_destroy(&queue.changed);
+    return 0;
+}
+
+//Process the PNG files of the source one after the other in this thread, printing directly to the standard output
+int process_serial(struct job_source* source){
+    struct png_context ctx;
+    struct out_sink out;
+    memset(&ctx, 0, sizeof(ctx));
+    if(sink_init(&out,STDOUT_FILENO)!=0){
+        printf("Error, can't allocate memory for the output buffer\n");
+        return 1;
+    }
+    ctx.out=&out;
+
+    int read_a_file=0; // flag to check if a PNG file is read used to flag the unique presence of "--" in the command lines
+    struct png_job job;
+    while(next_job(source,&job)){
+        if(job.kind==JOB_DASHES){
+            if(read_a_file){
+                sink_puts(&out,"Error, the \"--\" parameter is not allowed after a PNG file name\n");
+                break;
+            }
+            continue;
+        }
+        read_a_file|=run_job(&ctx,&job);
+        if(job.owns_name)
+            free(job.file_name);
+    }
+
+    sink_flush(&out);
+    free(out.buf);
+    free_context(&ctx);
+    return 0;
+}
+
+/*
+    Server mode (option "--serve")
+    pngq keeps running and answers requests over a Unix domain socket, or over the standard input and output, so the start
+    of a process, the selection of the CRC engines and the compilation of the formats are paid once and the buffers of the
+    contexts are reused from one request to the next.
+    A request is a list of "FIELD VALUE" lines ended by an empty line; in the values "\n", "\t" and "\\" stand for a newline,
+    a tab and a backslash:
+        file PATH       PNG file to read
+        data LENGTH     the PNG file is sent inline, its LENGTH bytes follow the empty line
+        name NAME       file name printed for the inline data (default "-")
+        p FORMAT        pformat of the request, "c" and "k" give the cformat and the kformat (default: the command line ones)
+        output MODE     output mode of the request: text, ndjson or binary
+        deep 0|1        deep validation of the image data
+    The other options of the command line given before "--serve" apply to every request.
+    The reply is the length of the output in decimal on its own line followed by the output, which is exactly what the
+    command line prints for the same file and options. The requests of a client are answered in order.
+    Each server thread (option "-j") runs an epoll event loop with its own context, the threads share the listening socket.
+*/
+
+//Maximum size of the header of a request and of the inline data
+#define SERVE_MAX_HEADER (64*1024)
+#define SERVE_MAX_DATA (256*1024*1024)
+//The requests of a client aren't read while it has more than this amount of replies not written yet
+#define SERVE_MAX_PENDING (1024*1024)
+//Minimum room of the input buffer of a client for a read
+#define SERVE_READ_SIZE (64*1024)
+
+//Define the struct for the request being received from a client
+struct serve_request{
+    char* path;                 // "file" field, NULL if not given
+    char* name;                 // "name" field, NULL if not given
+    int has_data;               // boolean value, the "data" field has been given
+    int in_data;                // boolean value, the header is complete and the inline data is being received
+    unsigned char* data;        // inline data, handed over to the context which releases it
+    size_t data_size;           // length of the inline data
+    size_t data_used;           // bytes of the inline data received
+    char* formats[3];           // pformat, cformat and kformat of the request, NULL for the default ones
+    int output;                 // output mode, -1 for the default one
+    int deep;                   // deep validation, -1 for the default
+    const char* error;          // first error found in the header, it's the reply of the request
+    int fatal;                  // boolean value, the connection can't go on after the error (the data length is unknown)
+};
+
+//Define the struct for a format compiled for a client, it's kept as long as the client sends the same format
+struct serve_format{
+    char* text;                         // format string, referenced by the program
+    struct format_program* program;     // compiled format
+};
+
+//Define the struct for a client of the server
+struct serve_client{
+    int fd;                     // socket of the client, or the standard input
+    int out_fd;                 // socket of the client, or the standard output
+    unsigned char* in;          // bytes received and not used yet
+    size_t in_used;             // number of bytes in "in"
+    size_t in_capacity;         // size of "in"
+    struct out_sink out;        // replies not written yet, kept in memory
+    size_t out_sent;            // bytes of the replies already written
+    struct serve_request req;   // request being received
+    struct serve_format formats[3];     // last formats compiled for the client
+    int closing;                // boolean value, the connection is closed once the replies are written
+    uint32_t events;            // epoll events the client waits for
+    struct serve_client* next;  // next client of the server thread
+};
+
+//Define the struct for a server thread
+struct serve_thread{
+    const struct read_settings* settings;   // default options of the requests
+    int listen_fd;              // listening socket, -1 when serving the standard input
+    int stop_fd;                // signalfd becoming readable when the server must stop, -1 when serving the standard input
+    struct png_context ctx;     // context reused by all the requests
+    struct out_sink output;     // output of the request processed
+    struct serve_client* clients;   // connected clients
+};
+
+//Release the fields of a request and prepare the next one
+static void serve_request_reset(struct serve_request* req){
+    free(req->path);
+    free(req->name);
+    free(req->data);
+    for(int k=0;k<3;k++)
+        free(req->formats[k]);
+    memset(req,0,sizeof(*req));
+    req->output=-1;
+    req->deep=-1;
+}
+
+//Replace the escapes of the value "s" in place
+static void serve_unescape(char* s){
+    char* dst=s;
+    for(; *s!='\0'; s++){
+        if(*s=='\\' && s[1]!='\0'){
+            s++;
+            *dst++ = *s=='n' ? '\n' : *s=='t' ? '\t' : *s;
+        }else{
+            *dst++=*s;
+        }
+    }
+    *dst='\0';
+}
+
+//Set the first error of the request
+static void serve_request_error(struct serve_request* req, const char* error){
+    if(req->error==NULL)
+        req->error=error;
+}
+
+//Read the field line[0..length-1] of the header of a request
+static void serve_parse_field(struct serve_request* req, char* line, size_t length){
+    char* value=memchr(line,' ',length);
+    if(value==NULL){
+        serve_request_error(req,"a field has no value");
+        return;
+    }
+    *value++='\0';
+    line[length]='\0';
+    serve_unescape(value);
+
+    if(strcmp(line,"file")==0 || strcmp(line,"name")==0){
+        char** field = line[0]=='f' ? &req->path : &req->name;
+        free(*field);
+        *field=strdup(value);
+        if(*field==NULL)
+            serve_request_error(req,"can't allocate memory for the request");
+    }else if(strcmp(line,"data")==0){
+        char* end;
+        unsigned long long size=strtoull(value,&end,10);
+        if(req->has_data || end==value || *end!='\0' || size>SERVE_MAX_DATA){
+            serve_request_error(req,"the data length is not valid");
+            req->fatal=1;
+            return;
+        }
+        req->data=malloc(size>0 ? (size_t)size : 1);
+        if(req->data==NULL){
+            serve_request_error(req,"can't allocate memory for the data");
+            req->fatal=1;
+            return;
+        }
+        req->has_data=1;
+        req->data_size=(size_t)size;
+    }else if((line[0]=='p' || line[0]=='c' || line[0]=='k') && line[1]=='\0'){
+        int k = line[0]=='p' ? 0 : line[0]=='c' ? 1 : 2;
+        free(req->formats[k]);
+        req->formats[k]=strdup(value);
+        if(req->formats[k]==NULL)
+            serve_request_error(req,"can't allocate memory for the request");
+    }else if(strcmp(line,"output")==0){
+        if(strcmp(value,"text")==0)
+            req->output=OUTPUT_TEXT;
+        else if(strcmp(value,"ndjson")==0)
+            req->output=OUTPUT_NDJSON;
+        else if(strcmp(value,"binary")==0)
+            req->output=OUTPUT_BINARY;
+        else
+            serve_request_error(req,"the output mode must be text, ndjson or binary");
+    }else if(strcmp(line,"deep")==0){
+        if(strcmp(value,"0")!=0 && strcmp(value,"1")!=0)
+            serve_request_error(req,"the deep field must be 0 or 1");
+        req->deep = value[0]=='1';
+    }else{
+        serve_request_error(req,"unknown field");
+    }
+}
+
+//Return the format of kind "kind" compiled for the client from the string "text", which the client keeps
+//Return NULL if the memory allocation fails
+static const struct format_program* serve_format(struct serve_client* c, enum format_kind kind, char** text){
+    struct serve_format* f=&c->formats[kind];
+    if(f->program!=NULL && strcmp(f->text,*text)==0)
+        return f->program;
+    struct format_program* program=compile_format(*text,kind);
+    if(program==NULL)
+        return NULL;
+    free(f->program);
+    free(f->text);
+    f->program=program;
+    f->text=*text;
+    *text=NULL;
+    return program;
+}
+
+//Process the complete request of the client and append the reply to its output
+static void serve_reply(struct serve_thread* t, struct serve_client* c){
+    struct serve_request* req=&c->req;
+    struct out_sink* output=&t->output;
+    output->used=0;
+
+    if(req->path!=NULL && req->has_data)
+        serve_request_error(req,"the request has both a file and data field");
+    if(req->path==NULL && !req->has_data)
+        serve_request_error(req,"the request has no file or data field");
+
+    struct read_settings settings=*t->settings;
+    const struct format_program** programs[3]={&settings.pformat,&settings.cformat,&settings.kformat};
+    for(int k=0;k<3 && req->error==NULL;k++){
+        if(req->formats[k]!=NULL && (*programs[k]=serve_format(c,(enum format_kind)k,&req->formats[k]))==NULL)
+            serve_request_error(req,"can't allocate memory for the formats");
+    }
+
+    if(req->error!=NULL){
+        sink_printf(output,"Error, the request is not valid, %s\n",req->error);
+    }else{
+        if(req->output>=0)
+            settings.output=(enum output_mode)req->output;
+        if(req->deep>=0)
+            settings.deep=req->deep;
+
+        struct png_job job;
+        memset(&job,0,sizeof(job));
+        job.kind=JOB_FILE;
+        job.settings=&settings;
+        if(req->has_data){
+            //The inline data is parsed like a file read by the io_uring backend, the streaming and header-only paths need a file
+            job.file_name = req->name!=NULL ? req->name : (char*)"-";
+            job.loaded=1;
+            job.data=req->data;
+            job.data_size=req->data_size;
+            req->data=NULL;
+            settings.stream_limit=0;
+            settings.trust_crc=0;
+            settings.use_index=0;
+            settings.rewrite=0;
+        }else{
+            job.file_name=req->path;
+        }
+        t->ctx.out=output;
+        process_png_file(&t->ctx,&job);
+        free(job.data);
+    }
+
+    char length[32];
+    int n=snprintf(length,sizeof(length),"%zu\n",output->used);
+    sink_write(&c->out,length,(size_t)n);
+    sink_write(&c->out,output->buf,output->used);
+    if(req->fatal)
+        c->closing=1;
+    serve_request_reset(req);
+}
+
+//Process the complete requests received from the client
+static void serve_process(struct serve_thread* t, struct serve_client* c){
+    size_t pos=0;
+    while(!c->closing){
+        struct serve_request* req=&c->req;
+        if(req->in_data){
+            size_t n=c->in_used-pos;
+            if(n>req->data_size-req->data_used)
+                n=req->data_size-req->data_used;
+            memcpy(req->data+req->data_used,c->in+pos,n);
+            req->data_used+=n;
+            pos+=n;
+            if(req->data_used<req->data_size)
+                break;
+            req->in_data=0;
+            serve_reply(t,c);
+            continue;
+        }
+
+        //The header ends with an empty line
+        unsigned char* start=c->in+pos;
+        unsigned char* end=NULL;
+        for(unsigned char* p=start; p<c->in+c->in_used; p++){
+            p=memchr(p,'\n',(size_t)(c->in+c->in_used-p));
+            if(p==NULL)
+                break;
+            if(p==start || p[-1]=='\n'){
+                end=p;
+                break;
+            }
+        }
+        if(end==NULL){
+            if(c->in_used-pos>SERVE_MAX_HEADER){
+                serve_request_error(req,"the header is too long");
+                req->fatal=1;
+                serve_reply(t,c);
+            }
+            break;
+        }
+        for(unsigned char* line=start; line<end; ){
+            unsigned char* eol=memchr(line,'\n',(size_t)(end-line));
+            serve_parse_field(req,(char*)line,(size_t)(eol-line));
+            line=eol+1;
+        }
+        pos=(size_t)(end+1-c->in);
+        //The inline data is received even if the request isn't valid, so that the next request starts after it
+        if(req->has_data && !req->fatal)
+            req->in_data=1;
+        else
+            serve_reply(t,c);
+    }
+    memmove(c->in,c->in+pos,c->in_used-pos);
+    c->in_used-=pos;
+}
+
+//Read the bytes sent by the client, the inline data is read directly in its buffer when there is nothing before it
+//Return the result of read
+static ssize_t serve_receive(struct serve_client* c){
+    struct serve_request* req=&c->req;
+    ssize_t n;
+    if(req->in_data && c->in_used==0){
+        n=read(c->fd,req->data+req->data_used,req->data_size-req->data_used);
+        if(n>0)
+            req->data_used+=(size_t)n;
+        return n;
+    }
+    if(c->in_capacity-c->in_used<SERVE_READ_SIZE){
+        size_t capacity = c->in_capacity ? 2*c->in_capacity : 2*SERVE_READ_SIZE;
+        unsigned char* in=realloc(c->in,capacity);
+        if(in==NULL){
+            errno=ENOMEM;
+            return -1;
+        }
+        c->in=in;
+        c->in_capacity=capacity;
+    }
+    n=read(c->fd,c->in+c->in_used,c->in_capacity-c->in_used);
+    if(n>0)
+        c->in_used+=(size_t)n;
+    return n;
+}
+
+//Write the replies of the client, return 0 once they are all written, 1 if the socket is full and -1 on error
+static int serve_send(struct serve_client* c){
+    while(c->out_sent<c->out.used){
+        ssize_t n=write(c->out_fd,c->out.buf+c->out_sent,c->out.used-c->out_sent);
+        if(n<0){
+            if(errno==EINTR)
+                continue;
+            return errno==EAGAIN || errno==EWOULDBLOCK ? 1 : -1;
+        }
+        c->out_sent+=(size_t)n;
+    }
+    c->out.used=0;
+    c->out_sent=0;
+    return 0;
+}
+
+//Allocate a client reading "fd" and writing "out_fd", return NULL if the memory allocation fails
+static struct serve_client* serve_client_new(int fd, int out_fd){
+    struct serve_client* c=calloc(1,sizeof(struct serve_client));
+    if(c==NULL)
+        return NULL;
+    if(sink_init(&c->out,-1)!=0){
+        free(c);
+        return NULL;
+    }
+    c->fd=fd;
+    c->out_fd=out_fd;
+    serve_request_reset(&c->req);
+    return c;
+}
+
+//Release a client
+static void serve_client_free(struct serve_client* c){
+    serve_request_reset(&c->req);
+    for(int k=0;k<3;k++){
+        free(c->formats[k].program);
+        free(c->formats[k].text);
+    }
+    free(c->in);
+    free(c->out.buf);
+    free(c);
+}
+
+//Close the connection of the client "c" of the server thread
+static void serve_disconnect(struct serve_thread* t, struct serve_client* c){
+    for(struct serve_client** p=&t->clients; *p!=NULL; p=&(*p)->next){
+        if(*p==c){
+            *p=c->next;
+            break;
+        }
+    }
+    close(c->fd);
+    serve_client_free(c);
+}
+
+//Handle the events of a client: read and process its requests, write its replies
+//Return 0 if the client is still connected, -1 if the connection has been closed
+static int serve_client_event(struct serve_thread* t, int epoll_fd, struct serve_client* c, uint32_t events){
+    if((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && (c->events & EPOLLIN)){
+        ssize_t n=serve_receive(c);
+        if(n==0)
+            c->closing=1; // the client has sent all its requests
+        else if(n<0 && errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR){
+            serve_disconnect(t,c);
+            return -1;
+        }
+        if(n>0)
+            serve_process(t,c);
+    }
+
+    int pending=serve_send(c);
+    if(pending<0 || (c->closing && pending==0)){
+        serve_disconnect(t,c);
+        return -1;
+    }
+
+    //The client isn't read while its replies are not written, so a client that doesn't read them can't exhaust the memory
+    uint32_t wanted = (pending ? EPOLLOUT : 0) | (!c->closing && c->out.used<SERVE_MAX_PENDING ? EPOLLIN : 0);
+    if(wanted!=c->events){
+        struct epoll_event ev={.events=wanted,.data.ptr=c};
+        epoll_ctl(epoll_fd,EPOLL_CTL_MOD,c->fd,&ev);
+        c->events=wanted;
+    }
+    return 0;
+}
+
+//Accept the pending connections of the listening socket
+static void serve_accept(struct serve_thread* t, int epoll_fd){
+    for(;;){
+        int fd=accept(t->listen_fd,NULL,NULL);
+        if(fd<0){
+            if(errno==EINTR || errno==ECONNABORTED)
+                continue;
+            return; // no more connections (EAGAIN), or out of file descriptors
+        }
+        fcntl(fd,F_SETFL,fcntl(fd,F_GETFL)|O_NONBLOCK);
+        fcntl(fd,F_SETFD,FD_CLOEXEC);
+        struct serve_client* c=serve_client_new(fd,fd);
+        struct epoll_event ev={.events=EPOLLIN,.data.ptr=c};
+        if(c==NULL || epoll_ctl(epoll_fd,EPOLL_CTL_ADD,fd,&ev)!=0){
+            if(c!=NULL)
+                serve_client_free(c);
+            close(fd);
+            continue;
+        }
+        c->events=EPOLLIN;
+        c->next=t->clients;
+        t->clients=c;
+    }
+}
+
+//Event loop of a server thread: accept the connections and answer the requests until the server is stopped
+static void serve_loop(struct serve_thread* t){
+    struct epoll_event events[64];
+    int epoll_fd=epoll_create1(EPOLL_CLOEXEC);
+    if(epoll_fd<0)
+        return;
+
+    //The threads wait on the same listening socket, EPOLLEXCLUSIVE wakes a single one for each connection
+    struct epoll_event ev={.events=EPOLLIN | EPOLLEXCLUSIVE,.data.ptr=&t->listen_fd};
+    epoll_ctl(epoll_fd,EPOLL_CTL_ADD,t->listen_fd,&ev);
+    ev=(struct epoll_event){.events=EPOLLIN,.data.ptr=&t->stop_fd};
+    epoll_ctl(epoll_fd,EPOLL_CTL_ADD,t->stop_fd,&ev);
+
+    int running=1;
+    while(running){
+        int n=epoll_wait(epoll_fd,events,64,-1);
+        if(n<0 && errno!=EINTR)
+            break;
+        for(int i=0;i<n;i++){
+            if(events[i].data.ptr==&t->stop_fd)
+                running=0; // the signal is left pending, so that every thread sees it
+            else if(events[i].data.ptr==&t->listen_fd)
+                serve_accept(t,epoll_fd);
+            else
+                serve_client_event(t,epoll_fd,events[i].data.ptr,events[i].events);
+        }
+    }
+
+    while(t->clients!=NULL)
+        serve_disconnect(t,t->clients);
+    close(epoll_fd);
+}
+
+//Thread running an event loop besides the main one
+static void* serve_worker(void* arg){
+    stats_thread_begin("server");
+    serve_loop(arg);
+    return NULL;
+}
+
+//Answer the requests read from the standard input on the standard output until the end of the input
+static void serve_stdio(struct serve_thread* t){
+    struct serve_client* c=serve_client_new(STDIN_FILENO,STDOUT_FILENO);
+    if(c==NULL){
+        printf("Error, can't allocate memory for the server\n");
+        return;
+    }
+    while(!c->closing){
+        ssize_t n=serve_receive(c);
+        if(n<0 && errno==EINTR)
+            continue;
+        if(n<=0)
+            break;
+        serve_process(t,c);
+        if(serve_send(c)!=0)
+            break;
+    }
+    serve_client_free(c);
+}
+
+//Create the Unix domain socket "path" listening for the clients, a stale socket left by a previous server is replaced
+//Return the socket, -1 after printing the error otherwise
+static int serve_listen(const char* path){
+    struct sockaddr_un addr;
+    memset(&addr,0,sizeof(addr));
+    addr.sun_family=AF_UNIX;
+    if(strlen(path)>=sizeof(addr.sun_path)){
+        printf("Error, the socket name %s is too long\n",path);
+        return -1;
+    }
+    strcpy(addr.sun_path,path);
+
+    struct stat st;
+    if(lstat(path,&st)==0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+    int fd=socket(AF_UNIX,SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,0);
+    if(fd<0 || bind(fd,(struct sockaddr*)&addr,sizeof(addr))!=0 || listen(fd,SOMAXCONN)!=0){
+        printf("Error, can't listen on the socket %s\n",path);
+        if(fd>=0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//Run the server on the socket "endpoint" ("-" for the standard input and output) with "threads" event loops
+//The requests use the options "settings"; the server stops on SIGINT or SIGTERM, or at the end of the standard input
+int serve(const char* endpoint, const struct read_settings* settings, unsigned int threads){
+    signal(SIGPIPE,SIG_IGN); // a client closing its socket is reported by write
+
+    struct serve_thread* loops=calloc(threads,sizeof(struct serve_thread));
+    pthread_t* workers=calloc(threads,sizeof(pthread_t));
+    if(loops==NULL || workers==NULL){
+        printf("Error, can't allocate memory for the server\n");
+        free(loops);
+        free(workers);
+        return 1;
+    }
+    int result=0;
+    int listen_fd=-1, stop_fd=-1;
+    if(strcmp(endpoint,"-")!=0){
+        listen_fd=serve_listen(endpoint);
+        //The stop signals are read from a signalfd by the event loops, the threads inherit the blocked signals
+        sigset_t stop_signals;
+        sigemptyset(&stop_signals);
+        sigaddset(&stop_signals,SIGINT);
+        sigaddset(&stop_signals,SIGTERM);
+        pthread_sigmask(SIG_BLOCK,&stop_signals,NULL);
+        if(listen_fd>=0)
+            stop_fd=signalfd(-1,&stop_signals,SFD_NONBLOCK | SFD_CLOEXEC);
+        if(listen_fd<0 || stop_fd<0)
+            result=1;
+    }
+
+    for(unsigned int i=0; i<threads && result==0; i++){
+        loops[i].settings=settings;
+        loops[i].listen_fd=listen_fd;
+        loops[i].stop_fd=stop_fd;
+        if(sink_init(&loops[i].output,-1)!=0){
+            printf("Error, can't allocate memory for the server\n");
+            result=1;
+        }
+    }
+    if(result==0 && listen_fd<0){
+        serve_stdio(&loops[0]);
+    }else if(result==0){
+        unsigned int started=1;
+        for(; started<threads; started++){
+            if(pthread_create(&workers[started],NULL,serve_worker,&loops[started])!=0)
+                break;
+        }
+        serve_loop(&loops[0]);
+        for(unsigned int i=1; i<started; i++)
+            pthread_join(workers[i],NULL);
+        unlink(endpoint);
+    }
+
+    for(unsigned int i=0; i<threads; i++){
+        free(loops[i].output.buf);
+        free_context(&loops[i].ctx);
+    }
+    if(listen_fd>=0)
+        close(listen_fd);
+    if(stop_fd>=0)
+        close(stop_fd);
+    free(loops);
+    free(workers);
+    return result;
+}
+
+int main(int argc, char* argv[]){
+    if(argc < 2){
+        printf("Error, a PNG file name is required for %s \n.Try to use: %s [options] [--] file1 [[options] file2 . . . ]\n", argv[0],argv[0]);
+        return 1;
+    }
+
+    //Run the self-test of the CRC engines instead of reading PNG files
+    if(strcmp(argv[1],"--crc-selftest")==0){
+        return crc_self_test();
+    }
+
+    //Select the fastest CRC and Adler-32 engines available on this CPU
+    pngq_init();
+
+    //Array of the compiled formats, at most one per argument plus the default ones
+    struct format_program** programs=calloc(argc+3,sizeof(struct format_program*));
+    size_t nprograms=0; // number of compiled formats
+    if(programs==NULL){
+        printf("Error, can't allocate memory for the formats\n");
+        return 1;
+    }
+
+    //Array of the chunk selectors, at most one per argument
+    struct chunk_selector** selectors=calloc(argc,sizeof(struct chunk_selector*));
+    size_t nselectors=0; // number of chunk selectors
+    if(selectors==NULL){
+        printf("Error, can't allocate memory for the chunk selectors\n");
+        return 1;
+    }
+
+    //Options in force, they apply to the PNG files (and lists of files) given after them
+    struct read_settings settings;
+    settings.pformat = programs[nprograms++] = compile_format(default_pformat,PFORMAT);
+    settings.cformat = programs[nprograms++] = compile_format(default_cformat,CFORMAT);
+    settings.kformat = programs[nprograms++] = compile_format(default_kformat,KFORMAT);
+    settings.use_mmap=1; // map the regular PNG files in memory (option "--no-mmap")
+    settings.trust_crc=0; // read only the data printed by the formats without checking the CRC (option "--trust-crc")
+    settings.use_index=0; // read the files through a sidecar chunk offset index (option "--index")
+    settings.recover=0; // scan the files that can't be read for the chunks that can be salvaged (option "--recover")
+    settings.rewrite=0; // write the files again instead of printing them (option "--rewrite")
+    settings.rewrite_dir=NULL; // directory of the files written (option "--rewrite=DIR")
+    struct rewrite_targets rewrite_targets={PTHREAD_MUTEX_INITIALIZER,NULL,0,0};
+    settings.rewrite_targets=&rewrite_targets; // files written in the directories of the option "--rewrite=DIR" during the run
+    settings.strip=NULL; // chunks not written (option "--strip")
+    settings.fix_crc=0; // write the correct CRC fields (option "--fix-crc")
+    settings.select=NULL; // chunks printed with cformat and kformat (option "--chunks")
+    settings.stream_limit=0; // memory limit of the streaming mode (option "--stream"), 0 if disabled
+    settings.crc_threads=1; // number of threads checking the CRC of the chunks of a file (option "--crc-threads")
+    if(settings.pformat==NULL || settings.cformat==NULL || settings.kformat==NULL){
+        printf("Error, can't allocate memory for the formats\n");
+        return 1;
+    }
+    unsigned int threads=1; // number of worker threads (option "-j")
+    char separator='\n'; // separator of the file names of the lists (option "-0")
+    int stats=0; // statistics printed at exit (option "--stats"), 1 for a summary and 2 for JSON
+    settings.cache=NULL; // validation cache (option "--cache")
+    settings.output=OUTPUT_TEXT; // output mode (option "--output")
+    settings.deep=0; // deep validation of the image data (option "--deep")
+    unsigned int uring_depth=0; // number of files read ahead by the io_uring backend (option "--uring"), 0 if disabled
+    const char* serve_endpoint=NULL; // socket of the server mode (option "--serve"), NULL if disabled
+    struct read_settings serve_settings; // options in force for the requests of the server mode
+
+    //Array of the entries of the command line, at most one per argument
+    struct cmd_entry* entries=calloc(argc,sizeof(struct cmd_entry));
+    if(entries==NULL){
+        printf("Error, can't allocate memory for the list of PNG files\n");
+        return 1;
+    }
+    //Patterns of the directory trees (options "--include" and "--exclude"), each tree uses the ones given before it
+    struct walk_filter filter;
+    filter.include=calloc(argc,sizeof(char*));
+    filter.exclude=calloc(argc,sizeof(char*));
+    filter.include_count=0;
+    filter.exclude_count=0;
+    if(filter.include==NULL || filter.exclude==NULL){
+        printf("Error, can't allocate memory for the list of PNG files\n");
+        return 1;
+    }
+    size_t count=0; // number of entries
+    int has_file=0; // flag set when a PNG file name (or a list of them) is given
+
+    unsigned int i; // loop counter
+
+    int after_dashes=0; // flag set after the optional parameter "--", the next arguments are all PNG file names
+
+    // loop through all the line arguments
+    for (i = 1; i < argc; i++){
+
+        if(!after_dashes){
+            // check if the argument is the option "--no-mmap", the next PNG files are read with fread instead of being mapped in memory
+            if(strcmp(argv[i],"--no-mmap")==0){
+                settings.use_mmap=0;
+                continue;
+            }
+
+            // check if the argument is the option "--deep", the image data of the next PNG files is decoded and checked too
+            if(strcmp(argv[i],"--deep")==0){
+                settings.deep=1;
+                continue;
+            }
+
+            // check if the argument is the option "--trust-crc", only the data printed by the formats of the next PNG files is read
+            if(strcmp(argv[i],"--trust-crc")==0){
+                settings.trust_crc=1;
+                continue;
+            }
+
+            // check if the argument is the option "--recover", the next PNG files that can't be read are scanned again and the
+            // ranges of chunks that can be salvaged are printed with the damaged ones
+            if(strcmp(argv[i],"--recover")==0){
+                settings.recover=1;
+                continue;
+            }
+
+            // check if the argument is the option "--rewrite[=DIR]", the next PNG files are written again (in the directory DIR,
+            // or in place) without the chunks of the option "--strip" and with the CRC fields repaired by the option "--fix-crc"
+            if(strncmp(argv[i],"--rewrite",9)==0 && (argv[i][9]=='\0' || argv[i][9]=='=')){
+                settings.rewrite=1;
+                settings.rewrite_dir = argv[i][9]=='=' && argv[i][10]!='\0' ? argv[i]+10 : NULL;
+                continue;
+            }
+            if(strcmp(argv[i],"--fix-crc")==0){
+                settings.fix_crc=1;
+                continue;
+            }
+
+            // check if the argument is the option "--strip=LIST", the chunks selected by LIST (like "--chunks") are not written
+            // by the rewrite mode, except the critical ones
+            if(strncmp(argv[i],"--strip=",8)==0){
+                struct chunk_selector* selector=parse_chunk_selector(argv[i]+8);
+                if(selector==NULL){
+                    printf("Error, the chunk selector of %s is not valid, it must be a list of chunk types and chunk numbers or ranges\n",argv[i]);
+                    free(entries);
+                    return 1;
+                }
+                selectors[nselectors++]=selector;
+                settings.strip=selector;
+                continue;
+            }
+
+            // check if the argument is the option "--index", the next PNG files are read through their chunk offset index,
+            // saved in a sidecar file next to them, and only the data fields printed are read
+            if(strcmp(argv[i],"--index")==0){
+                settings.use_index=1;
+                continue;
+            }
+
+            // check if the argument is the option "--chunks=LIST", only the chunks of the next PNG files selected by LIST
+            // (chunk types and chunk numbers or ranges, e.g. "tEXt,1-10,4812") are printed with cformat and kformat
+            if(strncmp(argv[i],"--chunks=",9)==0){
+                struct chunk_selector* selector=NULL;
+                if(strcmp(argv[i]+9,"all")!=0){
+                    selector=parse_chunk_selector(argv[i]+9);
+                    if(selector==NULL){
+                        printf("Error, the chunk selector of %s is not valid, it must be a list of chunk types and chunk numbers or ranges\n",argv[i]);
+                        free(entries);
+                        return 1;
+                    }
+                    selectors[nselectors++]=selector;
+                }
+                settings.select=selector;
+                continue;
+            }
+
+            // check if the argument is the option "--stream[=SIZE]", the next PNG files are read with a memory limit of SIZE bytes
+            if(strncmp(argv[i],"--stream",8)==0 && (argv[i][8]=='\0' || argv[i][8]=='=')){
+                settings.stream_limit = argv[i][8]=='=' ? parse_stream_limit(argv[i]+9) : STREAM_DEFAULT_LIMIT;
+                if(settings.stream_limit==0){
+                    printf("Error, the memory limit of %s is not valid, it must be at least %d bytes\n",argv[i],STREAM_MIN_LIMIT);
+                    free(entries);
+                    return 1;
+                }
+                continue;
+            }
+
+            // check if the argument is the option "--crc-threads=N", the CRC of the chunks of the next large PNG files are checked by N threads
+            if(strncmp(argv[i],"--crc-threads=",14)==0){
+                char* end;
+                long n=strtol(argv[i]+14,&end,10);
+                if(end==argv[i]+14 || *end!='\0' || n<1 || n>1024){
+                    printf("Error, the number of threads of the option --crc-threads must be between 1 and 1024\n");
+                    free(entries);
+                    return 1;
+                }
+                settings.crc_threads=(unsigned int)n;
+                continue;
+            }
+
+            // check if the argument is the option "-j N" (or "-jN"), the PNG files are processed by N worker threads
+            if(strncmp(argv[i],"-j",2)==0){
+                const char* value = argv[i][2]!='\0' ? argv[i]+2 : (i+1<argc ? argv[++i] : "");
+                char* end;
+                long n=strtol(value,&end,10);
+                if(end==value || *end!='\0' || n<1 || n>1024){
+                    printf("Error, the number of threads of the option -j must be between 1 and 1024\n");
+                    free(entries);
+                    return 1;
+                }
+                threads=(unsigned int)n;
+                continue;
+            }
+
+            // check if the argument is the option "--stats[=json]", the statistics of the run are printed to the standard error at exit
+            if(strcmp(argv[i],"--stats")==0 || strcmp(argv[i],"--stats=json")==0){
+                stats = argv[i][7]=='=' ? 2 : 1;
+                continue;
+            }
+
+            // check if the argument is the option "--cache=FILE", the validation of the next PNG files is saved in the cache file FILE
+            // and the files unchanged since a previous run are printed from the cache without being read
+            if(strncmp(argv[i],"--cache=",8)==0){
+                if(settings.cache!=NULL || argv[i][8]=='\0'){
+                    printf("Error, the option --cache requires the name of a single cache file\n");
+                    cache_free(settings.cache);
+                    free(entries);
+                    return 1;
+                }
+                settings.cache=cache_open(argv[i]+8);
+                if(settings.cache==NULL){
+                    printf("Error, can't allocate memory for the validation cache\n");
+                    free(entries);
+                    return 1;
+                }
+                continue;
+            }
+
+            // check if the argument is the option "--output=MODE", the information about the next PNG files is printed as
+            // text following the formats, as a JSON object per line or as binary records
+            if(strncmp(argv[i],"--output=",9)==0){
+                if(strcmp(argv[i]+9,"text")==0)
+                    settings.output=OUTPUT_TEXT;
+                else if(strcmp(argv[i]+9,"ndjson")==0)
+                    settings.output=OUTPUT_NDJSON;
+                else if(strcmp(argv[i]+9,"binary")==0)
+                    settings.output=OUTPUT_BINARY;
+                else{
+                    printf("Error, the output mode of %s is not valid, it must be text, ndjson or binary\n",argv[i]);
+                    cache_free(settings.cache);
+                    free(entries);
+                    return 1;
+                }
+                continue;
+            }
+
+            // check if the argument is the option "--uring[=DEPTH]", the PNG files are opened and read ahead by the io_uring backend
+            if(strncmp(argv[i],"--uring",7)==0 && (argv[i][7]=='\0' || argv[i][7]=='=')){
+                long n=URING_DEFAULT_DEPTH;
+                if(argv[i][7]=='='){
+                    char* end;
+                    n=strtol(argv[i]+8,&end,10);
+                    if(end==argv[i]+8 || *end!='\0' || n<1 || n>URING_MAX_DEPTH){
+                        printf("Error, the queue depth of the option --uring must be between 1 and %d\n",URING_MAX_DEPTH);
+                        free(entries);
+                        return 1;
+                    }
+                }
+                uring_depth=(unsigned int)n;
+                continue;
+            }
+
+            // check if the argument is the option "--serve=SOCKET", pngq answers the requests received on the Unix domain socket
+            // SOCKET ("-" for the standard input and output) with the options given before it, instead of reading PNG files
+            if(strncmp(argv[i],"--serve=",8)==0){
+                if(argv[i][8]=='\0'){
+                    printf("Error, the option --serve requires the name of a socket\n");
+                    free(entries);
+                    return 1;
+                }
+                serve_endpoint=argv[i]+8;
+                serve_settings=settings;
+                continue;
+            }
+
+            // check if the argument is the option "-0", the file names of the next lists are separated by null characters
+            if(strcmp(argv[i],"-0")==0){
+                separator='\0';
+                continue;
+            }
+
+            // check if the argument is the option "-@ LIST" (or "-@LIST"), the PNG file names are read from the file LIST
+            // ("-" for the standard input), one per line, with the options in force
+            if(strncmp(argv[i],"-@",2)==0){
+                char* list = argv[i][2]!='\0' ? argv[i]+2 : (i+1<argc ? argv[++i] : NULL);
+                if(list==NULL){
+                    printf("Error, the option -@ requires the name of a list of files\n");
+                    free(entries);
+                    return 1;
+                }
+                entries[count].kind=JOB_LIST;
+                entries[count].name=list;
+                entries[count].separator=separator;
+                entries[count].settings=settings;
+                count++;
+                has_file=1;
+                continue;
+            }
+
+            // check if the argument is the option "-r DIR" (or "-rDIR"), the PNG files of the directory tree DIR are read with
+            // the options in force; the files that don't start with the PNG signature are skipped
+            if(strncmp(argv[i],"-r",2)==0){
+                char* dir = argv[i][2]!='\0' ? argv[i]+2 : (i+1<argc ? argv[++i] : NULL);
+                if(dir==NULL){
+                    printf("Error, the option -r requires the name of a directory\n");
+                    free(entries);
+                    return 1;
+                }
+                entries[count].kind=JOB_DIR;
+                entries[count].name=dir;
+                entries[count].filter=filter;
+                entries[count].settings=settings;
+                count++;
+                has_file=1;
+                continue;
+            }
+
+            // check if the argument is the option "--include=PATTERN" or "--exclude=PATTERN", only the files matching one
+            // of the include patterns are read in the next directory trees, and the files and directories matching one of
+            // the exclude patterns are skipped (a pattern with a '/' matches the path relative to the tree, the name otherwise)
+            if(strncmp(argv[i],"--include=",10)==0){
+                filter.include[filter.include_count++]=argv[i]+10;
+                continue;
+            }
+            if(strncmp(argv[i],"--exclude=",10)==0){
+                filter.exclude[filter.exclude_count++]=argv[i]+10;
+                continue;
+            }
+
+            // check if the argument is the optional parameter "--"
+            if(strcmp(argv[i],"--")==0){
+                //compute the next arguments as PNG file names
+                //"--" is not allowed after a PNG file name that could be opened, this is checked when the files are processed
+                if(has_file)
+                    entries[count++].kind=JOB_DASHES;
+                after_dashes=1;
+                continue;
+            }
+
+            // any other argument starting with "--" is an option that isn't valid or misses its value
+            if(strncmp(argv[i],"--",2)==0){
+                printf("Error, the option %s is not valid\n",argv[i]);
+                cache_free(settings.cache);
+                free(entries);
+                return 1;
+            }
+
+            //Update the reference to the format values
+
+            //Check if the argument is the optional parameter "p=" for setting up the "pformat" value
+            if(strncmp(argv[i],"p=",2)==0){
+                settings.pformat = programs[nprograms++] = compile_format(argv[i]+2,PFORMAT); // set the "pformat" value to the format specified in the argument
+                if(settings.pformat==NULL){
+                    printf("Error, can't allocate memory for the formats\n");
+                    return 1;
+                }
+                continue;
+            }
+            if(strncmp(argv[i],"c=",2)==0){
+                settings.cformat = programs[nprograms++] = compile_format(argv[i]+2,CFORMAT); // set the "cformat" value to the format specified in the argument
+                if(settings.cformat==NULL){
+                    printf("Error, can't allocate memory for the formats\n");
+                    return 1;
+                }
+                continue;
+            }
+            if(strncmp(argv[i],"k=",2)==0){
+                settings.kformat = programs[nprograms++] = compile_format(argv[i]+2,KFORMAT); // set the "kformat" value to the format specified in the argument
+                if(settings.kformat==NULL){
+                    printf("Error, can't allocate memory for the formats\n");
+                    return 1;
+                }
+                continue;
+            }
+        }
+
+        // add the PNG file name to the files to process with the current options
+        entries[count].kind=JOB_FILE;
+        entries[count].name=argv[i];
+        entries[count].settings=settings;
+        count++;
+        has_file=1;
+    }
+
+    if(serve_endpoint!=NULL && has_file){
+        printf("Error, the option --serve can't be used with PNG file names\n");
+        free(entries);
+        return 1;
+    }
+
+#ifndef PNGQ_NO_STATS
+    uint64_t start_ns=0; // start of the processing of the PNG files
+    if(stats){
+        stats_enabled=1;
+        stats_thread_begin("main");
+        start_ns=stats_now();
+    }
+#else
+    if(stats)
+        printf("Error, the option --stats is not available, pngq is compiled with PNGQ_NO_STATS\n");
+#endif
+
+    struct job_source source;
+    memset(&source,0,sizeof(source));
+    source.entries=entries;
+    source.count=count;
+    //Without io_uring the files are read with the blocking path
+    if(uring_depth>0)
+        source.uring=uring_init(uring_depth);
+
+    int result=0;
+    if(serve_endpoint!=NULL)
+        result=serve(serve_endpoint,&serve_settings,threads); // the requests are answered by "threads" event loops
+    else if(threads>1)
+        process_parallel(&source,threads);
+    else
+        process_serial(&source);
+
+    free_job_source(&source);
+
+    //Save the validation of the files read during the run
+    if(settings.cache!=NULL){
+        if(cache_save(settings.cache)!=0)
+            printf("Error, can't update the validation cache %s\n",settings.cache->path);
+        cache_free(settings.cache);
+    }
+#ifndef PNGQ_NO_STATS
+    if(stats){
+        stats_report(stats==2,stats_now()-start_ns);
+        stats_free();
+    }
+#endif
+    rewrite_targets_free(&rewrite_targets);
+    free(entries);
+    free(filter.include);
+    free(filter.exclude);
+    for(size_t f=0;f<nselectors;f++)
+        free(selectors[f]);
+    free(selectors);
+    for(size_t f=0;f<nprograms;f++)
+        free(programs[f]);
+    free(programs);
+    return result;
 }
@@ -0,0 +1,184 @@
+/*
+pngq library : reading and validating Portable Network Graphics files
+
+The library holds the PNG reader used by the pngq program, so that it can be embedded in other programs without starting
+a process for each file. It has no global state besides the checksum engines and the fixed Huffman tables, which are selected
+or built once (pngq_init) and never change afterwards: every reader is an independent handle, several threads can read
+different files at the same time without any lock, a single reader must not be used by two threads at once.
+
+    struct pngq_reader* reader;
+    struct pngq_chunk chunk;
+    int status = pngq_open_path(&reader, "image.png", 0);
+    if(status == PNGQ_OK){
+        while((status = pngq_next_chunk(reader, &chunk)) == 1)
+            printf("%.4s %u\n", (const char*)chunk.type, chunk.length);
+        if(status == PNGQ_OK)
+            status = pngq_validate(reader, PNGQ_DEEP);
+        pngq_close(reader);
+    }
+    if(status < 0)
+        printf("Error, %s\n", pngq_strerror(status));
+
+The status codes are PNGQ_OK (0) or a negative PNGQ_ERR_* value, pngq_next_chunk returns 1 for each chunk.
+
+Compile the library together with the program: gcc -O2 -pthread program.c libpngq.c
+*/
+
+#ifndef PNGQ_H
+#define PNGQ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//Status codes
+enum pngq_status{
+    PNGQ_OK = 0,
+    PNGQ_ERR_OPEN = -1,                 // the file can't be opened
+    PNGQ_ERR_READ = -2,                 // the file can't be read
+    PNGQ_ERR_MEMORY = -3,               // a memory allocation failed
+    PNGQ_ERR_SIGNATURE_SHORT = -4,      // the file is shorter than the PNG signature
+    PNGQ_ERR_SIGNATURE = -5,            // the file doesn't start with the PNG signature
+    PNGQ_ERR_LENGTH_FIELD = -6,         // a chunk length field is truncated
+    PNGQ_ERR_TYPE_FIELD = -7,           // a chunk type field is truncated
+    PNGQ_ERR_CHUNK_TYPE = -8,           // a chunk type field has characters that are not letters or digits
+    PNGQ_ERR_DATA_FIELD = -9,           // a chunk data field is truncated
+    PNGQ_ERR_CRC_FIELD = -10,           // a chunk CRC field is truncated
+    PNGQ_ERR_CRC = -11,                 // a chunk CRC field is not correct
+    PNGQ_ERR_NO_IHDR = -12,             // the first chunk isn't a complete IHDR chunk
+    PNGQ_ERR_IHDR = -13,                // the IHDR bit depth isn't valid for the color type
+    PNGQ_ERR_COLOR_TYPE = -14,          // the IHDR color type isn't defined
+    PNGQ_ERR_IHDR_METHOD = -15,         // the IHDR compression, filter or interlace method isn't defined
+    PNGQ_ERR_NO_IDAT = -16,             // there is no IDAT chunk
+    PNGQ_ERR_IDAT_SPLIT = -17,          // the IDAT chunks are not consecutive
+    PNGQ_ERR_ZLIB_HEADER = -18,         // the zlib header of the image data isn't valid
+    PNGQ_ERR_ZLIB_DATA = -19,           // the deflate stream of the image data isn't valid
+    PNGQ_ERR_ZLIB_TRUNCATED = -20,      // the deflate stream of the image data is truncated
+    PNGQ_ERR_ADLER = -21,               // the Adler-32 of the image data isn't correct
+    PNGQ_ERR_FILTER = -22,              // a scanline filter type isn't valid
+    PNGQ_ERR_IMAGE_LARGE = -23,         // the image data is larger than the size given by IHDR
+    PNGQ_ERR_IMAGE_SMALL = -24,         // the image data is smaller than the size given by IHDR
+    PNGQ_ERR_IMAGE_EXTRA = -25,         // there are bytes after the end of the zlib stream of the image data
+    PNGQ_ERR_STOPPED = -26              // the output callback of pngq_inflate_zlib stopped the decoding
+};
+
+//Flags of the readers and of pngq_validate
+#define PNGQ_NO_CRC 1u                  // pngq_next_chunk doesn't check the CRC fields (pngq_validate always checks them)
+#define PNGQ_DEEP 2u                    // pngq_validate decodes the image data and checks it too
+
+//Chunk returned by pngq_next_chunk, the data field points into the file read by the reader
+struct pngq_chunk{
+    uint32_t num;                       // chunk number, from 1
+    uint32_t length;                    // length of the data field
+    unsigned char type[4];              // type field
+    const unsigned char* data;          // data field, valid until the reader is closed
+    uint32_t crc;                       // CRC field
+    uint64_t offset;                    // offset of the chunk (length field) in the file
+};
+
+//IHDR chunk fields
+struct pngq_ihdr{
+    uint32_t width;
+    uint32_t height;
+    uint8_t bit_depth;
+    uint8_t color_type;
+    uint8_t compression;
+    uint8_t filter;
+    uint8_t interlace;
+};
+
+struct pngq_reader;
+
+//Select the checksum engines of the CPU and build the tables of the library, it's done by the first pngq_open_* otherwise
+void pngq_init(void);
+
+//Open a reader of the PNG file "path", of the file descriptor "fd" (not closed by the reader) or of the buffer data[0..size-1]
+//(not copied, it must stay valid until the reader is closed); regular files are mapped in memory, the other ones read
+//The PNG signature is checked, the reader is returned in "reader" when the status is PNGQ_OK
+int pngq_open_path(struct pngq_reader** reader, const char* path, unsigned int flags);
+int pngq_open_fd(struct pngq_reader** reader, int fd, unsigned int flags);
+int pngq_open_memory(struct pngq_reader** reader, const void* data, size_t size, unsigned int flags);
+
+//Release the reader and the file it has read
+void pngq_close(struct pngq_reader* reader);
+
+//Read the next chunk, return 1 and fill "chunk", PNGQ_OK after the IEND chunk or an error status (the next calls return it too)
+int pngq_next_chunk(struct pngq_reader* reader, struct pngq_chunk* chunk);
+
+//Restart the iteration from the first chunk
+void pngq_rewind(struct pngq_reader* reader);
+
+//Read the IHDR chunk fields, return PNGQ_OK or PNGQ_ERR_NO_IHDR (the fields aren't checked, see pngq_check_ihdr)
+int pngq_get_ihdr(struct pngq_reader* reader, struct pngq_ihdr* ihdr);
+
+//Read the IHDR fields from the data field data[0..length-1], return PNGQ_OK or PNGQ_ERR_NO_IHDR
+int pngq_parse_ihdr(const unsigned char* data, size_t length, struct pngq_ihdr* ihdr);
+
+//Check the IHDR fields: bit depth valid for the color type (PNGQ_ERR_IHDR), color type defined (PNGQ_ERR_COLOR_TYPE), then
+//compression, filter and interlace methods (PNGQ_ERR_IHDR_METHOD); return PNGQ_OK or the first error found
+int pngq_check_ihdr(const struct pngq_ihdr* ihdr);
+
+//Check the whole file: structure and CRC of every chunk up to IEND, IHDR first with valid fields, at least one IDAT chunk and
+//no other chunk between them, and with PNGQ_DEEP the image data (see pngq_check_image_data); return PNGQ_OK or the first
+//error found, the reader is rewound
+int pngq_validate(struct pngq_reader* reader, unsigned int flags);
+
+//Check if the chunk type field is valid, each byte must be a letter or a digit
+int pngq_valid_chunk_type(const unsigned char* type);
+
+//Message describing a status, as printed by pngq after "Error, " (e.g. "the chunk CRC field is not correct")
+const char* pngq_strerror(int status);
+
+//Update a running CRC-32 (initialized to 0xffffffff, complemented at the end) with the bytes buf[0..len-1]
+uint32_t pngq_crc32_update(uint32_t crc, const unsigned char* buf, size_t len);
+
+//Update a running Adler-32 (initialized to 1) with the bytes buf[0..len-1]
+uint32_t pngq_adler32_update(uint32_t adler, const unsigned char* buf, size_t len);
+
+//Names of the CRC engines, from the most preferred one, and the engine in use
+size_t pngq_crc_engine_count(void);
+const char* pngq_crc_engine_name(size_t engine);
+const char* pngq_crc_engine_in_use(void);
+
+//Check if the CPU supports the CRC engine number "engine"
+int pngq_crc_engine_available(size_t engine);
+
+//Compare the CRC engine number "engine" against the reference version, return the number of errors, -1 if the CPU doesn't
+//support the engine or the test buffer can't be allocated
+int pngq_crc_engine_check(size_t engine);
+
+/*
+    Streaming decoder of zlib streams
+    The input is pulled from segments returned one after the other by the input callback (0 when there are no more segments),
+    the decoded bytes are handed to the output callback through a 32 KiB window (a non-zero result stops the decoding).
+*/
+
+typedef int (*pngq_input_fn)(void* arg, const unsigned char** data, size_t* length);
+typedef int (*pngq_output_fn)(void* arg, const unsigned char* data, size_t length);
+
+struct pngq_inflater;
+
+//Allocate and release a decoder, a decoder can decode any number of streams one after the other
+struct pngq_inflater* pngq_inflater_new(void);
+void pngq_inflater_free(struct pngq_inflater* inflater);
+
+//Decode a zlib stream, the Adler-32 field of the stream is saved in "adler" (it's not checked)
+//Return PNGQ_OK, PNGQ_ERR_ZLIB_HEADER, PNGQ_ERR_ZLIB_DATA, PNGQ_ERR_ZLIB_TRUNCATED or PNGQ_ERR_STOPPED; the bytes decoded
+//before an error in the stream are handed to the output callback
+int pngq_inflate_zlib(struct pngq_inflater* inflater, pngq_input_fn input, void* input_arg, pngq_output_fn output, void* output_arg, uint32_t* adler);
+
+//Check if the input of the last stream decoded has bytes left after the end of the stream
+int pngq_inflate_input_left(struct pngq_inflater* inflater);
+
+//Decode the image data, whose IDAT data fields are returned by "input", and check its zlib stream, Adler-32, scanline filter
+//types and size against the IHDR fields (checked first), without keeping the decoded image; return PNGQ_OK or the error found
+int pngq_check_image_data(struct pngq_inflater* inflater, const struct pngq_ihdr* ihdr, pngq_input_fn input, void* input_arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
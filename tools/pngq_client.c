@@ -0,0 +1,211 @@
+/*
+Client of the pngq server mode
+
+The client connects to a pngq server (pngq --serve=SOCKET) and sends it a request for each PNG file given on the command line,
+one after the other, printing the replies on the standard output: the output is the same as the one of pngq run on the files.
+It's meant for testing the server locally and as an example of the protocol.
+
+Usage: pngq_client SOCKET [options] file1 [[options] file2 . . . ]
+    p=FORMAT, c=FORMAT, k=FORMAT : pformat, cformat and kformat of the next files (default: the ones of the server)
+    --output=MODE : output mode of the next files, text, ndjson or binary
+    --deep, --no-deep : deep validation of the image data of the next files
+    --data : send the content of the next files inline instead of their names, so the server doesn't need to read them
+             (the name printed is the one given on the command line)
+
+Notes about the imported libraries:
+    - sys/socket.h, sys/un.h : for the connection to the Unix domain socket of the server
+    - unistd.h, errno.h : for reading and writing the socket
+
+Compile with: gcc -O2 tools/pngq_client.c -o pngq_client
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+//Write buf[0..len-1] to the file descriptor "fd", return 0 on success
+static int write_all(int fd, const void* buf, size_t len){
+    const char* p = buf;
+    while(len > 0){
+        ssize_t n = write(fd, p, len);
+        if(n < 0){
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+//Read exactly len bytes from the file descriptor "fd", return 0 on success
+static int read_all(int fd, void* buf, size_t len){
+    char* p = buf;
+    while(len > 0){
+        ssize_t n = read(fd, p, len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+//Append the field "name" with the value "value" to the request, escaping the newlines, tabs and backslashes
+//Return the new length of the request, which must hold at least 6 + 2 * strlen(value) more bytes
+static size_t put_field(char* request, size_t length, const char* name, const char* value){
+    length += (size_t)sprintf(request + length, "%s ", name);
+    for(; *value != '\0'; value++){
+        if(*value == '\n' || *value == '\t' || *value == '\\'){
+            request[length++] = '\\';
+            request[length++] = *value == '\n' ? 'n' : *value == '\t' ? 't' : '\\';
+        }else{
+            request[length++] = *value;
+        }
+    }
+    request[length++] = '\n';
+    return length;
+}
+
+//Read the whole content of the file "path", return NULL if it can't be read
+static char* read_file(const char* path, size_t* size){
+    FILE* f = fopen(path, "rb");
+    if(f == NULL)
+        return NULL;
+    size_t capacity = 65536, used = 0;
+    char* data = malloc(capacity);
+    while(data != NULL){
+        used += fread(data + used, 1, capacity - used, f);
+        if(used < capacity)
+            break;
+        capacity *= 2;
+        char* bigger = realloc(data, capacity);
+        if(bigger == NULL)
+            free(data);
+        data = bigger;
+    }
+    if(data != NULL && ferror(f)){
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    *size = used;
+    return data;
+}
+
+int main(int argc, char* argv[]){
+    if(argc < 3){
+        printf("Error, a socket and a PNG file name are required.Try to use: %s SOCKET [options] file1 [[options] file2 . . . ]\n", argv[0]);
+        return 1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(argv[1]) >= sizeof(addr.sun_path)){
+        printf("Error, the socket name %s is too long\n", argv[1]);
+        return 1;
+    }
+    strcpy(addr.sun_path, argv[1]);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0){
+        printf("Error, can't connect to the server %s\n", argv[1]);
+        return 1;
+    }
+
+    //Options in force, sent with every request
+    const char* formats[3] = {NULL, NULL, NULL};
+    const char* output = NULL;
+    int deep = -1, inline_data = 0;
+    int result = 0;
+
+    for(int i = 2; i < argc; i++){
+        if((argv[i][0] == 'p' || argv[i][0] == 'c' || argv[i][0] == 'k') && argv[i][1] == '='){
+            formats[argv[i][0] == 'p' ? 0 : argv[i][0] == 'c' ? 1 : 2] = argv[i] + 2;
+            continue;
+        }
+        if(strncmp(argv[i], "--output=", 9) == 0){
+            output = argv[i] + 9;
+            continue;
+        }
+        if(strcmp(argv[i], "--deep") == 0 || strcmp(argv[i], "--no-deep") == 0){
+            deep = argv[i][2] == 'd';
+            continue;
+        }
+        if(strcmp(argv[i], "--data") == 0){
+            inline_data = 1;
+            continue;
+        }
+
+        //Request of the file
+        size_t room = 64 + 2 * strlen(argv[i]) + (output != NULL ? 2 * strlen(output) : 0);
+        for(int k = 0; k < 3; k++)
+            room += formats[k] != NULL ? 8 + 2 * strlen(formats[k]) : 0;
+        char* request = malloc(room);
+        char* data = NULL;
+        size_t data_size = 0;
+        if(request == NULL){
+            printf("Error, can't allocate memory for the request\n");
+            result = 1;
+            break;
+        }
+        size_t length = 0;
+        if(inline_data){
+            data = read_file(argv[i], &data_size);
+            if(data == NULL){
+                printf("Error, can't open the file %s\n", argv[i]);
+                free(request);
+                continue;
+            }
+            length = put_field(request, length, "name", argv[i]);
+            length += (size_t)sprintf(request + length, "data %zu\n", data_size);
+        }else{
+            length = put_field(request, length, "file", argv[i]);
+        }
+        static const char* const names[3] = {"p", "c", "k"};
+        for(int k = 0; k < 3; k++){
+            if(formats[k] != NULL)
+                length = put_field(request, length, names[k], formats[k]);
+        }
+        if(output != NULL)
+            length = put_field(request, length, "output", output);
+        if(deep >= 0)
+            length += (size_t)sprintf(request + length, "deep %d\n", deep);
+        request[length++] = '\n';
+
+        int sent = write_all(fd, request, length) == 0 && write_all(fd, data, data_size) == 0;
+        free(request);
+        free(data);
+
+        //Reply: its length on a line, then the output of the file
+        char header[32];
+        size_t used = 0;
+        while(sent && used < sizeof(header) - 1 && read_all(fd, header + used, 1) == 0 && header[used] != '\n')
+            used++;
+        header[used] = '\0';
+        char* end;
+        unsigned long long reply_size = strtoull(header, &end, 10);
+        char* reply = NULL;
+        if(!sent || end == header || *end != '\0' || (reply = malloc(reply_size > 0 ? reply_size : 1)) == NULL ||
+           read_all(fd, reply, reply_size) != 0){
+            printf("Error, the server %s doesn't answer\n", argv[1]);
+            free(reply);
+            result = 1;
+            break;
+        }
+        fflush(stdout);
+        write_all(STDOUT_FILENO, reply, reply_size);
+        free(reply);
+    }
+
+    close(fd);
+    return result;
+}